@@ -0,0 +1,352 @@
+/*
+    Измерение производительности расчета CRC, разбора кадров и кодирования запросов и ответов
+
+    make bench
+    ./wb-modbus-bench capture.bin   - разбор принятых данных из записи обмена (-w), теми же участками
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "modbus_crc.h"
+#include "modbus_ext.h"
+#include "frame_parser.h"
+#include "frame_codec.h"
+#include "bus_timing.h"
+#include "bus_capture.h"
+
+#define BENCH_TIME_NS               (300 * NSEC_PER_MSEC)
+#define STREAM_FRAMES               1024
+#define STREAM_CHUNK                64
+
+static uint16_t byte_table[256];
+
+// побитовый расчет по определению, эталон для проверки
+static uint16_t crc_bitwise(uint16_t crc, const uint8_t * data, uint32_t len)
+{
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+// побайтовый расчет по одной таблице (прежняя реализация), для сравнения скорости
+static uint16_t crc_bytewise(uint16_t crc, const uint8_t * data, uint32_t len)
+{
+    while (len--) {
+        crc = (crc >> 8) ^ byte_table[(*data++ ^ crc) & 0xFF];
+    }
+    return crc;
+}
+
+static int check_crc(void)
+{
+    static uint8_t buf[1024];
+    for (unsigned i = 0; i < sizeof(buf); i++) {
+        buf[i] = rand();
+    }
+
+    for (uint32_t len = 0; len <= sizeof(buf); len++) {
+        uint16_t iv = rand();
+        uint32_t offset = rand() % 8;
+        if (offset + len > sizeof(buf)) {
+            offset = 0;
+        }
+        if (modbus_crc_iv(iv, &buf[offset], len) != crc_bitwise(iv, &buf[offset], len)) {
+            printf("CRC MISMATCH: len %u offset %u\n", len, offset);
+            return -1;
+        }
+    }
+    printf("crc check: ok\n");
+    return 0;
+}
+
+static void bench_crc(const char * name, uint16_t (*crc_fn)(uint16_t, const void *, uint32_t), uint32_t len)
+{
+    uint8_t * buf = malloc(len);
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = rand();
+    }
+
+    uint64_t bytes = 0;
+    volatile uint16_t sink = 0;
+    uint64_t start = bus_time_now_ns();
+    uint64_t elapsed;
+    do {
+        for (int i = 0; i < 64; i++) {
+            sink ^= crc_fn(0xFFFF, buf, len);
+        }
+        bytes += 64 * len;
+        elapsed = bus_time_now_ns() - start;
+    } while (elapsed < BENCH_TIME_NS);
+
+    printf("crc %-10s %6u bytes: %9.1f MB/s\n", name, len, (double)bytes * NSEC_PER_SEC / elapsed / 1e6);
+    free(buf);
+}
+
+static uint16_t crc_bytewise_fn(uint16_t iv, const void * data, uint32_t len)
+{
+    return crc_bytewise(iv, data, len);
+}
+
+// поток ответов на запрос событий, перед каждым байты арбитража
+static int build_stream(uint8_t * stream, int preamble)
+{
+    int len = 0;
+    for (int n = 0; n < STREAM_FRAMES; n++) {
+        memset(&stream[len], ARBITRATION_BYTE, preamble);
+        len += preamble;
+
+        uint8_t * f = &stream[len];
+        int data_len = 4 + (n % 8) * 6;
+        f[0] = 1 + n % 247;
+        f[1] = SPECIAL_CMD;
+        f[2] = CMD_EXT_EVENTS_RESP;
+        f[3] = n & 1;
+        f[4] = 1;
+        f[5] = data_len;
+        for (int i = 0; i < data_len; i++) {
+            f[6 + i] = rand();
+        }
+        uint16_t crc = modbus_crc(f, 6 + data_len);
+        f[6 + data_len] = crc & 0xFF;
+        f[7 + data_len] = crc >> 8;
+        len += 8 + data_len;
+    }
+    return len;
+}
+
+static void bench_parser(int preamble)
+{
+    int stream_max = STREAM_FRAMES * (preamble + 8 + 7 * 6 + 4);
+    uint8_t * stream = malloc(stream_max);
+    int stream_len = build_stream(stream, preamble);
+
+    static frame_parser_t parser;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t start = bus_time_now_ns();
+    uint64_t elapsed;
+
+    do {
+        frame_parser_reset(&parser);
+        int pos = 0;
+        while (pos < stream_len) {
+            int space;
+            uint8_t * wp = frame_parser_write_ptr(&parser, &space);
+            int chunk = stream_len - pos;
+            if (chunk > STREAM_CHUNK) {
+                chunk = STREAM_CHUNK;
+            }
+            if (chunk > space) {
+                chunk = space;
+            }
+            memcpy(wp, &stream[pos], chunk);
+            frame_parser_commit(&parser, chunk);
+            pos += chunk;
+
+            uint8_t * frame;
+            int len;
+            while ((len = frame_parser_next(&parser, &frame)) != FRAME_NEED_MORE) {
+                if (len < 0) {
+                    printf("PARSER ERROR %d\n", len);
+                    exit(EXIT_FAILURE);
+                }
+                frames++;
+            }
+        }
+        bytes += stream_len;
+        elapsed = bus_time_now_ns() - start;
+    } while (elapsed < BENCH_TIME_NS);
+
+    if (frames % STREAM_FRAMES) {
+        printf("PARSER LOST FRAMES\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("parser preamble %3d bytes: %9.1f MB/s %10.0f frames/s\n", preamble,
+        (double)bytes * NSEC_PER_SEC / elapsed / 1e6, (double)frames * NSEC_PER_SEC / elapsed);
+    free(stream);
+}
+
+// ответ из заголовка и данных с CRC
+static int make_resp(uint8_t * f, const uint8_t * body, int len)
+{
+    memcpy(f, body, len);
+    uint16_t crc = modbus_crc(f, len);
+    f[len] = crc & 0xFF;
+    f[len + 1] = crc >> 8;
+    return len + 2;
+}
+
+// кодирование запросов и разбор ответов каждого типа: время на кадр не должно зависеть от функции
+static void bench_codec(void)
+{
+    static const struct {
+        const char * name;
+        uint8_t body[16];
+        int len;
+    } resps[] = {
+        { "scan_resp", { SPECIAL_ADDRESS, SPECIAL_CMD, CMD_EXT_SCAN_RESP, 0x09, 0x3E, 0x44, 0xC6, 0x01 }, 8 },
+        { "scan_end", { SPECIAL_ADDRESS, SPECIAL_CMD, CMD_EXT_SCAN_END }, 3 },
+        { "events", { 0x01, SPECIAL_CMD, CMD_EXT_EVENTS_RESP, 0x00, 0x01, 0x06, 0x02, 0x04, 0x00, 0x01, 0x12, 0x34 }, 12 },
+        { "events_end", { SPECIAL_ADDRESS, SPECIAL_CMD, CMD_EXT_EVENTS_END }, 3 },
+        { "event_ctrl", { 0x01, SPECIAL_CMD, CMD_EXT_EVENTS_CTRL, 0x01, 0x01 }, 5 },
+        { "pdu_read", { SPECIAL_ADDRESS, SPECIAL_CMD, CMD_EXT_STD_PDU_RESP, 0x09, 0x3E, 0x44, 0xC6, 0x03, 0x02, 0x00, 0x2A }, 11 },
+        { "pdu_write", { SPECIAL_ADDRESS, SPECIAL_CMD, CMD_EXT_STD_PDU_RESP, 0x09, 0x3E, 0x44, 0xC6, 0x06, 0x00, 0x80, 0x00, 0x2A }, 12 },
+        { "pdu_except", { SPECIAL_ADDRESS, SPECIAL_CMD, CMD_EXT_STD_PDU_RESP, 0x09, 0x3E, 0x44, 0xC6, 0x83, 0x02 }, 9 },
+    };
+
+    uint8_t buf[FRAME_MAX_LEN];
+    static const uint8_t coils[16] = { 0xCD, 0x01 };
+    static const uint16_t regs[16] = { 0x000A, 0x0102 };
+    volatile uint32_t sink = 0;
+
+    for (int k = 0; k < 8; k++) {
+        uint64_t frames = 0;
+        uint64_t start = bus_time_now_ns();
+        uint64_t elapsed;
+        const char * name = "";
+        do {
+            for (int i = 0; i < 64; i++) {
+                switch (k) {
+                case 0: name = "scan"; sink ^= frame_encode_scan(buf, SPECIAL_CMD, CMD_EXT_SCAN_NEXT); break;
+                case 1: name = "read_regs"; sink ^= frame_encode_read_regs(buf, SPECIAL_CMD, i, 0x03, 200, 20); break;
+                case 2: name = "write_reg"; sink ^= frame_encode_write_reg(buf, SPECIAL_CMD, i, 128, i); break;
+                case 5: name = "write_coil"; sink ^= frame_encode_write_coil(buf, SPECIAL_CMD, i, 0, i & 1); break;
+                case 6: name = "write_coils"; sink ^= frame_encode_write_coils(buf, SPECIAL_CMD, i, 0, 10, coils); break;
+                case 7: name = "write_regs"; sink ^= frame_encode_write_regs(buf, SPECIAL_CMD, i, 0, 16, regs); break;
+                case 3: name = "event_req"; sink ^= frame_encode_event_req(buf, 1, 100, i, i & 1); break;
+                case 4: name = "event_ctrl"; memset(&buf[FRAME_EVENT_CTRL_HEADER_LEN], 0, 5); sink ^= frame_encode_event_ctrl(buf, i, 5); break;
+                }
+                sink ^= buf[1];
+            }
+            frames += 64;
+            elapsed = bus_time_now_ns() - start;
+        } while (elapsed < BENCH_TIME_NS / 4);
+        printf("encode %-11s %6.1f ns/frame\n", name, (double)elapsed / frames);
+    }
+
+    for (unsigned k = 0; k < sizeof(resps) / sizeof(resps[0]); k++) {
+        int len = make_resp(buf, resps[k].body, resps[k].len);
+        uint64_t frames = 0;
+        uint64_t start = bus_time_now_ns();
+        uint64_t elapsed;
+        do {
+            for (int i = 0; i < 64; i++) {
+                frame_view_t v;
+                frame_scan_resp_t scan;
+                frame_pdu_resp_t pdu;
+                frame_event_ctrl_resp_t ctrl;
+                const struct ext_modbus_event_resp * ev;
+                if (frame_decode(buf, len, &v) != 0) {
+                    printf("CODEC ERROR %s\n", resps[k].name);
+                    exit(EXIT_FAILURE);
+                }
+                switch (v.cmd) {
+                case CMD_EXT_SCAN_RESP: sink ^= (frame_decode_scan_resp(&v, &scan) == 0) ? scan.serial : 0; break;
+                case CMD_EXT_STD_PDU_RESP: sink ^= (frame_decode_pdu_resp(&v, &pdu) == 0) ? pdu.data_len : 0; break;
+                case CMD_EXT_EVENTS_CTRL: sink ^= (frame_decode_event_ctrl_resp(&v, &ctrl) == 0) ? ctrl.mask_len : 0; break;
+                default: sink ^= (frame_decode_event_resp(&v, &ev) == 0) ? ev->sub_cmd : 0; break;
+                }
+            }
+            frames += 64;
+            elapsed = bus_time_now_ns() - start;
+        } while (elapsed < BENCH_TIME_NS / 4);
+        printf("decode %-11s %6.1f ns/frame\n", resps[k].name, (double)elapsed / frames);
+    }
+}
+
+// разбор участков приема из записи обмена: реальные размеры участков, арбитраж и ошибки CRC
+static int bench_capture(const char * path)
+{
+    static bus_capture_reader_t reader;
+    static frame_parser_t parser;
+    bus_capture_record_t rec;
+
+    if (bus_capture_load(&reader, path) != 0) {
+        printf("Error read capture %s\n", path);
+        return -1;
+    }
+
+    uint64_t frames = 0;
+    uint64_t crc_errors = 0;
+    uint64_t bytes = 0;
+    uint64_t chunks = 0;
+    uint64_t passes = 0;
+    uint64_t start = bus_time_now_ns();
+    uint64_t elapsed;
+
+    do {
+        reader.pos = BUS_CAPTURE_MAGIC_LEN;
+        frame_parser_reset(&parser);
+        while (bus_capture_next(&reader, &rec) > 0) {
+            if (rec.kind != BUS_CAPTURE_RX) {
+                // запрос начинает новый ответ, как и при работе с портом
+                frame_parser_reset(&parser);
+                continue;
+            }
+            uint32_t pos = 0;
+            while (pos < rec.len) {
+                int space;
+                uint8_t * wp = frame_parser_write_ptr(&parser, &space);
+                int chunk = (rec.len - pos < (uint32_t)space) ? (int)(rec.len - pos) : space;
+                memcpy(wp, &rec.data[pos], chunk);
+                frame_parser_commit(&parser, chunk);
+                pos += chunk;
+
+                uint8_t * frame;
+                int len;
+                while ((len = frame_parser_next(&parser, &frame)) != FRAME_NEED_MORE) {
+                    if (len == FRAME_CRC_ERROR) {
+                        crc_errors++;
+                    } else {
+                        frames++;
+                    }
+                }
+            }
+            bytes += rec.len;
+            chunks++;
+        }
+        passes++;
+        elapsed = bus_time_now_ns() - start;
+    } while (elapsed < BENCH_TIME_NS);
+
+    printf("parser capture %s: %llu bytes in %llu chunks, %llu crc errors: %9.1f MB/s %10.0f frames/s\n", path,
+        (unsigned long long)(bytes / passes), (unsigned long long)(chunks / passes), (unsigned long long)(crc_errors / passes),
+        (double)bytes * NSEC_PER_SEC / elapsed / 1e6, (double)frames * NSEC_PER_SEC / elapsed);
+    bus_capture_unload(&reader);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    for (int b = 0; b < 256; b++) {
+        byte_table[b] = crc_bitwise(0, (uint8_t[]){ b }, 1);
+    }
+
+    if (check_crc() != 0) {
+        return EXIT_FAILURE;
+    }
+
+    static const uint32_t sizes[] = { 8, 64, 256, 65536 };
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_crc("bytewise", crc_bytewise_fn, sizes[i]);
+        bench_crc("modbus_crc", modbus_crc_iv, sizes[i]);
+    }
+
+    bench_parser(0);
+    bench_parser(12);
+    bench_parser(32);
+    bench_codec();
+
+    for (int i = 1; i < argc; i++) {
+        if (bench_capture(argv[i]) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Оценка скорости сканирования и опроса событий на симуляторе шины.
+# Время сканирования сравнивается с теоретическим: 834 бита на устройство
+# (запрос, арбитраж 32 бит, ответ) по описанию протокола.
+#
+# Параметры задаются переменными окружения:
+#   DEVICES  - количество устройств, по умолчанию 100
+#   BAUD     - скорость, по умолчанию 115200
+#   RATE     - событий в секунду на шине при опросе событий, по умолчанию 1000
+#   DURATION - длительность опроса событий в секундах, по умолчанию 5
+
+DEVICES=${DEVICES:-100}
+BAUD=${BAUD:-115200}
+RATE=${RATE:-1000}
+DURATION=${DURATION:-5}
+
+SCANNER=./wb-modbus-scanner
+SIM=./wb-modbus-sim
+
+TMP=$(mktemp -d)
+PORT=$TMP/port
+trap 'kill $SIM_PID 2>/dev/null; rm -rf $TMP' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+$SIM -n "$DEVICES" -b "$BAUD" -r "$RATE" -l "$PORT" > "$TMP/sim.log" &
+SIM_PID=$!
+
+while [ ! -e "$PORT" ]; do
+    sleep 0.05
+done
+
+start=$(now_ns)
+found=$($SCANNER -d "$PORT" -b "$BAUD" -I none | grep -c "Found device")
+end=$(now_ns)
+
+awk -v found="$found" -v devices="$DEVICES" -v baud="$BAUD" -v ns=$((end - start)) 'BEGIN {
+    ms = ns / 1e6
+    per_dev = found ? ms / found : 0
+    theory = 834 * 1000 / baud
+    printf "scan:   %d of %d devices in %.1f ms, %.3f ms per device, theoretical %.3f ms (%.1f%%)\n",
+        found, devices, ms, per_dev, theory, per_dev ? theory / per_dev * 100 : 0
+}'
+
+$SCANNER -d "$PORT" -b "$BAUD" -P > "$TMP/events.log" &
+POLL_PID=$!
+sleep "$DURATION"
+kill -INT $POLL_PID
+wait $POLL_PID
+
+events=$(grep -c "^Event type" "$TMP/events.log")
+awk -v events="$events" -v duration="$DURATION" -v rate="$RATE" 'BEGIN {
+    printf "events: %d in %d s, %.1f events/s, generated %d events/s\n", events, duration, events / duration, rate
+}'
@@ -0,0 +1,208 @@
+#include <string.h>
+#include "bus_analyzer.h"
+#include "modbus_ext.h"
+
+void bus_analyzer_init(bus_analyzer_t * a, const bus_timing_t * timing)
+{
+    memset(a, 0, sizeof(*a));
+    bus_timing_init(&a->timing, timing->baud, timing->char_bits, 0);
+    frame_parser_reset(&a->parser);
+}
+
+static void finish_request(bus_analyzer_t * a)
+{
+    if (!a->active) {
+        return;
+    }
+    a->active = 0;
+
+    if (!a->framed) {
+        a->lost++;
+        return;
+    }
+
+    bus_analyzer_type_t * s = &a->types[a->type];
+    uint64_t start_ns = (a->rx_first_ns > a->tx_done_ns) ? a->rx_first_ns - a->tx_done_ns : 0;
+    uint64_t arbitration_ns = (a->rx_data_ns > a->rx_first_ns) ? a->rx_data_ns - a->rx_first_ns : 0;
+    int64_t slack_ns = (int64_t)a->timeout_ns - (int64_t)a->silence_ns;
+
+    if ((s->answered == 0) || (start_ns < s->start_min_ns)) {
+        s->start_min_ns = start_ns;
+    }
+    if (start_ns > s->start_max_ns) {
+        s->start_max_ns = start_ns;
+    }
+    if (arbitration_ns > s->arbitration_max_ns) {
+        s->arbitration_max_ns = arbitration_ns;
+    }
+    if ((s->answered == 0) || (slack_ns < s->slack_min_ns)) {
+        s->slack_min_ns = slack_ns;
+    }
+    s->start_sum_ns += start_ns;
+    s->arbitration_sum_ns += arbitration_ns;
+    s->answered++;
+}
+
+static void on_tx(bus_analyzer_t * a, const bus_capture_record_t * rec)
+{
+    finish_request(a);
+
+    uint64_t tx_ns = rec->len * a->timing.char_ns;
+    if (a->requests == 0) {
+        a->first_ns = rec->timestamp_ns;
+    } else if (rec->timestamp_ns > a->last_ns) {
+        uint64_t gap_ns = rec->timestamp_ns - a->last_ns;
+        if ((a->gap_min_ns == 0) || (gap_ns < a->gap_min_ns)) {
+            a->gap_min_ns = gap_ns;
+        }
+    }
+
+    // запросы по адресу (изменение настроек событий) ждут ответа так же, как по серийному номеру
+    a->type = txn_type_of_request(rec->data, rec->len);
+    int legacy = (rec->len > 1) && (rec->data[1] == SPECIAL_CMD_LEGACY);
+    int windows = (a->type == TXN_EVENT_REQ) ? ARBITRATION_WINDOWS_EVENTS : ARBITRATION_WINDOWS_SCAN;
+    a->timeout_ns = bus_response_timeout_ns(&a->timing, windows, legacy);
+
+    a->active = 1;
+    a->framed = 0;
+    a->tx_done_ns = rec->timestamp_ns + tx_ns;
+    a->rx_first_ns = 0;
+    a->rx_data_ns = 0;
+    a->rx_last_ns = 0;
+    a->silence_ns = 0;
+    a->types[a->type].count++;
+    a->requests++;
+    a->busy_ns += tx_ns;
+    a->last_ns = a->tx_done_ns;
+    frame_parser_reset(&a->parser);
+}
+
+static void on_rx(bus_analyzer_t * a, const bus_capture_record_t * rec)
+{
+    uint64_t ts = rec->timestamp_ns;
+
+    a->busy_ns += rec->len * a->timing.char_ns;
+    if (ts > a->last_ns) {
+        a->last_ns = ts;
+    }
+    if (!a->active) {
+        return;
+    }
+
+    // тишина так, как ее видит ожидание ответа: между моментами чтения из порта
+    uint64_t prev_ns = a->rx_last_ns ? a->rx_last_ns : a->tx_done_ns;
+    if ((ts > prev_ns) && (ts - prev_ns > a->silence_ns)) {
+        a->silence_ns = ts - prev_ns;
+    }
+    a->rx_last_ns = ts;
+    if (a->rx_first_ns == 0) {
+        a->rx_first_ns = ts;
+    }
+    if (a->rx_data_ns == 0) {
+        for (uint32_t i = 0; i < rec->len; i++) {
+            if (rec->data[i] != ARBITRATION_BYTE) {
+                a->rx_data_ns = ts;
+                break;
+            }
+        }
+    }
+
+    uint32_t pos = 0;
+    while (pos < rec->len) {
+        int space;
+        uint8_t * wp = frame_parser_write_ptr(&a->parser, &space);
+        int chunk = (rec->len - pos < (uint32_t)space) ? (int)(rec->len - pos) : space;
+        memcpy(wp, &rec->data[pos], chunk);
+        frame_parser_commit(&a->parser, chunk);
+        pos += chunk;
+
+        uint8_t * frame;
+        int len;
+        while ((len = frame_parser_next(&a->parser, &frame)) != FRAME_NEED_MORE) {
+            if (len == FRAME_CRC_ERROR) {
+                a->crc_errors++;
+            } else {
+                a->framed = 1;
+            }
+        }
+    }
+}
+
+void bus_analyzer_record(bus_analyzer_t * a, const bus_capture_record_t * rec)
+{
+    switch (rec->kind) {
+    case BUS_CAPTURE_SESSION:
+        finish_request(a);
+        bus_timing_init(&a->timing, rec->baud, rec->char_bits, 0);
+        frame_parser_reset(&a->parser);
+        break;
+
+    case BUS_CAPTURE_TX:
+        on_tx(a, rec);
+        break;
+
+    case BUS_CAPTURE_RX:
+        on_rx(a, rec);
+        break;
+    }
+}
+
+void bus_analyzer_finish(bus_analyzer_t * a)
+{
+    finish_request(a);
+}
+
+uint64_t bus_analyzer_overrun_ns(const bus_analyzer_t * a)
+{
+    uint64_t overrun_ns = 0;
+    for (int t = 0; t < TXN_TYPES_NUM; t++) {
+        const bus_analyzer_type_t * s = &a->types[t];
+        if (s->answered && (s->slack_min_ns < 0) && ((uint64_t)-s->slack_min_ns > overrun_ns)) {
+            overrun_ns = -s->slack_min_ns;
+        }
+    }
+    return overrun_ns;
+}
+
+double bus_analyzer_utilization(const bus_analyzer_t * a)
+{
+    if (a->last_ns <= a->first_ns) {
+        return 0.0;
+    }
+    return 100.0 * a->busy_ns / (a->last_ns - a->first_ns);
+}
+
+void bus_analyzer_print(const bus_analyzer_t * a, FILE * out)
+{
+    const bus_timing_t * t = &a->timing;
+
+    fprintf(out, "Protocol: response start up to %llu us, arbitration window %llu us, frame gap %llu us\n",
+        (unsigned long long)(bus_response_timeout_ns(t, 0, 0) / NSEC_PER_USEC),
+        (unsigned long long)((bus_response_timeout_ns(t, 1, 0) - bus_response_timeout_ns(t, 0, 0)) / NSEC_PER_USEC),
+        (unsigned long long)(bus_silence_ns(t) / NSEC_PER_USEC));
+    fprintf(out, "Measured: %llu requests, %llu without responce, %llu crc errors, bus utilization %.1f%%, min gap %llu us\n",
+        (unsigned long long)a->requests, (unsigned long long)a->lost, (unsigned long long)a->crc_errors,
+        bus_analyzer_utilization(a), (unsigned long long)(a->gap_min_ns / NSEC_PER_USEC));
+    fprintf(out, "%-10s %8s %8s   %-24s %-24s %s\n", "request", "count", "answered",
+        "start us min/avg/max", "arbitration us avg/max", "slack us min");
+
+    for (int i = 0; i < TXN_TYPES_NUM; i++) {
+        const bus_analyzer_type_t * s = &a->types[i];
+        if (s->count == 0) {
+            continue;
+        }
+        if (s->answered == 0) {
+            fprintf(out, "%-10s %8llu %8llu\n", txn_type_name(i), (unsigned long long)s->count, 0ULL);
+            continue;
+        }
+
+        char start[64];
+        char arbitration[64];
+        snprintf(start, sizeof(start), "%llu/%llu/%llu", (unsigned long long)(s->start_min_ns / NSEC_PER_USEC),
+            (unsigned long long)(s->start_sum_ns / s->answered / NSEC_PER_USEC), (unsigned long long)(s->start_max_ns / NSEC_PER_USEC));
+        snprintf(arbitration, sizeof(arbitration), "%llu/%llu",
+            (unsigned long long)(s->arbitration_sum_ns / s->answered / NSEC_PER_USEC), (unsigned long long)(s->arbitration_max_ns / NSEC_PER_USEC));
+        fprintf(out, "%-10s %8llu %8llu   %-24s %-24s %lld\n", txn_type_name(i), (unsigned long long)s->count,
+            (unsigned long long)s->answered, start, arbitration, (long long)(s->slack_min_ns / (int64_t)NSEC_PER_USEC));
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "bus_timing.h"
+#include "bus_capture.h"
+#include "frame_parser.h"
+#include "txn_stats.h"
+
+/*
+    Анализ времянок шины по записи обмена (см. bus_capture.h)
+
+    Записи подаются по порядку. Для каждого запроса измеряется:
+
+        начало ответа   - от конца передачи запроса до первого принятого байта
+        арбитраж        - от первого байта до первого байта кадра (не 0xFF)
+        тишина          - наибольшая пауза без приема: до первого байта и между участками
+        запас           - таймаут по формуле протокола без margin_ns минус наибольшая тишина,
+                          отрицательный запас - ответ уложился только за счет margin_ns
+
+    Занятость шины - доля времени передачи всех символов запросов и ответов (вместе
+    с байтами арбитража) от длительности записи. Времена приема - моменты чтения из
+    порта, поэтому в них входят задержки драйвера и адаптера: их и покрывает margin_ns.
+*/
+
+typedef struct {
+    uint64_t count;
+    uint64_t answered;              // принят кадр с правильной CRC
+    uint64_t start_min_ns;
+    uint64_t start_max_ns;
+    uint64_t start_sum_ns;
+    uint64_t arbitration_max_ns;
+    uint64_t arbitration_sum_ns;
+    int64_t slack_min_ns;
+} bus_analyzer_type_t;
+
+typedef struct {
+    bus_timing_t timing;
+    frame_parser_t parser;
+    bus_analyzer_type_t types[TXN_TYPES_NUM];
+
+    uint64_t first_ns;
+    uint64_t last_ns;               // конец последнего символа на шине
+    uint64_t busy_ns;
+    uint64_t gap_min_ns;            // наименьшая пауза от конца ответа до следующего запроса
+    uint64_t requests;
+    uint64_t lost;                  // запрос без кадра ответа
+    uint64_t crc_errors;
+
+    // текущий запрос
+    int active;
+    txn_type_t type;
+    uint64_t timeout_ns;            // таймаут по формуле протокола без margin_ns
+    uint64_t tx_done_ns;
+    uint64_t rx_first_ns;
+    uint64_t rx_data_ns;
+    uint64_t rx_last_ns;
+    uint64_t silence_ns;
+    int framed;
+} bus_analyzer_t;
+
+// timing задает скорость и формат символа, если в записи нет записи сессии
+void bus_analyzer_init(bus_analyzer_t * a, const bus_timing_t * timing);
+
+void bus_analyzer_record(bus_analyzer_t * a, const bus_capture_record_t * rec);
+
+// учет последнего запроса записи
+void bus_analyzer_finish(bus_analyzer_t * a);
+
+// наибольшее превышение тишины над формулой протокола по всем запросам с ответом, 0 если не было
+uint64_t bus_analyzer_overrun_ns(const bus_analyzer_t * a);
+
+// занятость шины в процентах
+double bus_analyzer_utilization(const bus_analyzer_t * a);
+
+void bus_analyzer_print(const bus_analyzer_t * a, FILE * out);
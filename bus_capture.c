@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bus_capture.h"
+
+#ifndef EPROTO
+#define EPROTO                      EINVAL
+#endif
+
+static void put_varint(FILE * f, uint64_t value)
+{
+    do {
+        uint8_t b = value & 0x7F;
+        value >>= 7;
+        putc(value ? b | 0x80 : b, f);
+    } while (value);
+}
+
+static int get_varint(bus_capture_reader_t * r, uint64_t * value)
+{
+    *value = 0;
+    for (int shift = 0; (shift < 64) && (r->pos < r->len); shift += 7) {
+        uint8_t b = r->buf[r->pos++];
+        *value |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int bus_capture_open(bus_capture_t * c, const char * path)
+{
+    FILE * f = fopen(path, "ab");
+    if (f == NULL) {
+        return -1;
+    }
+    bus_capture_attach(c, f);
+    return 0;
+}
+
+void bus_capture_attach(bus_capture_t * c, FILE * f)
+{
+    memset(c, 0, sizeof(*c));
+
+    c->f = f;
+    fseek(c->f, 0, SEEK_END);
+    if (ftell(c->f) == 0) {
+        fwrite(BUS_CAPTURE_MAGIC, 1, BUS_CAPTURE_MAGIC_LEN, c->f);
+    }
+}
+
+void bus_capture_close(bus_capture_t * c)
+{
+    if (c->f) {
+        fclose(c->f);
+        c->f = NULL;
+    }
+}
+
+void bus_capture_session(bus_capture_t * c, uint64_t now_ns, uint32_t baud, uint8_t char_bits)
+{
+    putc(BUS_CAPTURE_SESSION, c->f);
+    put_varint(c->f, now_ns);
+    put_varint(c->f, baud);
+    putc(char_bits, c->f);
+    c->last_ns = now_ns;
+}
+
+void bus_capture_chunk(bus_capture_t * c, uint8_t kind, uint64_t timestamp_ns, const uint8_t * data, uint32_t len)
+{
+    putc(kind, c->f);
+    // участок приема может быть отмечен раньше окончания передачи, отрицательной разницы не пишем
+    put_varint(c->f, timestamp_ns > c->last_ns ? timestamp_ns - c->last_ns : 0);
+    put_varint(c->f, len);
+    fwrite(data, 1, len, c->f);
+    if (timestamp_ns > c->last_ns) {
+        c->last_ns = timestamp_ns;
+    }
+}
+
+int bus_capture_load(bus_capture_reader_t * r, const char * path)
+{
+    FILE * f = fopen(path, "rb");
+    if (f == NULL) {
+        memset(r, 0, sizeof(*r));
+        return -1;
+    }
+    int res = bus_capture_load_file(r, f);
+    fclose(f);
+    return res;
+}
+
+int bus_capture_load_file(bus_capture_reader_t * r, FILE * f)
+{
+    memset(r, 0, sizeof(*r));
+
+    fflush(f);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if ((size < BUS_CAPTURE_MAGIC_LEN) || ((r->buf = malloc(size)) == NULL) ||
+        (fread(r->buf, 1, size, f) != (size_t)size) || (memcmp(r->buf, BUS_CAPTURE_MAGIC, BUS_CAPTURE_MAGIC_LEN) != 0)) {
+        bus_capture_unload(r);
+        errno = EPROTO;
+        return -1;
+    }
+
+    r->len = size;
+    r->pos = BUS_CAPTURE_MAGIC_LEN;
+    return 0;
+}
+
+void bus_capture_unload(bus_capture_reader_t * r)
+{
+    free(r->buf);
+    r->buf = NULL;
+}
+
+int bus_capture_next(bus_capture_reader_t * r, bus_capture_record_t * rec)
+{
+    uint64_t value;
+    uint64_t len;
+
+    if (r->pos >= r->len) {
+        return 0;
+    }
+
+    rec->kind = r->buf[r->pos++];
+    switch (rec->kind) {
+    case BUS_CAPTURE_SESSION:
+        if ((get_varint(r, &rec->timestamp_ns) != 0) || (get_varint(r, &value) != 0) || (r->pos >= r->len)) {
+            return -1;
+        }
+        rec->baud = value;
+        rec->char_bits = r->buf[r->pos++];
+        rec->data = NULL;
+        rec->len = 0;
+        r->last_ns = rec->timestamp_ns;
+        return 1;
+
+    case BUS_CAPTURE_TX:
+    case BUS_CAPTURE_RX:
+        if ((get_varint(r, &value) != 0) || (get_varint(r, &len) != 0) || (len > r->len - r->pos)) {
+            return -1;
+        }
+        r->last_ns += value;
+        rec->timestamp_ns = r->last_ns;
+        rec->data = &r->buf[r->pos];
+        rec->len = len;
+        r->pos += len;
+        return 1;
+
+    default:
+        return -1;
+    }
+}
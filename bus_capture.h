@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    Запись обмена на шине в двоичный файл и чтение записи
+
+    Файл начинается с сигнатуры BUS_CAPTURE_MAGIC и дальше только дополняется:
+    каждый запуск добавляет запись сессии и записи переданных и принятых участков данных.
+
+        сессия:     0x00, время (varint, нс CLOCK_MONOTONIC), скорость (varint), бит в символе (1 байт)
+        передача:   0x01, время от предыдущей записи (varint, нс), длина (varint), байты
+        прием:      0x02, время от предыдущей записи (varint, нс), длина (varint), байты
+
+    varint - 7 бит на байт, младшие первыми, старший бит - продолжение. Время передачи -
+    начало записи в порт, время приема - момент, когда участок прочитан из порта.
+    Запись идет через буфер stdio и не добавляет системных вызовов в обмен.
+*/
+
+#define BUS_CAPTURE_MAGIC           "WBMBCAP1"
+#define BUS_CAPTURE_MAGIC_LEN       8
+
+#define BUS_CAPTURE_SESSION         0x00
+#define BUS_CAPTURE_TX              0x01
+#define BUS_CAPTURE_RX              0x02
+
+typedef struct {
+    FILE * f;
+    uint64_t last_ns;
+} bus_capture_t;
+
+typedef struct {
+    uint8_t kind;                   // BUS_CAPTURE_*
+    uint64_t timestamp_ns;
+    uint32_t baud;                  // для записи сессии
+    uint8_t char_bits;
+    const uint8_t * data;           // указывает в буфер чтения
+    uint32_t len;
+} bus_capture_record_t;
+
+typedef struct {
+    uint8_t * buf;
+    size_t len;
+    size_t pos;
+    uint64_t last_ns;
+} bus_capture_reader_t;
+
+// открытие файла на дополнение, сигнатура пишется в пустой файл; 0 или -1, причина в errno
+int bus_capture_open(bus_capture_t * c, const char * path);
+
+// запись в уже открытый файл (например tmpfile() для анализа обмена), файл закрывается bus_capture_close
+void bus_capture_attach(bus_capture_t * c, FILE * f);
+
+void bus_capture_close(bus_capture_t * c);
+
+void bus_capture_session(bus_capture_t * c, uint64_t now_ns, uint32_t baud, uint8_t char_bits);
+
+void bus_capture_chunk(bus_capture_t * c, uint8_t kind, uint64_t timestamp_ns, const uint8_t * data, uint32_t len);
+
+// загрузка всего файла в память для чтения; 0 или -1 (errno, EPROTO - не файл записи)
+int bus_capture_load(bus_capture_reader_t * r, const char * path);
+
+// то же для открытого на чтение файла, файл читается с начала
+int bus_capture_load_file(bus_capture_reader_t * r, FILE * f);
+
+void bus_capture_unload(bus_capture_reader_t * r);
+
+// очередная запись: 1 - запись в rec, 0 - конец файла, -1 - запись обрезана или повреждена
+int bus_capture_next(bus_capture_reader_t * r, bus_capture_record_t * rec);
@@ -0,0 +1,126 @@
+#include "bus_timing.h"
+
+#define ARBITRATION_START_US            800     // максимальная задержка начала арбитража
+#define ARBITRATION_IRQ_RESERVE_US      50      // запас на обработку прерывания в окне арбитража
+#define ARBITRATION_WINDOW_BITS         12      // один символ с битом четности и двумя стоп битами
+
+#define LEGACY_ARBITRATION_START_BITS   44
+#define LEGACY_ARBITRATION_WINDOW_BITS  20
+
+void bus_timing_init(bus_timing_t * t, uint32_t baud, uint8_t char_bits, uint64_t margin_ns)
+{
+    t->baud = baud;
+    t->char_bits = char_bits;
+    t->char_ns = bus_bits_ns(t, char_bits);
+    t->margin_ns = margin_ns;
+    t->gap_ns = 0;
+    t->last_activity_ns = 0;
+}
+
+uint8_t bus_char_bits(int data_bits, int parity, int stop_bits)
+{
+    return 1 + data_bits + (parity ? 1 : 0) + stop_bits;
+}
+
+uint64_t bus_bits_ns(const bus_timing_t * t, uint64_t bits)
+{
+    return (bits * NSEC_PER_SEC + t->baud - 1) / t->baud;
+}
+
+uint64_t bus_response_timeout_ns(const bus_timing_t * t, int windows, int legacy)
+{
+    uint64_t start_ns;
+    uint64_t window_ns;
+
+    if (legacy) {
+        start_ns = bus_bits_ns(t, LEGACY_ARBITRATION_START_BITS);
+        window_ns = bus_bits_ns(t, LEGACY_ARBITRATION_WINDOW_BITS);
+    } else {
+        uint64_t silence_ns = bus_silence_ns(t);
+        start_ns = bus_bits_ns(t, ARBITRATION_WINDOW_BITS) + ARBITRATION_START_US * NSEC_PER_USEC;
+        if (silence_ns > start_ns) {
+            start_ns = silence_ns;
+        }
+
+        // ceil_bits(50мкс) - запас на прерывание, кратный длительности бита
+        uint64_t reserve_bits = (ARBITRATION_IRQ_RESERVE_US * NSEC_PER_USEC * t->baud + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+        uint64_t window_bits = ARBITRATION_WINDOW_BITS + reserve_bits;
+        if (window_bits < ARBITRATION_WINDOW_BITS + 1) {
+            window_bits = ARBITRATION_WINDOW_BITS + 1;
+        }
+        window_ns = bus_bits_ns(t, window_bits);
+    }
+
+    return start_ns + windows * window_ns + t->margin_ns;
+}
+
+uint64_t bus_silence_ns(const bus_timing_t * t)
+{
+    return (bus_bits_ns(t, 7 * t->char_bits) + 1) / 2;
+}
+
+uint64_t bus_frame_gap_ns(const bus_timing_t * t)
+{
+    return t->gap_ns ? t->gap_ns : bus_silence_ns(t);
+}
+
+#if defined(_WIN32)
+#include <windows.h>
+
+uint64_t bus_time_now_ns(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER cnt;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&cnt);
+
+    return (uint64_t)(cnt.QuadPart / freq.QuadPart) * NSEC_PER_SEC +
+        (uint64_t)(cnt.QuadPart % freq.QuadPart) * NSEC_PER_SEC / freq.QuadPart;
+}
+
+void bus_sleep_until_ns(uint64_t deadline_ns)
+{
+    uint64_t now = bus_time_now_ns();
+
+    // шаг системного таймера windows порядка 15мс, остаток времени дожидаемся активно
+    if ((now < deadline_ns) && (deadline_ns - now > 20 * NSEC_PER_MSEC)) {
+        Sleep((deadline_ns - now) / NSEC_PER_MSEC - 16);
+    }
+    while (bus_time_now_ns() < deadline_ns) {
+        YieldProcessor();
+    }
+}
+#else // _WIN32
+#include <time.h>
+#include <errno.h>
+
+uint64_t bus_time_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void bus_sleep_until_ns(uint64_t deadline_ns)
+{
+#if defined(__APPLE__)
+    uint64_t now;
+    while ((now = bus_time_now_ns()) < deadline_ns) {
+        struct timespec ts = {
+            .tv_sec = (deadline_ns - now) / NSEC_PER_SEC,
+            .tv_nsec = (deadline_ns - now) % NSEC_PER_SEC,
+        };
+        nanosleep(&ts, NULL);
+    }
+#else
+    struct timespec ts = {
+        .tv_sec = deadline_ns / NSEC_PER_SEC,
+        .tv_nsec = deadline_ns % NSEC_PER_SEC,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) { }
+#endif
+}
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+// значение deadline, означающее ожидание без ограничения по времени
+#define BUS_DEADLINE_NONE           UINT64_MAX
+#define BUS_TIMEOUT_NONE            UINT64_MAX
+
+#define NSEC_PER_USEC               1000ULL
+#define NSEC_PER_MSEC               1000000ULL
+#define NSEC_PER_SEC                1000000000ULL
+
+// количество окон арбитража для разных запросов (см. docs/protocol.ru.md, "Тайминги")
+#define ARBITRATION_WINDOWS_SCAN    32      // арбитраж по серийному номеру
+#define ARBITRATION_WINDOWS_EVENTS  9       // первый символ при арбитраже по server_id появляется не позже 9го окна
+
+// запас на программную задержку хоста и драйвера порта (USB адаптеры отдают данные пачками)
+#define BUS_TIMEOUT_MARGIN_DEFAULT_US   20000
+
+typedef struct {
+    uint32_t baud;
+    uint8_t char_bits;          // бит в одном символе на линии: старт + данные + четность + стоп
+    uint64_t char_ns;           // время передачи одного символа
+    uint64_t margin_ns;         // добавляется к каждому таймауту ответа
+    uint64_t gap_ns;            // пауза перед запросом, 0 - 3.5 символа
+    uint64_t last_activity_ns;  // момент окончания последнего переданного или принятого символа
+} bus_timing_t;
+
+// монотонное время в наносекундах, не зависит от перевода системных часов
+uint64_t bus_time_now_ns(void);
+
+void bus_timing_init(bus_timing_t * t, uint32_t baud, uint8_t char_bits, uint64_t margin_ns);
+
+// количество бит в символе для формата кадра: 1 старт бит + данные + бит четности + стоп биты
+uint8_t bus_char_bits(int data_bits, int parity, int stop_bits);
+
+// время передачи указанного количества бит, округленное вверх
+uint64_t bus_bits_ns(const bus_timing_t * t, uint64_t bits);
+
+/*
+    Таймаут ожидания ответа после окончания передачи запроса:
+
+        max(3.5 символа, 12 бит + 800мкс) + N * max(13 бит, 12 бит + ceil_bits(50мкс))
+
+    для устаревшей команды 0x60 арбитраж начинается через 44 бита, окно - 20 бит
+*/
+uint64_t bus_response_timeout_ns(const bus_timing_t * t, int windows, int legacy);
+
+// тишина 3.5 символа, по которой устройства определяют конец кадра
+uint64_t bus_silence_ns(const bus_timing_t * t);
+
+// пауза перед отправкой запроса: gap_ns, если задана, иначе 3.5 символа
+uint64_t bus_frame_gap_ns(const bus_timing_t * t);
+
+// отметка активности на шине: передача или прием символа закончились в момент now_ns
+static inline void bus_activity(bus_timing_t * t, uint64_t now_ns)
+{
+    if (now_ns > t->last_activity_ns) {
+        t->last_activity_ns = now_ns;
+    }
+}
+
+// одно ожидание до абсолютного момента времени по монотонным часам
+void bus_sleep_until_ns(uint64_t deadline_ns);
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bus_workers.h"
+
+void bus_port_name(char * name, size_t size, const char * device)
+{
+    if (strncmp(device, "/dev/", strlen("/dev/")) == 0) {
+        device += strlen("/dev/");
+    }
+    snprintf(name, size, "%s", device);
+    for (char * c = name; *c; c++) {
+        if (*c == '/') {
+            *c = '_';
+        }
+    }
+}
+
+#if defined(_WIN32)
+
+int bus_workers_run(const bus_desc_t * buses, int bus_num, bus_worker_fn_t fn, void * arg)
+{
+    if (bus_num == 1) {
+        return fn(&buses[0], stdout, arg);
+    }
+    printf("Several serial ports in one process are not supported on this platform\n");
+    return EXIT_FAILURE;
+}
+
+void bus_workers_lock(void)
+{
+}
+
+void bus_workers_unlock(void)
+{
+}
+
+#else // _WIN32
+
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define LINE_MAX_LEN                1024
+#define WORKER_STACK_SIZE           (1024 * 1024)
+
+typedef struct {
+    const bus_desc_t * bus;
+    bus_worker_fn_t fn;
+    void * arg;
+    pthread_t thread;
+    FILE * out;                     // сторона обработчика
+    int fd;                         // сторона сборщика вывода, -1 - обработчик завершился
+    int exit_code;
+    int line_len;
+    char line[LINE_MAX_LEN];
+} bus_worker_t;
+
+static pthread_mutex_t workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void bus_workers_lock(void)
+{
+    pthread_mutex_lock(&workers_mutex);
+}
+
+void bus_workers_unlock(void)
+{
+    pthread_mutex_unlock(&workers_mutex);
+}
+
+static void * worker_main(void * arg)
+{
+    bus_worker_t * w = arg;
+
+    w->exit_code = w->fn(w->bus, w->out, w->arg);
+    // закрытие канала - признак завершения для сборщика вывода
+    fclose(w->out);
+    return NULL;
+}
+
+static void print_tagged_line(bus_worker_t * w)
+{
+    printf("[%s] %.*s\n", w->bus->device, w->line_len, w->line);
+    w->line_len = 0;
+}
+
+// разбор прочитанного из канала обработчика на строки, \r отбрасывается
+static void collect_output(bus_worker_t * w, const char * buf, int len)
+{
+    for (int i = 0; i < len; i++) {
+        if (buf[i] == '\n') {
+            print_tagged_line(w);
+        } else if (buf[i] != '\r') {
+            if (w->line_len == LINE_MAX_LEN) {
+                print_tagged_line(w);
+            }
+            w->line[w->line_len++] = buf[i];
+        }
+    }
+}
+
+int bus_workers_run(const bus_desc_t * buses, int bus_num, bus_worker_fn_t fn, void * arg)
+{
+    static bus_worker_t workers[BUSES_MAX];
+
+    if (bus_num == 1) {
+        return fn(&buses[0], stdout, arg);
+    }
+
+    // буферы обработчиков - на стеке потока, размер не зависит от ulimit и libc
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+
+    fflush(stdout);
+
+    int started = 0;
+    for (int i = 0; i < bus_num; i++) {
+        bus_worker_t * w = &workers[i];
+        int pfd[2];
+
+        memset(w, 0, sizeof(*w));
+        w->bus = &buses[i];
+        w->fn = fn;
+        w->arg = arg;
+        w->fd = -1;
+
+        if (pipe(pfd) != 0) {
+            printf("Error from pipe: %s\n", strerror(errno));
+            break;
+        }
+        w->out = fdopen(pfd[1], "w");
+        if (w->out == NULL) {
+            printf("Error from fdopen: %s\n", strerror(errno));
+            close(pfd[0]);
+            close(pfd[1]);
+            break;
+        }
+        setvbuf(w->out, NULL, _IOLBF, 0);
+        w->fd = pfd[0];
+
+        int err = pthread_create(&w->thread, &attr, worker_main, w);
+        if (err != 0) {
+            printf("Error from pthread_create: %s\n", strerror(err));
+            fclose(w->out);
+            close(w->fd);
+            w->fd = -1;
+            break;
+        }
+        started++;
+    }
+    pthread_attr_destroy(&attr);
+
+    // сигналы остановки и SIGUSR1 обрабатывают сами обработчики: сборщик только ждет вывода
+    int running = started;
+    while (running) {
+        struct pollfd pfds[BUSES_MAX];
+        for (int i = 0; i < started; i++) {
+            pfds[i].fd = workers[i].fd;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+
+        if (poll(pfds, started, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error from poll: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < started; i++) {
+            bus_worker_t * w = &workers[i];
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+
+            char buf[512];
+            int len = read(w->fd, buf, sizeof(buf));
+            if (len > 0) {
+                collect_output(w, buf, len);
+            } else if ((len == 0) || (errno != EINTR)) {
+                if (w->line_len) {
+                    print_tagged_line(w);
+                }
+                close(w->fd);
+                w->fd = -1;             // poll пропускает отрицательные дескрипторы
+                running--;
+            }
+        }
+        fflush(stdout);
+    }
+
+    int exit_code = (started == bus_num) ? EXIT_SUCCESS : EXIT_FAILURE;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].exit_code != EXIT_SUCCESS) {
+            exit_code = EXIT_FAILURE;
+        }
+    }
+    return exit_code;
+}
+
+#endif // _WIN32
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdio.h>
+
+#define BUSES_MAX                   8
+
+typedef struct {
+    const char * device;
+    int baud;
+    char parity;
+} bus_desc_t;
+
+// обработчик шины, out - вывод шины; возвращает код завершения
+typedef int (*bus_worker_fn_t)(const bus_desc_t * bus, FILE * out, void * arg);
+
+/*
+    Параллельная работа с несколькими шинами, поток на шину
+
+    Каждый обработчик пишет в свой канал, вызывающий поток собирает вывод всех шин
+    построчно, добавляя к каждой строке имя устройства, и дожидается завершения всех
+    обработчиков. Одна шина обслуживается в вызывающем потоке с выводом в stdout без
+    пометки строк. Возвращает EXIT_SUCCESS, если все обработчики завершились успешно.
+
+    Состояние обработчика (контекст шины, буферы) должно быть своим у каждого потока,
+    общие для шин файлы изменяются под bus_workers_lock.
+*/
+int bus_workers_run(const bus_desc_t * buses, int bus_num, bus_worker_fn_t fn, void * arg);
+
+void bus_workers_lock(void);
+void bus_workers_unlock(void);
+
+// имя порта для имен файлов и секций конфигурации: без /dev/, остальные / заменяются на _
+void bus_port_name(char * name, size_t size, const char * device);
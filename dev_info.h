@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#define DEVICES_MAX                 100
+
+// поля информации об устройстве, читаемые после сканирования (см. wbmbext_dev_info_fields)
+typedef enum {
+    DEV_INFO_MODEL = 0,
+    DEV_INFO_FWVER,
+    DEV_INFO_SIGNATURE,
+    DEV_INFO_BOOTLOADER,
+    DEV_INFO_FIELDS_NUM
+} dev_info_field_t;
+
+#define DEV_INFO_STR_MAX            20
+
+typedef struct {
+    uint32_t serial;
+    uint8_t id;
+    unsigned info_mask;         // успешно прочитанные поля info
+    time_t last_seen;
+    char info[DEV_INFO_FIELDS_NUM][DEV_INFO_STR_MAX + 1];
+} dev_info_t;
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "event_config.h"
+
+#define EVENT_CONFIG_LINE_MAX       256
+
+static const struct {
+    const char * name;
+    uint8_t type;
+} event_types[] = {
+    { "coil", 1 },
+    { "discrete", 2 },
+    { "holding", 3 },
+    { "input", 4 },
+    { "system", 15 },
+};
+
+static int parse_type(const char * arg, uint8_t * type)
+{
+    unsigned value;
+
+    for (unsigned i = 0; i < sizeof(event_types) / sizeof(event_types[0]); i++) {
+        if (strcmp(arg, event_types[i].name) == 0) {
+            *type = event_types[i].type;
+            return 0;
+        }
+    }
+    if ((sscanf(arg, "%u", &value) == 1) && (((value >= 1) && (value <= 4)) || (value == 15))) {
+        *type = value;
+        return 0;
+    }
+    return -1;
+}
+
+int event_config_load(const char * path, event_config_t * cfg, FILE * out)
+{
+    cfg->num = 0;
+
+    FILE * f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(out, "Error open event config %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[EVENT_CONFIG_LINE_MAX];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_num++;
+        line[strcspn(line, "#\r\n")] = 0;
+
+        unsigned id;
+        char type_str[16];
+        char range_str[32];
+        unsigned ctrl;
+        int fields = sscanf(line, "%u %15s %31s %u", &id, type_str, range_str, &ctrl);
+        if (fields <= 0) {
+            continue;
+        }
+
+        uint8_t type;
+        unsigned first;
+        unsigned last;
+        int range_fields = (fields == 4) ? sscanf(range_str, "%u-%u", &first, &last) : 0;
+        if (range_fields == 1) {
+            last = first;
+        }
+        if ((fields != 4) || (range_fields < 1) || (parse_type(type_str, &type) != 0) ||
+            (id < WBMBEXT_ID_MIN) || (id > WBMBEXT_ID_MAX) || (ctrl > WBMBEXT_EVENT_CTRL_HIGH) ||
+            (first > last) || (last > 0xFFFF)) {
+            fprintf(out, "Error event config %s:%d: wrong format\n", path, line_num);
+            fclose(f);
+            return -1;
+        }
+
+        for (unsigned address = first; address <= last; address++) {
+            if (cfg->num == EVENT_CONFIG_MAX) {
+                fprintf(out, "Error event config %s: too many registers, max %d\n", path, EVENT_CONFIG_MAX);
+                fclose(f);
+                return -1;
+            }
+            event_config_entry_t * e = &cfg->entries[cfg->num++];
+            memset(e, 0, sizeof(*e));
+            e->id = id;
+            e->setting.type = type;
+            e->setting.address = address;
+            e->setting.ctrl = ctrl;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdio.h>
+#include "wbmbext.h"
+
+#define EVENT_CONFIG_MAX            8192    // настроек регистров во всем файле
+
+/*
+    Настройка отправки событий для всей шины
+
+    Текстовый файл, по строке на регистр или диапазон регистров:
+
+        # id  type      address   ctrl
+        62    input     35        1
+        62    coil      0-7       2
+        10    15        0         0
+
+    type - номер типа (1 coil, 2 discrete, 3 holding, 4 input, 15 system) или его название,
+    ctrl - 0 отключить, 1 низкий приоритет, 2 высокий приоритет.
+    Строки, начинающиеся с #, и пустые строки пропускаются.
+*/
+typedef struct {
+    uint8_t id;
+    wbmbext_event_setting_t setting;
+} event_config_entry_t;
+
+typedef struct {
+    int num;
+    event_config_entry_t entries[EVENT_CONFIG_MAX];
+} event_config_t;
+
+// возвращает -1 при ошибке чтения или формата, ошибка печатается в out
+int event_config_load(const char * path, event_config_t * cfg, FILE * out);
@@ -0,0 +1,200 @@
+#include <string.h>
+#include <errno.h>
+#include "event_ring.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t ring_size(uint32_t capacity)
+{
+    return sizeof(event_ring_hdr_t) + (size_t)capacity * sizeof(event_ring_record_t);
+}
+
+int event_ring_create(event_ring_t * ring, const char * name, uint32_t capacity)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    // слот вычисляется маской
+    if ((capacity == 0) || (capacity & (capacity - 1))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t size = ring_size(capacity);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    int reuse = ((size_t)st.st_size == size);
+
+    if (!reuse && (ftruncate(fd, size) != 0)) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    ring->hdr = map;
+    ring->map_size = size;
+
+    // буфер того же формата, оставшийся от прошлого запуска, продолжается с его write_index:
+    // подключенные читатели не замечают перезапуска писателя
+    event_ring_hdr_t * hdr = ring->hdr;
+    if (reuse && (hdr->magic == EVENT_RING_MAGIC) && (hdr->version == EVENT_RING_VERSION) &&
+        (hdr->record_size == sizeof(event_ring_record_t)) && (hdr->capacity == capacity)) {
+        return 0;
+    }
+
+    __atomic_store_n(&hdr->magic, 0, __ATOMIC_RELEASE);
+    memset(hdr, 0, size);
+    hdr->version = EVENT_RING_VERSION;
+    hdr->record_size = sizeof(event_ring_record_t);
+    hdr->capacity = capacity;
+    // magic последним: читатель не подключится к недозаполненному заголовку
+    __atomic_store_n(&hdr->magic, EVENT_RING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int event_ring_open(event_ring_t * ring, const char * name)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(event_ring_hdr_t))) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    event_ring_hdr_t * hdr = map;
+    if ((__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != EVENT_RING_MAGIC) || (hdr->version != EVENT_RING_VERSION) ||
+        (hdr->record_size != sizeof(event_ring_record_t)) || (ring_size(hdr->capacity) > (size_t)st.st_size)) {
+        munmap(map, st.st_size);
+        errno = EPROTO;
+        return -1;
+    }
+
+    ring->hdr = hdr;
+    ring->map_size = st.st_size;
+    ring->read_index = __atomic_load_n(&hdr->write_index, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+void event_ring_close(event_ring_t * ring)
+{
+    if (ring->hdr) {
+        munmap(ring->hdr, ring->map_size);
+        ring->hdr = NULL;
+    }
+}
+
+#else // _WIN32
+
+int event_ring_create(event_ring_t * ring, const char * name, uint32_t capacity)
+{
+    (void)name;
+    (void)capacity;
+    memset(ring, 0, sizeof(*ring));
+    errno = ENOSYS;
+    return -1;
+}
+
+int event_ring_open(event_ring_t * ring, const char * name)
+{
+    (void)name;
+    memset(ring, 0, sizeof(*ring));
+    errno = ENOSYS;
+    return -1;
+}
+
+void event_ring_close(event_ring_t * ring)
+{
+    ring->hdr = NULL;
+}
+
+#endif // _WIN32
+
+void event_ring_write(event_ring_t * ring, uint64_t timestamp_ns, uint8_t slave_id, uint8_t type, uint16_t event_id,
+    const uint8_t * data, uint8_t len)
+{
+    event_ring_hdr_t * hdr = ring->hdr;
+    uint64_t n = hdr->write_index;      // писатель один, его собственное значение
+    event_ring_record_t * rec = &hdr->records[n & (hdr->capacity - 1)];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rec->timestamp_ns = timestamp_ns;
+    rec->slave_id = slave_id;
+    rec->type = type;
+    rec->event_id = event_id;
+    rec->len = len;
+    memcpy(rec->data, data, len < EVENT_RING_DATA_MAX ? len : EVENT_RING_DATA_MAX);
+
+    __atomic_store_n(&rec->seq, n + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->write_index, n + 1, __ATOMIC_RELEASE);
+}
+
+int event_ring_read(event_ring_t * ring, event_ring_record_t * rec, uint64_t * lost)
+{
+    const event_ring_hdr_t * hdr = ring->hdr;
+
+    for (;;) {
+        uint64_t w = __atomic_load_n(&hdr->write_index, __ATOMIC_ACQUIRE);
+        if (ring->read_index >= w) {
+            return 0;
+        }
+
+        // читатель отстал больше чем на размер буфера - его записи уже перезаписаны
+        if (w - ring->read_index > hdr->capacity) {
+            if (lost) {
+                *lost += w - hdr->capacity - ring->read_index;
+            }
+            ring->read_index = w - hdr->capacity;
+        }
+
+        uint64_t n = ring->read_index++;
+        const event_ring_record_t * slot = &hdr->records[n & (hdr->capacity - 1)];
+
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        memcpy(rec, slot, sizeof(*rec));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq == n + 1) && (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)) {
+            rec->seq = seq;
+            return 1;
+        }
+
+        // слот перезаписан писателем во время чтения
+        if (lost) {
+            (*lost)++;
+        }
+    }
+}
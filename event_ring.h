@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    Кольцевой буфер событий в разделяемой памяти (/dev/shm)
+
+    Один писатель (утилита, опрашивающая шину) и любое количество читателей в других
+    процессах. Записи фиксированного размера, события без текстового форматирования,
+    чтение без системных вызовов на каждое событие.
+
+    Писатель никогда не ждет читателей: при переполнении старые записи перезаписываются,
+    отставший читатель пропускает их и узнает количество пропущенных из event_ring_read.
+
+    Запись n (с нуля) лежит в слоте n % capacity. Писатель помечает слот как изменяемый
+    (seq = 0), заполняет его, затем публикует seq = n + 1 и write_index = n + 1.
+    Читатель копирует слот и проверяет seq до и после копирования: если seq изменился
+    или не равен ожидаемому, слот был перезаписан во время чтения и запись считается потерянной.
+*/
+
+#define EVENT_RING_MAGIC            0x52455757u     // "WWER"
+#define EVENT_RING_VERSION          1
+#define EVENT_RING_NAME_DEFAULT     "/wb-modbus-events"
+#define EVENT_RING_CAPACITY_DEFAULT 65536           // записей, степень двойки
+
+#define EVENT_RING_DATA_MAX         40              // данные длиннее сохраняются обрезанными, len - полная длина
+
+typedef struct {
+    uint64_t seq;                   // номер записи + 1, 0 - слот изменяется
+    uint64_t timestamp_ns;          // время приема пакета по CLOCK_MONOTONIC
+    uint8_t slave_id;
+    uint8_t type;
+    uint16_t event_id;
+    uint8_t len;                    // длина данных события
+    uint8_t reserved[3];
+    uint8_t data[EVENT_RING_DATA_MAX];
+} event_ring_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint8_t reserved[48];
+
+    // отдельная строка кэша: меняется на каждое событие
+    uint64_t write_index;
+    uint8_t reserved2[56];
+
+    event_ring_record_t records[];
+} event_ring_hdr_t;
+
+typedef struct {
+    event_ring_hdr_t * hdr;
+    size_t map_size;
+    uint64_t read_index;            // читатель: следующая запись
+} event_ring_t;
+
+// создание буфера писателем; существующий буфер того же формата продолжается с места остановки,
+// иначе создается заново. Писатель у буфера должен быть один. Возвращает 0 или -1, причина в errno
+int event_ring_create(event_ring_t * ring, const char * name, uint32_t capacity);
+
+// подключение читателя, чтение начинается с новых записей
+int event_ring_open(event_ring_t * ring, const char * name);
+
+void event_ring_close(event_ring_t * ring);
+
+void event_ring_write(event_ring_t * ring, uint64_t timestamp_ns, uint8_t slave_id, uint8_t type, uint16_t event_id,
+    const uint8_t * data, uint8_t len);
+
+/*
+    Чтение очередной записи в rec
+
+    Возвращает 1 - запись прочитана, 0 - новых записей нет. lost (может быть NULL)
+    увеличивается на количество записей, перезаписанных до того, как читатель их прочитал.
+*/
+int event_ring_read(event_ring_t * ring, event_ring_record_t * rec, uint64_t * lost);
@@ -0,0 +1,266 @@
+#include <stddef.h>
+#include <string.h>
+#include "frame_codec.h"
+#include "frame_parser.h"
+#include "modbus_crc.h"
+
+/*
+    Описания ответов, которые присылают устройства
+
+    payload_len_index:      номер байта в кадре, от которого зависит длина, 0 - длина постоянна
+    frame_len:              ожидаемая длина кадра включая CRC, без данных переменной длины
+
+    Пример:
+
+        ответ события отсутствуют
+            FD 46 12 52 5D
+
+            cmd = 0x12
+            payload_len_index = PAYLOAD_LEN_FIXED (0)
+            frame_len = 5
+
+        ответ на настройку событий
+
+                           ,-- поле переменной длины 3 байта
+                        ___|____
+            0A 46 18 03 05 05 00 XX XX
+                      |          -----
+                      |           CRC
+                      `-- длина (3)
+
+            cmd = 0x18
+            payload_len_index = 3
+            frame_len = 6 (включая CRC без учета данных переменной длины)
+
+    Для ответа 0x09 номер байта и длина считаются от функции PDU, как у стандартного
+    кадра с адресом: кадр расширения длиннее на 6 байт (подкоманда и серийный номер).
+*/
+const frame_desc_t frame_ext_desc[256] = {
+    [CMD_EXT_SCAN_RESP] = { .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 10 },
+    [CMD_EXT_SCAN_END] = { .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 5 },
+    [CMD_EXT_EVENTS_RESP] = { .payload_len_index = 5, .frame_len = 8 },
+    [CMD_EXT_EVENTS_END] = { .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 5 },
+    [CMD_EXT_EVENTS_CTRL] = { .payload_len_index = 3, .frame_len = 6 },
+};
+
+const frame_desc_t frame_std_desc[256] = {
+    [0x01] = { .payload_len_index = 2, .frame_len = 5 },
+    [0x02] = { .payload_len_index = 2, .frame_len = 5 },
+    [0x03] = { .payload_len_index = 2, .frame_len = 5 },
+    [0x04] = { .payload_len_index = 2, .frame_len = 5 },
+
+    [0x05] = { .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 8 },
+    [0x06] = { .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 8 },
+    [0x0F] = { .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 8 },
+    [0x10] = { .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 8 },
+};
+
+static inline void put_u16_be(uint8_t * buf, uint16_t value)
+{
+    buf[0] = (value >> 8) & 0xFF;
+    buf[1] = (value >> 0) & 0xFF;
+}
+
+static inline void put_u32_be(uint8_t * buf, uint32_t value)
+{
+    buf[0] = (value >> 24) & 0xFF;
+    buf[1] = (value >> 16) & 0xFF;
+    buf[2] = (value >> 8) & 0xFF;
+    buf[3] = (value >> 0) & 0xFF;
+}
+
+static inline uint32_t get_u32_be(const uint8_t * buf)
+{
+    return ((uint32_t)buf[0] << 24) + (buf[1] << 16) + (buf[2] << 8) + (buf[3] << 0);
+}
+
+// CRC младшим байтом вперед за данными кадра, возвращает длину кадра
+static int put_crc(uint8_t * buf, int len)
+{
+    uint16_t crc = modbus_crc(buf, len);
+    buf[len] = crc & 0xFF;
+    buf[len + 1] = crc >> 8;
+    return len + 2;
+}
+
+// кодирование
+
+int frame_encode_scan(uint8_t * buf, uint8_t ext_cmd, uint8_t sub_cmd)
+{
+    buf[0] = SPECIAL_ADDRESS;
+    buf[1] = ext_cmd;
+    buf[2] = sub_cmd;
+    return put_crc(buf, 3);
+}
+
+static int encode_pdu_reg(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint8_t fc, uint16_t address, uint16_t value)
+{
+    buf[0] = SPECIAL_ADDRESS;
+    buf[1] = ext_cmd;
+    buf[2] = CMD_EXT_STD_PDU_REQ;
+    put_u32_be(&buf[3], serial);
+    buf[PAYLOAD_EXT_OFFSET] = fc;
+    put_u16_be(&buf[PAYLOAD_EXT_OFFSET + 1], address);
+    put_u16_be(&buf[PAYLOAD_EXT_OFFSET + 3], value);
+    return put_crc(buf, PAYLOAD_EXT_OFFSET + 5);
+}
+
+int frame_encode_read_regs(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint8_t fc, uint16_t address, uint16_t count)
+{
+    return encode_pdu_reg(buf, ext_cmd, serial, fc, address, count);
+}
+
+int frame_encode_write_reg(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t value)
+{
+    return encode_pdu_reg(buf, ext_cmd, serial, 0x06, address, value);
+}
+
+int frame_encode_write_coil(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint16_t address, int value)
+{
+    return encode_pdu_reg(buf, ext_cmd, serial, 0x05, address, value ? 0xFF00 : 0x0000);
+}
+
+// заголовок запроса записи нескольких coil или регистров, возвращает смещение данных
+static int encode_pdu_multiple(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint8_t fc, uint16_t address,
+    uint16_t count, uint8_t byte_count)
+{
+    encode_pdu_reg(buf, ext_cmd, serial, fc, address, count);
+    buf[PAYLOAD_EXT_OFFSET + 5] = byte_count;
+    return PAYLOAD_EXT_OFFSET + 6;
+}
+
+int frame_encode_write_coils(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t count,
+    const uint8_t * bits)
+{
+    if ((count == 0) || (count > FRAME_WRITE_COILS_MAX)) {
+        return -1;
+    }
+    uint8_t byte_count = (count + 7) / 8;
+    int len = encode_pdu_multiple(buf, ext_cmd, serial, 0x0F, address, count, byte_count);
+    memcpy(&buf[len], bits, byte_count);
+    // неиспользуемые биты последнего байта по modbus должны быть нулями
+    if (count % 8) {
+        buf[len + byte_count - 1] &= (1 << (count % 8)) - 1;
+    }
+    return put_crc(buf, len + byte_count);
+}
+
+int frame_encode_write_regs(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t count,
+    const uint16_t * values)
+{
+    if ((count == 0) || (count > FRAME_WRITE_REGS_MAX)) {
+        return -1;
+    }
+    int len = encode_pdu_multiple(buf, ext_cmd, serial, 0x10, address, count, count * 2);
+    for (int i = 0; i < count; i++) {
+        put_u16_be(&buf[len + i * 2], values[i]);
+    }
+    return put_crc(buf, len + count * 2);
+}
+
+int frame_encode_event_req(uint8_t * buf, uint8_t min_slave, uint8_t max_event_len, uint8_t confirm_slave_id, uint8_t flag)
+{
+    buf[0] = SPECIAL_ADDRESS;
+    buf[1] = SPECIAL_CMD;
+    buf[2] = CMD_EXT_EVENTS_REQ;
+    buf[3] = min_slave;
+    buf[4] = max_event_len;
+    buf[5] = confirm_slave_id;
+    buf[6] = flag;
+    return put_crc(buf, 7);
+}
+
+int frame_encode_event_ctrl(uint8_t * buf, uint8_t slave_id, uint8_t settings_len)
+{
+    buf[0] = slave_id;
+    buf[1] = SPECIAL_CMD;
+    buf[2] = CMD_EXT_EVENTS_CTRL;
+    buf[3] = settings_len;
+    return put_crc(buf, FRAME_EVENT_CTRL_HEADER_LEN + settings_len);
+}
+
+// разбор
+
+int frame_decode(const uint8_t * frame, int len, frame_view_t * v)
+{
+    if ((len < 5) || ((frame[1] != SPECIAL_CMD) && (frame[1] != SPECIAL_CMD_LEGACY)) || (frame_expected_len(frame, len) != len)) {
+        return -1;
+    }
+
+    v->frame = frame;
+    v->len = len;
+    v->slave_id = frame[0];
+    v->ext_cmd = frame[1];
+    v->cmd = frame[2];
+    v->payload = &frame[3];
+    v->payload_len = len - 3 - 2;
+    return 0;
+}
+
+int frame_decode_scan_resp(const frame_view_t * v, frame_scan_resp_t * r)
+{
+    if ((v->cmd != CMD_EXT_SCAN_RESP) || (v->payload_len < 5)) {
+        return -1;
+    }
+    r->serial = get_u32_be(&v->payload[0]);
+    r->id = v->payload[4];
+    return 0;
+}
+
+int frame_decode_pdu_resp(const frame_view_t * v, frame_pdu_resp_t * r)
+{
+    // серийный номер и функция
+    if ((v->cmd != CMD_EXT_STD_PDU_RESP) || (v->payload_len < 5)) {
+        return -1;
+    }
+
+    const uint8_t * pdu = &v->payload[4];
+    int pdu_len = v->payload_len - 4;
+
+    r->serial = get_u32_be(&v->payload[0]);
+    r->fc = pdu[0] & ~MODBUS_EXCEPTION_FLAG;
+    r->exception = 0;
+    r->data = &pdu[1];
+    r->data_len = pdu_len - 1;
+
+    if (pdu[0] & MODBUS_EXCEPTION_FLAG) {
+        if (pdu_len < 2) {
+            return -1;
+        }
+        r->exception = pdu[1];
+        r->data_len = 0;
+    } else if ((r->fc >= 0x01) && (r->fc <= 0x04)) {
+        if ((pdu_len < 2) || (pdu[1] > pdu_len - 2)) {
+            return -1;
+        }
+        r->data = &pdu[2];
+        r->data_len = pdu[1];
+    }
+    return 0;
+}
+
+int frame_decode_event_resp(const frame_view_t * v, const struct ext_modbus_event_resp ** r)
+{
+    const struct ext_modbus_event_resp * resp = (const struct ext_modbus_event_resp *)v->frame;
+
+    if (v->cmd == CMD_EXT_EVENTS_END) {
+        *r = resp;
+        return 0;
+    }
+    if ((v->cmd != CMD_EXT_EVENTS_RESP) || (v->len < (int)sizeof(*resp) + 2) || (v->len < (int)sizeof(*resp) + resp->data_len + 2)) {
+        return -1;
+    }
+    *r = resp;
+    return 0;
+}
+
+int frame_decode_event_ctrl_resp(const frame_view_t * v, frame_event_ctrl_resp_t * r)
+{
+    if ((v->cmd != CMD_EXT_EVENTS_CTRL) || (v->payload_len < 1) || (v->payload[0] > v->payload_len - 1)) {
+        return -1;
+    }
+    r->slave_id = v->slave_id;
+    r->mask = &v->payload[1];
+    r->mask_len = v->payload[0];
+    return 0;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include "modbus_ext.h"
+
+/*
+    Кодирование запросов и разбор ответов расширения протокола
+
+    Описания кадров ответов - таблицы по коду функции: подкоманды расширения (buf[2])
+    и функции стандартного PDU внутри ответа 0x09. Поиск описания - одно обращение
+    по индексу, стоимость не зависит от того, какая это функция.
+
+    Кодировщики пишут кадр целиком в буфер вызывающего, вместе с CRC, и возвращают
+    длину кадра. Буфер должен вмещать кадр (FRAME_*_LEN, для настройки событий -
+    заголовок, настройки и CRC, для записи нескольких coil или регистров - 15 байт и данные).
+
+    Разбор не копирует данные: frame_decode проверяет длину кадра по описанию
+    функции, разборщики типов проверяют подкоманду и возвращают значения полей и
+    указатели на данные внутри принятого кадра. Указатели действительны, пока кадр
+    не перезаписан следующим приемом.
+*/
+
+typedef struct {
+    uint8_t payload_len_index;      // номер байта с длиной переменной части, PAYLOAD_LEN_FIXED - длина постоянна
+    uint8_t frame_len;              // длина кадра с CRC без переменной части, 0 - функции нет
+} frame_desc_t;
+
+extern const frame_desc_t frame_ext_desc[256];     // ответы расширения по подкоманде
+extern const frame_desc_t frame_std_desc[256];     // ответы стандартного PDU по функции, без адреса
+
+// описание ответа или NULL, если такой функции нет
+static inline const frame_desc_t * frame_desc(uint8_t cmd, int is_ext)
+{
+    const frame_desc_t * desc = is_ext ? &frame_ext_desc[cmd] : &frame_std_desc[cmd];
+    return desc->frame_len ? desc : NULL;
+}
+
+// длины запросов с CRC
+#define FRAME_SCAN_REQ_LEN          5
+#define FRAME_PDU_REQ_LEN           14      // чтение или запись одного регистра по серийному номеру
+#define FRAME_EVENT_REQ_LEN         9
+#define FRAME_EVENT_CTRL_HEADER_LEN 4       // server id, команда, подкоманда, длина списка настроек
+
+// 0x01 SCAN INIT или 0x02 SCAN NEXT
+int frame_encode_scan(uint8_t * buf, uint8_t ext_cmd, uint8_t sub_cmd);
+
+// 0x08: чтение count регистров или бит функцией fc 1..4
+int frame_encode_read_regs(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint8_t fc, uint16_t address, uint16_t count);
+
+// 0x08: запись одного holding регистра (функция 6)
+int frame_encode_write_reg(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t value);
+
+// ограничение длины кадра 256 байт: запрос 0x08 на запись N регистров занимает 7 + 6 + 2 * N + 2 байт
+#define FRAME_WRITE_REGS_MAX        120
+#define FRAME_WRITE_COILS_MAX       (241 * 8)
+
+// 0x08: запись одного coil (функция 5), value != 0 - включить
+int frame_encode_write_coil(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint16_t address, int value);
+
+// 0x08: запись count coil (функция 15), bits - упакованы по 8 в байт младшим битом вперед, как в modbus;
+// -1, если count 0 или больше FRAME_WRITE_COILS_MAX
+int frame_encode_write_coils(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t count,
+    const uint8_t * bits);
+
+// 0x08: запись count holding регистров (функция 16); -1, если count 0 или больше FRAME_WRITE_REGS_MAX
+int frame_encode_write_regs(uint8_t * buf, uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t count,
+    const uint16_t * values);
+
+// 0x10: запрос событий с подтверждением пакета от confirm_slave_id
+int frame_encode_event_req(uint8_t * buf, uint8_t min_slave, uint8_t max_event_len, uint8_t confirm_slave_id, uint8_t flag);
+
+// 0x18: настройки событий уже записаны в буфер с FRAME_EVENT_CTRL_HEADER_LEN, дописываются заголовок и CRC
+int frame_encode_event_ctrl(uint8_t * buf, uint8_t slave_id, uint8_t settings_len);
+
+// принятый кадр: заголовок и данные между подкомандой и CRC
+typedef struct {
+    const uint8_t * frame;
+    int len;
+    uint8_t slave_id;
+    uint8_t ext_cmd;
+    uint8_t cmd;
+    const uint8_t * payload;
+    int payload_len;
+} frame_view_t;
+
+// ответ на сканирование 0x03
+typedef struct {
+    uint32_t serial;
+    uint8_t id;
+} frame_scan_resp_t;
+
+// ответ 0x09 на стандартный PDU
+typedef struct {
+    uint32_t serial;
+    uint8_t fc;                     // функция без бита исключения
+    uint8_t exception;              // код исключения modbus, 0 - ответ без исключения
+    const uint8_t * data;           // функции 1..4 - данные после счетчика байт, остальные - после функции
+    int data_len;
+} frame_pdu_resp_t;
+
+// ответ 0x18 на настройку событий
+typedef struct {
+    uint8_t slave_id;
+    const uint8_t * mask;           // маски включенных событий по диапазонам запроса
+    int mask_len;
+} frame_event_ctrl_resp_t;
+
+typedef struct {
+    uint8_t len;
+    uint8_t type;
+    uint8_t event_id[2];
+    uint8_t data[];
+} event_in_buffer_t;
+
+// ответ 0x11 на запрос событий (и 0x12 без событий, у него действительны только первые три поля)
+struct ext_modbus_event_resp {
+    uint8_t slave_id;
+    uint8_t ext_cmd;
+    uint8_t sub_cmd;
+    uint8_t flag;
+    uint8_t events_num;
+    uint8_t data_len;
+    uint8_t data[];
+};
+
+// проверка длины кадра расширения по описанию функции; 0 или -1
+int frame_decode(const uint8_t * frame, int len, frame_view_t * v);
+
+// разбор ответов конкретного типа после frame_decode; 0 или -1, если подкоманда или длина не те
+int frame_decode_scan_resp(const frame_view_t * v, frame_scan_resp_t * r);
+int frame_decode_pdu_resp(const frame_view_t * v, frame_pdu_resp_t * r);
+int frame_decode_event_resp(const frame_view_t * v, const struct ext_modbus_event_resp ** r);
+int frame_decode_event_ctrl_resp(const frame_view_t * v, frame_event_ctrl_resp_t * r);
@@ -0,0 +1,151 @@
+#include <string.h>
+#include "frame_parser.h"
+#include "modbus_crc.h"
+#include "modbus_ext.h"
+#include "frame_codec.h"
+
+#define RING_MASK                   (FRAME_RING_SIZE - 1)
+
+// ожидаемая длина кадра по первым принятым байтам
+int frame_expected_len(const uint8_t * buf, int available_len)
+{
+    if (available_len < 3) {
+        // вся утилита работает только с расширенными ответами
+        if ((available_len == 2) && (buf[1] != SPECIAL_CMD) && (buf[1] != SPECIAL_CMD_LEGACY)) {
+            return FRAME_INVALID;
+        }
+        return FRAME_NEED_MORE;
+    }
+
+    uint8_t cmd = buf[2];
+    int is_ext = 1;
+    int additional_len = 0;
+
+    int len = 0;
+
+    if (cmd == CMD_EXT_STD_PDU_RESP) {
+        // Функция ответа на стандартную команду обрабатывается отдельно
+        if (available_len <= PAYLOAD_EXT_OFFSET) {
+            return FRAME_NEED_MORE;
+        }
+
+        // команда длиннее на 6 байт. так как PDU начинается с 7го байта, но не имеет байта с адресом устройства как стандартный пакет
+        additional_len = 6;
+        is_ext = 0;
+        cmd = buf[PAYLOAD_EXT_OFFSET];
+
+        // устройство ответило ошибкой на вложенную команду
+        if (cmd & MODBUS_EXCEPTION_FLAG) {
+            return additional_len + MODBUS_EXCEPTION_FRAME_LEN;
+        }
+    }
+
+    const frame_desc_t * desc = frame_desc(cmd, is_ext);
+
+    if (desc == NULL) {
+        return FRAME_INVALID;
+    }
+
+    if (desc->payload_len_index) {
+
+        if (available_len <= (additional_len + desc->payload_len_index)) {
+            return FRAME_NEED_MORE;
+        }
+
+        len = buf[additional_len + desc->payload_len_index];
+    }
+
+    len += desc->frame_len;
+    len += additional_len;
+
+    if (len > FRAME_MAX_LEN) {
+        return FRAME_INVALID;
+    }
+
+    return len;
+}
+
+static void frame_restart(frame_parser_t * p)
+{
+    p->frame_len = 0;
+    p->expected_len = 0;
+    p->crc = 0xFFFF;
+}
+
+void frame_parser_reset(frame_parser_t * p)
+{
+    p->head = 0;
+    p->tail = 0;
+    p->cursor = 0;
+    p->skipped = 0;
+    frame_restart(p);
+}
+
+uint8_t * frame_parser_write_ptr(frame_parser_t * p, int * space)
+{
+    unsigned used = p->head - p->tail;
+    unsigned to_end = FRAME_RING_SIZE - (p->head & RING_MASK);
+    unsigned free_space = FRAME_RING_SIZE - used;
+
+    *space = free_space < to_end ? free_space : to_end;
+    return &p->ring[p->head & RING_MASK];
+}
+
+void frame_parser_commit(frame_parser_t * p, int len)
+{
+    p->head += len;
+}
+
+int frame_parser_next(frame_parser_t * p, uint8_t ** frame)
+{
+    while (p->cursor != p->head) {
+        uint8_t byte = p->ring[p->cursor & RING_MASK];
+        p->cursor++;
+
+        if (p->frame_len == 0) {
+            // байты арбитража между кадрами и перед кадром
+            if (byte == ARBITRATION_BYTE) {
+                p->tail = p->cursor;
+                p->skipped++;
+                continue;
+            }
+        }
+
+        p->frame[p->frame_len++] = byte;
+        p->crc = modbus_crc_iv(p->crc, &byte, 1);
+
+        if (p->expected_len == 0) {
+            int len = frame_expected_len(p->frame, p->frame_len);
+            if (len == FRAME_INVALID) {
+                // с этого байта кадр не начинается - продолжаем со следующего
+                p->tail++;
+                p->cursor = p->tail;
+                p->skipped++;
+                frame_restart(p);
+                continue;
+            }
+            p->expected_len = len;
+        }
+
+        if (p->frame_len == p->expected_len) {
+            // CRC кадра вместе с его контрольной суммой дает 0
+            int len = p->frame_len;
+
+            if (p->crc != 0) {
+                // заголовок мог оказаться помехой перед настоящим кадром: разбор продолжается
+                // со следующего за ним байта, как и для байта, с которого кадр начаться не может
+                p->tail++;
+                p->cursor = p->tail;
+                p->skipped++;
+                frame_restart(p);
+                return FRAME_CRC_ERROR;
+            }
+
+            p->tail = p->cursor;
+            frame_restart(p);
+            *frame = p->frame;
+            return len;
+        }
+    }
+    return FRAME_NEED_MORE;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#define FRAME_MAX_LEN               512
+#define FRAME_RING_SIZE             1024    // степень двойки
+
+#define FRAME_NEED_MORE             0
+#define FRAME_INVALID               (-1)
+#define FRAME_CRC_ERROR             (-2)
+
+/*
+    Потоковый разбор ответов устройств
+
+    Принятые байты складываются в кольцевой буфер, разбор идет побайтно с того места,
+    где остановился в прошлый раз. Байты арбитража 0xFF перед кадром пропускаются
+    за один проход, CRC считается по мере поступления байт. Байты после найденного
+    кадра остаются в буфере для следующего кадра.
+
+    Кадр собирается в frame, байты из кольца освобождаются только после того, как кадр
+    принят: если заголовок оказался не кадром или у кадра не сошлась CRC, разбор
+    продолжается со следующего за его первым байтом.
+*/
+typedef struct {
+    uint8_t ring[FRAME_RING_SIZE];
+    unsigned head;          // позиция записи принятых байт
+    unsigned tail;          // начало еще не разобранного кадра
+    unsigned cursor;        // следующий байт для разбора
+
+    uint8_t frame[FRAME_MAX_LEN];
+    int frame_len;
+    int expected_len;       // 0 пока длина кадра не известна
+    uint16_t crc;
+
+    unsigned skipped;       // пропущено байт арбитража и мусора перед последним кадром
+} frame_parser_t;
+
+void frame_parser_reset(frame_parser_t * p);
+
+// непрерывный участок свободного места в кольце для записи принятых байт
+uint8_t * frame_parser_write_ptr(frame_parser_t * p, int * space);
+void frame_parser_commit(frame_parser_t * p, int len);
+
+// разбор накопленных байт: длина кадра, FRAME_NEED_MORE или FRAME_CRC_ERROR
+int frame_parser_next(frame_parser_t * p, uint8_t ** frame);
+
+// ожидаемая длина кадра по первым принятым байтам:
+// длина кадра, FRAME_NEED_MORE или FRAME_INVALID если с этого байта кадр начинаться не может
+int frame_expected_len(const uint8_t * buf, int available_len);
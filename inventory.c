@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "inventory.h"
+
+#define INVENTORY_LINE_MAX          512
+#define INVENTORY_HEADER            "# serial\tid\tlast_seen\tinfo_mask\tmodel\tfw\tsignature\tbootloader\n"
+
+int inventory_load(const char * path, inventory_t * inv, FILE * out)
+{
+    inv->num = 0;
+
+    FILE * f = fopen(path, "r");
+    if (f == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(out, "Error open inventory %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[INVENTORY_LINE_MAX];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_num++;
+        line[strcspn(line, "\r\n")] = 0;
+        if ((line[0] == '#') || (line[0] == 0)) {
+            continue;
+        }
+        if (inv->num == DEVICES_MAX) {
+            fprintf(out, "Error inventory %s: too many devices\n", path);
+            fclose(f);
+            return -1;
+        }
+
+        dev_info_t * dev = &inv->devices[inv->num];
+        memset(dev, 0, sizeof(*dev));
+
+        // strtok не подходит - пропускает пустые поля
+        char * fields[4 + DEV_INFO_FIELDS_NUM] = {};
+        int fields_num = 0;
+        char * p = line;
+        while (fields_num < (int)(sizeof(fields) / sizeof(fields[0]))) {
+            fields[fields_num++] = p;
+            p = strchr(p, '\t');
+            if (p == NULL) {
+                break;
+            }
+            *p++ = 0;
+        }
+
+        unsigned long serial;
+        unsigned id;
+        long long last_seen;
+        if ((fields_num < 4) ||
+            (sscanf(fields[0], "%lu", &serial) != 1) ||
+            (sscanf(fields[1], "%u", &id) != 1) ||
+            (sscanf(fields[2], "%lld", &last_seen) != 1) ||
+            (sscanf(fields[3], "%x", &dev->info_mask) != 1)) {
+            fprintf(out, "Error inventory %s:%d: wrong format\n", path, line_num);
+            fclose(f);
+            return -1;
+        }
+
+        dev->serial = serial;
+        dev->id = id;
+        dev->last_seen = last_seen;
+        for (int i = 0; i < DEV_INFO_FIELDS_NUM; i++) {
+            if (4 + i < fields_num) {
+                strncpy(dev->info[i], fields[4 + i], DEV_INFO_STR_MAX);
+            }
+        }
+        inv->num++;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void write_str(FILE * f, const char * str)
+{
+    for (; *str; str++) {
+        fputc(((unsigned char)*str < ' ') ? ' ' : *str, f);
+    }
+}
+
+int inventory_save(const char * path, const inventory_t * inv, FILE * out)
+{
+    size_t tmp_len = strlen(path) + 5;
+    char * tmp_path = malloc(tmp_len);
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    FILE * f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        fprintf(out, "Error write inventory %s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return -1;
+    }
+
+    fputs(INVENTORY_HEADER, f);
+    for (int n = 0; n < inv->num; n++) {
+        const dev_info_t * dev = &inv->devices[n];
+        fprintf(f, "%lu\t%u\t%lld\t%x", (unsigned long)dev->serial, dev->id, (long long)dev->last_seen, dev->info_mask);
+        for (int i = 0; i < DEV_INFO_FIELDS_NUM; i++) {
+            fputc('\t', f);
+            write_str(f, dev->info[i]);
+        }
+        fputc('\n', f);
+    }
+
+    int err = ferror(f);
+    err |= fclose(f);
+#if defined(_WIN32)
+    // rename в windows не заменяет существующий файл
+    if (!err) {
+        remove(path);
+    }
+#endif
+    if (err || (rename(tmp_path, path) != 0)) {
+        fprintf(out, "Error write inventory %s: %s\n", path, strerror(errno));
+        remove(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    free(tmp_path);
+    return 0;
+}
+
+dev_info_t * inventory_find(inventory_t * inv, uint32_t serial)
+{
+    for (int n = 0; n < inv->num; n++) {
+        if (inv->devices[n].serial == serial) {
+            return &inv->devices[n];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+#include "dev_info.h"
+
+/*
+    Сохраняемый между запусками список устройств шины
+
+    Текстовый файл, по строке на устройство, поля разделены табуляцией:
+    serial  id  last_seen  info_mask  model  fw  signature  bootloader
+*/
+typedef struct {
+    int num;
+    dev_info_t devices[DEVICES_MAX];
+} inventory_t;
+
+// отсутствующий файл - пустой список, возвращает -1 при ошибке чтения или формата, ошибка печатается в out
+int inventory_load(const char * path, inventory_t * inv, FILE * out);
+
+// запись через временный файл, чтобы прерванная запись не портила список
+int inventory_save(const char * path, const inventory_t * inv, FILE * out);
+
+dev_info_t * inventory_find(inventory_t * inv, uint32_t serial);
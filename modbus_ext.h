@@ -0,0 +1,32 @@
+#pragma once
+
+// константы расширения протокола modbus wirenboard (см. docs/protocol.ru.md)
+
+#define SPECIAL_ADDRESS             0xFD
+#define SPECIAL_CMD                 0x46
+#define SPECIAL_CMD_LEGACY          0x60
+
+#define CMD_EXT_SCAN_START          0x01
+#define CMD_EXT_SCAN_NEXT           0x02
+#define CMD_EXT_SCAN_RESP           0x03
+#define CMD_EXT_SCAN_END            0x04
+#define CMD_EXT_EVENTS_REQ          0x10
+#define CMD_EXT_EVENTS_RESP         0x11
+#define CMD_EXT_EVENTS_END          0x12
+#define CMD_EXT_EVENTS_CTRL         0x18
+
+
+#define CMD_EXT_STD_PDU_REQ         0x08
+#define CMD_EXT_STD_PDU_RESP        0x09
+
+#define HOLDREG_WB_SLAVE_ID         128
+
+
+#define PAYLOAD_LEN_FIXED           0
+#define PAYLOAD_EXT_OFFSET          7
+
+#define MODBUS_EXCEPTION_FLAG       0x80
+#define MODBUS_EXCEPTION_FRAME_LEN  5       // адрес, функция с битом ошибки, код ошибки, CRC
+
+// байт, которым устройства занимают окна арбитража
+#define ARBITRATION_BYTE            0xFF
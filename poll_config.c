@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "poll_config.h"
+#include "bus_workers.h"
+
+#define POLL_CONFIG_LINE_MAX        256
+
+static const char * const reg_types[] = {
+    [1] = "coil",
+    [2] = "discrete",
+    [3] = "holding",
+    [4] = "input",
+};
+
+const char * poll_config_type_name(uint8_t fc)
+{
+    return ((fc >= 1) && (fc <= 4)) ? reg_types[fc] : "unknown";
+}
+
+static int parse_type(const char * arg, uint8_t * fc)
+{
+    unsigned value;
+
+    for (unsigned i = 1; i < sizeof(reg_types) / sizeof(reg_types[0]); i++) {
+        if (strcmp(arg, reg_types[i]) == 0) {
+            *fc = i;
+            return 0;
+        }
+    }
+    if ((sscanf(arg, "%u", &value) == 1) && (value >= 1) && (value <= 4)) {
+        *fc = value;
+        return 0;
+    }
+    return -1;
+}
+
+// секция [port]: 1 - строка секции, section - совпадает ли порт секции с port; -1 - ошибка формата
+static int parse_section(const char * line, const char * port, int * section)
+{
+    line += strspn(line, " \t");
+    if (*line != '[') {
+        return 0;
+    }
+
+    char name[POLL_CONFIG_LINE_MAX];
+    int len = 0;
+    if ((sscanf(line, "[%255[^]]]%n", name, &len) != 1) || (len == 0) || (line[len + strspn(&line[len], " \t")] != 0)) {
+        return -1;
+    }
+
+    char section_port[POLL_CONFIG_LINE_MAX];
+    char own_port[POLL_CONFIG_LINE_MAX];
+    bus_port_name(section_port, sizeof(section_port), name);
+    bus_port_name(own_port, sizeof(own_port), port);
+    *section = (strcmp(section_port, own_port) == 0);
+    return 1;
+}
+
+int poll_config_load(const char * path, const char * port, reg_poll_t * poll, FILE * out)
+{
+    FILE * f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(out, "Error open poll config %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[POLL_CONFIG_LINE_MAX];
+    int line_num = 0;
+    int own_section = 1;            // строки до первой секции - для всех портов
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_num++;
+        line[strcspn(line, "#\r\n")] = 0;
+
+        int res = parse_section(line, port, &own_section);
+        if (res < 0) {
+            fprintf(out, "Error poll config %s:%d: wrong section\n", path, line_num);
+            fclose(f);
+            return -1;
+        }
+        if (res > 0) {
+            continue;
+        }
+
+        unsigned long long serial;
+        char type_str[16];
+        char range_str[32];
+        unsigned period;
+        int fields = sscanf(line, "%llu %15s %31s %u", &serial, type_str, range_str, &period);
+        if (fields <= 0) {
+            continue;
+        }
+
+        uint8_t fc;
+        unsigned first;
+        unsigned last;
+        int range_fields = (fields == 4) ? sscanf(range_str, "%u-%u", &first, &last) : 0;
+        if (range_fields == 1) {
+            last = first;
+        }
+        if ((fields != 4) || (range_fields < 1) || (parse_type(type_str, &fc) != 0) ||
+            (serial > 0xFFFFFFFF) || (first > last) || (last > 0xFFFF) || (period == 0)) {
+            fprintf(out, "Error poll config %s:%d: wrong format\n", path, line_num);
+            fclose(f);
+            return -1;
+        }
+        if (!own_section) {
+            continue;
+        }
+
+        if (reg_poll_add(poll, serial, fc, first, last - first + 1, period) < 0) {
+            fprintf(out, "Error poll config %s:%d: range too long or too many registers\n", path, line_num);
+            fclose(f);
+            return -1;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdio.h>
+#include "reg_poll.h"
+
+/*
+    Список регистров для периодического опроса (-Q)
+
+    Текстовый файл, по строке на регистр или диапазон регистров:
+
+        # serial      type      address   period_ms
+        4262588889    holding   0-5       100
+        4262588889    input     35        1000
+        4267937719    2         0-7       50
+
+    type - номер функции чтения (1 coil, 2 discrete, 3 holding, 4 input) или ее название.
+    Строки, начинающиеся с #, и пустые строки пропускаются.
+
+    При опросе нескольких портов устройства каждого порта записываются в его секцию,
+    порт указывается как в -d (/dev/ можно опустить). Строки до первой секции
+    опрашиваются на всех портах:
+
+        [/dev/ttyRS485-1]
+        4262588889    holding   0-5       100
+        [ttyRS485-2]
+        4267937719    input     35        1000
+*/
+
+// загрузка строк порта port; возвращает -1 при ошибке чтения или формата, ошибка печатается в out
+int poll_config_load(const char * path, const char * port, reg_poll_t * poll, FILE * out);
+
+// название типа регистров по номеру функции чтения
+const char * poll_config_type_name(uint8_t fc);
@@ -0,0 +1,415 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "port_setup.h"
+
+#if !defined(_WIN32)
+#include <termios.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+
+static const char * const status_names[] = {
+    [PORT_SETUP_SKIPPED] = "skipped",
+    [PORT_SETUP_APPLIED] = "applied",
+    [PORT_SETUP_CHANGED] = "changed by driver",
+    [PORT_SETUP_UNSUPPORTED] = "not supported by driver",
+    [PORT_SETUP_FAILED] = "failed",
+};
+
+void port_setup_init(port_setup_t * setup)
+{
+    memset(setup, 0, sizeof(*setup));
+    setup->vmin = -1;
+    setup->vtime = -1;
+}
+
+static int parse_byte(const char * s, size_t len, int * value)
+{
+    char * end;
+    long v = strtol(s, &end, 10);
+    if ((end == s) || ((size_t)(end - s) != len) || (v < 0) || (v > 255)) {
+        return -1;
+    }
+    *value = v;
+    return 0;
+}
+
+int port_setup_parse(const char * arg, port_setup_t * setup)
+{
+    port_setup_init(setup);
+
+    while (*arg) {
+        size_t len = strcspn(arg, ",");
+        size_t name_len = strcspn(arg, ",=");
+        const char * value = &arg[name_len + 1];
+        size_t value_len = (name_len < len) ? len - name_len - 1 : 0;
+
+        if ((len == strlen("low_latency")) && (strncmp(arg, "low_latency", len) == 0)) {
+            setup->low_latency = 1;
+        } else if ((name_len == strlen("rs485")) && (strncmp(arg, "rs485", name_len) == 0)) {
+            setup->rs485 = 1;
+            if (name_len < len) {
+                // rs485=before/after, задержки RTS в мс
+                unsigned before, after;
+                int n;
+                if ((sscanf(value, "%u/%u%n", &before, &after, &n) != 2) || ((size_t)n != value_len) ||
+                    (before > PORT_SETUP_RTS_DELAY_MAX_MS) || (after > PORT_SETUP_RTS_DELAY_MAX_MS)) {
+                    return -1;
+                }
+                setup->rts_delay_before_ms = before;
+                setup->rts_delay_after_ms = after;
+            }
+        } else if ((name_len == strlen("vmin")) && (strncmp(arg, "vmin", name_len) == 0) && (name_len < len)) {
+            if (parse_byte(value, value_len, &setup->vmin) != 0) {
+                return -1;
+            }
+        } else if ((name_len == strlen("vtime")) && (strncmp(arg, "vtime", name_len) == 0) && (name_len < len)) {
+            if (parse_byte(value, value_len, &setup->vtime) != 0) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+
+        arg += len;
+        if (*arg == ',') {
+            arg++;
+        }
+    }
+    return 0;
+}
+
+static void saved_init(port_setup_saved_t * saved)
+{
+    saved->low_latency = -1;
+    saved->latency_timer_ms = -1;
+    saved->rs485 = -1;
+    saved->rts_delay_before_ms = 0;
+    saved->rts_delay_after_ms = 0;
+    saved->vmin = -1;
+    saved->vtime = -1;
+}
+
+#if defined(__linux__)
+
+// ioctl, которого нет у драйвера, возвращает ENOTTY (или EINVAL у части usb-serial)
+static port_setup_status_t errno_status(void)
+{
+    return ((errno == ENOTTY) || (errno == EINVAL)) ? PORT_SETUP_UNSUPPORTED : PORT_SETUP_FAILED;
+}
+
+// таймер задержки USB адаптера, -1 если его нет; запись value, если value >= 0
+static int latency_timer(const char * device, int value)
+{
+    const char * name = strrchr(device, '/');
+    name = name ? name + 1 : device;
+
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer", name);
+
+    if (value >= 0) {
+        FILE * f = fopen(path, "w");
+        if (f) {
+            fprintf(f, "%d\n", value);
+            fclose(f);
+        }
+    }
+
+    int timer_ms = -1;
+    FILE * f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%d", &timer_ms) != 1) {
+            timer_ms = -1;
+        }
+        fclose(f);
+    }
+    return timer_ms;
+}
+
+static port_setup_status_t set_low_latency(int fd, const char * device, port_setup_report_t * report)
+{
+    port_setup_status_t status;
+    struct serial_struct ss;
+
+    if (ioctl(fd, TIOCGSERIAL, &ss) != 0) {
+        status = errno_status();
+    } else {
+        report->saved.low_latency = (ss.flags & ASYNC_LOW_LATENCY) ? 1 : 0;
+        ss.flags |= ASYNC_LOW_LATENCY;
+        if ((ioctl(fd, TIOCSSERIAL, &ss) != 0) || (ioctl(fd, TIOCGSERIAL, &ss) != 0)) {
+            status = errno_status();
+        } else {
+            status = (ss.flags & ASYNC_LOW_LATENCY) ? PORT_SETUP_APPLIED : PORT_SETUP_CHANGED;
+        }
+    }
+
+    // у адаптеров FTDI задержку определяет таймер, флаг драйвер может не учитывать
+    report->saved.latency_timer_ms = latency_timer(device, -1);
+    report->latency_timer_ms = latency_timer(device, 1);
+    if (report->latency_timer_ms >= 0) {
+        status = (report->latency_timer_ms <= 1) ? PORT_SETUP_APPLIED : PORT_SETUP_FAILED;
+    }
+    return status;
+}
+
+static port_setup_status_t set_rs485(int fd, const port_setup_t * setup, port_setup_report_t * report)
+{
+#if defined(TIOCSRS485)
+    struct serial_rs485 rs;
+
+    memset(&rs, 0, sizeof(rs));
+    if (ioctl(fd, TIOCGRS485, &rs) != 0) {
+        return errno_status();
+    }
+    report->saved.rs485 = rs.flags;
+    report->saved.rts_delay_before_ms = rs.delay_rts_before_send;
+    report->saved.rts_delay_after_ms = rs.delay_rts_after_send;
+
+    // RTS активен на время передачи, свое эхо не принимаем: ответ читается сразу после запроса
+    rs.flags |= SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+    rs.flags &= ~(SER_RS485_RTS_AFTER_SEND | SER_RS485_RX_DURING_TX);
+    rs.delay_rts_before_send = setup->rts_delay_before_ms;
+    rs.delay_rts_after_send = setup->rts_delay_after_ms;
+
+    if ((ioctl(fd, TIOCSRS485, &rs) != 0) || (ioctl(fd, TIOCGRS485, &rs) != 0)) {
+        return errno_status();
+    }
+    if (!(rs.flags & SER_RS485_ENABLED)) {
+        return PORT_SETUP_FAILED;
+    }
+
+    report->rts_delay_before_ms = rs.delay_rts_before_send;
+    report->rts_delay_after_ms = rs.delay_rts_after_send;
+    if ((rs.delay_rts_before_send != setup->rts_delay_before_ms) || (rs.delay_rts_after_send != setup->rts_delay_after_ms) ||
+        (rs.flags & SER_RS485_RX_DURING_TX)) {
+        return PORT_SETUP_CHANGED;
+    }
+    return PORT_SETUP_APPLIED;
+#else
+    (void)fd;
+    (void)setup;
+    (void)report;
+    return PORT_SETUP_UNSUPPORTED;
+#endif
+}
+
+static int restore_low_latency(int fd, const char * device, const port_setup_saved_t * saved)
+{
+    int res = 0;
+
+    if (saved->low_latency == 0) {
+        struct serial_struct ss;
+        if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+            ss.flags &= ~ASYNC_LOW_LATENCY;
+            res = ioctl(fd, TIOCSSERIAL, &ss);
+        } else {
+            res = -1;
+        }
+    }
+    if ((saved->latency_timer_ms >= 0) && (latency_timer(device, saved->latency_timer_ms) != saved->latency_timer_ms)) {
+        res = -1;
+    }
+    return res ? -1 : 0;
+}
+
+static int restore_rs485(int fd, const port_setup_saved_t * saved)
+{
+#if defined(TIOCSRS485)
+    struct serial_rs485 rs;
+
+    memset(&rs, 0, sizeof(rs));
+    if (ioctl(fd, TIOCGRS485, &rs) != 0) {
+        return -1;
+    }
+    rs.flags = saved->rs485;
+    rs.delay_rts_before_send = saved->rts_delay_before_ms;
+    rs.delay_rts_after_send = saved->rts_delay_after_ms;
+    return (ioctl(fd, TIOCSRS485, &rs) == 0) ? 0 : -1;
+#else
+    (void)fd;
+    (void)saved;
+    return -1;
+#endif
+}
+
+#elif !defined(_WIN32)
+
+static port_setup_status_t set_low_latency(int fd, const char * device, port_setup_report_t * report)
+{
+    (void)fd;
+    (void)device;
+    (void)report;
+    return PORT_SETUP_UNSUPPORTED;
+}
+
+static port_setup_status_t set_rs485(int fd, const port_setup_t * setup, port_setup_report_t * report)
+{
+    (void)fd;
+    (void)setup;
+    (void)report;
+    return PORT_SETUP_UNSUPPORTED;
+}
+
+static int restore_low_latency(int fd, const char * device, const port_setup_saved_t * saved)
+{
+    (void)fd;
+    (void)device;
+    (void)saved;
+    return -1;
+}
+
+static int restore_rs485(int fd, const port_setup_saved_t * saved)
+{
+    (void)fd;
+    (void)saved;
+    return -1;
+}
+
+#endif // __linux__
+
+#if !defined(_WIN32)
+
+static port_setup_status_t set_termios(int fd, const port_setup_t * setup, port_setup_report_t * report)
+{
+    struct termios t;
+
+    if (tcgetattr(fd, &t) != 0) {
+        return PORT_SETUP_FAILED;
+    }
+    report->saved.vmin = t.c_cc[VMIN];
+    report->saved.vtime = t.c_cc[VTIME];
+    if (setup->vmin >= 0) {
+        t.c_cc[VMIN] = setup->vmin;
+    }
+    if (setup->vtime >= 0) {
+        t.c_cc[VTIME] = setup->vtime;
+    }
+    if ((tcsetattr(fd, TCSANOW, &t) != 0) || (tcgetattr(fd, &t) != 0)) {
+        return PORT_SETUP_FAILED;
+    }
+
+    report->vmin = t.c_cc[VMIN];
+    report->vtime = t.c_cc[VTIME];
+    if (((setup->vmin >= 0) && (report->vmin != setup->vmin)) || ((setup->vtime >= 0) && (report->vtime != setup->vtime))) {
+        return PORT_SETUP_CHANGED;
+    }
+    return PORT_SETUP_APPLIED;
+}
+
+int port_setup_apply(struct sp_port * port, const char * device, const port_setup_t * setup, port_setup_report_t * report)
+{
+    int fd = -1;
+
+    memset(report, 0, sizeof(*report));
+    report->latency_timer_ms = -1;
+    report->vmin = -1;
+    report->vtime = -1;
+    saved_init(&report->saved);
+
+    if (sp_get_port_handle(port, &fd) != SP_OK) {
+        fd = -1;
+    }
+
+    if (setup->low_latency) {
+        report->low_latency = (fd < 0) ? PORT_SETUP_FAILED : set_low_latency(fd, device, report);
+    }
+    if (setup->rs485) {
+        report->rs485 = (fd < 0) ? PORT_SETUP_FAILED : set_rs485(fd, setup, report);
+    }
+    if ((setup->vmin >= 0) || (setup->vtime >= 0)) {
+        report->termios = (fd < 0) ? PORT_SETUP_FAILED : set_termios(fd, setup, report);
+    }
+
+    int failed = (report->low_latency >= PORT_SETUP_UNSUPPORTED) || (report->rs485 >= PORT_SETUP_UNSUPPORTED) ||
+                 (report->termios >= PORT_SETUP_UNSUPPORTED);
+    return failed ? -1 : 0;
+}
+
+int port_setup_restore(struct sp_port * port, const char * device, const port_setup_report_t * report)
+{
+    const port_setup_saved_t * saved = &report->saved;
+    int fd = -1;
+    int res = 0;
+
+    if (sp_get_port_handle(port, &fd) != SP_OK) {
+        fd = -1;
+    }
+
+    if ((saved->low_latency >= 0) || (saved->latency_timer_ms >= 0)) {
+        res |= (fd < 0) ? -1 : restore_low_latency(fd, device, saved);
+    }
+    if (saved->rs485 >= 0) {
+        res |= (fd < 0) ? -1 : restore_rs485(fd, saved);
+    }
+    if (saved->vmin >= 0) {
+        struct termios t;
+        if ((fd < 0) || (tcgetattr(fd, &t) != 0)) {
+            res = -1;
+        } else {
+            t.c_cc[VMIN] = saved->vmin;
+            t.c_cc[VTIME] = saved->vtime;
+            res |= (tcsetattr(fd, TCSANOW, &t) == 0) ? 0 : -1;
+        }
+    }
+    return res ? -1 : 0;
+}
+
+#else // _WIN32
+
+int port_setup_apply(struct sp_port * port, const char * device, const port_setup_t * setup, port_setup_report_t * report)
+{
+    (void)port;
+    (void)device;
+
+    memset(report, 0, sizeof(*report));
+    report->latency_timer_ms = -1;
+    report->vmin = -1;
+    report->vtime = -1;
+    saved_init(&report->saved);
+
+    report->low_latency = setup->low_latency ? PORT_SETUP_UNSUPPORTED : PORT_SETUP_SKIPPED;
+    report->rs485 = setup->rs485 ? PORT_SETUP_UNSUPPORTED : PORT_SETUP_SKIPPED;
+    report->termios = ((setup->vmin >= 0) || (setup->vtime >= 0)) ? PORT_SETUP_UNSUPPORTED : PORT_SETUP_SKIPPED;
+    return (setup->low_latency || setup->rs485 || (report->termios != PORT_SETUP_SKIPPED)) ? -1 : 0;
+}
+
+int port_setup_restore(struct sp_port * port, const char * device, const port_setup_report_t * report)
+{
+    (void)port;
+    (void)device;
+    (void)report;
+    return 0;
+}
+
+#endif // _WIN32
+
+void port_setup_print(const port_setup_report_t * report, FILE * out)
+{
+    if (report->low_latency != PORT_SETUP_SKIPPED) {
+        fprintf(out, "Port setup: low_latency %s", status_names[report->low_latency]);
+        if (report->latency_timer_ms >= 0) {
+            fprintf(out, ", adapter latency timer %d ms", report->latency_timer_ms);
+        }
+        fprintf(out, "\n");
+    }
+
+    if (report->rs485 != PORT_SETUP_SKIPPED) {
+        fprintf(out, "Port setup: rs485 %s", status_names[report->rs485]);
+        if ((report->rs485 == PORT_SETUP_APPLIED) || (report->rs485 == PORT_SETUP_CHANGED)) {
+            fprintf(out, ", rts delay before send %u ms, after send %u ms", report->rts_delay_before_ms, report->rts_delay_after_ms);
+        }
+        fprintf(out, "\n");
+    }
+
+    if (report->termios != PORT_SETUP_SKIPPED) {
+        fprintf(out, "Port setup: termios %s", status_names[report->termios]);
+        if (report->vmin >= 0) {
+            fprintf(out, ", vmin %d, vtime %d", report->vmin, report->vtime);
+        }
+        fprintf(out, "\n");
+    }
+}
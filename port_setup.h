@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <libserialport.h>
+
+/*
+    Настройка порта Linux для малых задержек (-k)
+
+    libserialport задает только скорость и формат символа, остальное остается на
+    усмотрение драйвера:
+
+        low_latency - флаг ASYNC_LOW_LATENCY (TIOCSSERIAL) и таймер задержки USB
+                      адаптера 1 мс (latency_timer в sysfs, ftdi_sio). По умолчанию
+                      адаптер FTDI копит принятые байты до 16 мс, и цикл опроса
+                      событий растягивается до этого таймера вместо 4 мс на 115200
+        rs485       - режим RS-485 драйвера (TIOCSRS485): направление передачи
+                      переключает ядро по RTS, с задержками до и после передачи в мс
+        vmin, vtime - VMIN/VTIME termios. Порт читается через poll, и при VTIME 0
+                      poll сообщает о данных только после VMIN байт: меньше
+                      пробуждений на длинных ответах, но кадр короче VMIN байт
+                      дочитывается только по таймауту. -1 - не менять
+
+    Драйвер может не поддерживать настройку или принять ее с изменениями (ядро
+    ограничивает задержки RTS, pty не поддерживает ни TIOCSSERIAL, ни TIOCSRS485),
+    поэтому после записи настройки читаются обратно и в отчет попадает то, что
+    действует на самом деле. На других системах поддерживаются только VMIN/VTIME,
+    в windows - ничего.
+
+    Настройки драйвера и таймер адаптера в sysfs переживают закрытие порта, поэтому
+    прежние значения сохраняются в отчете и возвращаются port_setup_restore.
+*/
+
+#define PORT_SETUP_RTS_DELAY_MAX_MS 100
+
+typedef enum {
+    PORT_SETUP_SKIPPED,             // не запрашивалось
+    PORT_SETUP_APPLIED,
+    PORT_SETUP_CHANGED,             // драйвер принял настройку с изменениями
+    PORT_SETUP_UNSUPPORTED,
+    PORT_SETUP_FAILED,
+} port_setup_status_t;
+
+typedef struct {
+    int low_latency;
+    int rs485;
+    uint32_t rts_delay_before_ms;
+    uint32_t rts_delay_after_ms;
+    int vmin;
+    int vtime;                      // десятые доли секунды
+} port_setup_t;
+
+// прежние значения измененных настроек, -1 - настройка не менялась
+typedef struct {
+    int low_latency;                // флаг ASYNC_LOW_LATENCY
+    int latency_timer_ms;
+    int rs485;                      // флаги serial_rs485
+    uint32_t rts_delay_before_ms;
+    uint32_t rts_delay_after_ms;
+    int vmin;
+    int vtime;
+} port_setup_saved_t;
+
+typedef struct {
+    port_setup_status_t low_latency;
+    int latency_timer_ms;           // -1 - у адаптера нет таймера задержки
+    port_setup_status_t rs485;
+    uint32_t rts_delay_before_ms;
+    uint32_t rts_delay_after_ms;
+    port_setup_status_t termios;
+    int vmin;
+    int vtime;
+    port_setup_saved_t saved;
+} port_setup_report_t;
+
+// ничего не меняет: vmin и vtime -1
+void port_setup_init(port_setup_t * setup);
+
+// разбор списка вида low_latency,rs485[=before/after],vmin=N,vtime=N; 0 или -1
+int port_setup_parse(const char * arg, port_setup_t * setup);
+
+// device - путь к порту без символьных ссылок, по нему находится таймер адаптера в sysfs;
+// возвращает -1, если хотя бы одна запрошенная настройка не применена
+int port_setup_apply(struct sp_port * port, const char * device, const port_setup_t * setup, port_setup_report_t * report);
+
+// возвращает настройки, сохраненные port_setup_apply; -1, если вернуть удалось не все
+int port_setup_restore(struct sp_port * port, const char * device, const port_setup_report_t * report);
+
+void port_setup_print(const port_setup_report_t * report, FILE * out);
@@ -0,0 +1,161 @@
+#include <string.h>
+#include "reg_poll.h"
+
+static int is_bits(uint8_t fc)
+{
+    return (fc == 0x01) || (fc == 0x02);
+}
+
+// наибольшее количество регистров в одном запросе: ответ 0x09 не длиннее 256 байт
+static int block_count_max(uint8_t fc)
+{
+    return is_bits(fc) ? WBMBEXT_READ_REGS_MAX * 16 : WBMBEXT_READ_REGS_MAX;
+}
+
+void reg_poll_init(reg_poll_t * poll, uint8_t ext_cmd)
+{
+    memset(poll, 0, sizeof(*poll));
+    poll->ext_cmd = ext_cmd;
+}
+
+int reg_poll_add(reg_poll_t * poll, uint32_t serial, uint8_t fc, uint16_t address, uint16_t count, uint32_t period_ms)
+{
+    if ((fc < 0x01) || (fc > 0x04) || (count == 0) || (count > block_count_max(fc)) ||
+        (address + count > 0x10000) || (period_ms == 0)) {
+        return WBMBEXT_ERR_ARG;
+    }
+    if ((poll->items_num == REG_POLL_ITEMS_MAX) || (poll->values_num + count > REG_POLL_VALUES_MAX)) {
+        return WBMBEXT_ERR_ARG;
+    }
+
+    reg_poll_item_t * item = &poll->items[poll->items_num];
+    memset(item, 0, sizeof(*item));
+    item->serial = serial;
+    item->fc = fc;
+    item->address = address;
+    item->count = count;
+    item->period_ms = period_ms;
+    item->block = -1;
+    item->values_offset = poll->values_num;
+    item->result = WBMBEXT_ERR_TIMEOUT;
+
+    poll->values_num += count;
+    return poll->items_num++;
+}
+
+static int item_cmp(const reg_poll_item_t * a, const reg_poll_item_t * b)
+{
+    if (a->serial != b->serial) {
+        return a->serial < b->serial ? -1 : 1;
+    }
+    if (a->fc != b->fc) {
+        return a->fc < b->fc ? -1 : 1;
+    }
+    if (a->period_ms != b->period_ms) {
+        return a->period_ms < b->period_ms ? -1 : 1;
+    }
+    if (a->address != b->address) {
+        return a->address < b->address ? -1 : 1;
+    }
+    return 0;
+}
+
+int reg_poll_plan(reg_poll_t * poll, uint64_t now_ns)
+{
+    // сортировка вставками: список задается один раз и обычно уже почти упорядочен
+    for (int i = 0; i < poll->items_num; i++) {
+        int j = i;
+        while ((j > 0) && (item_cmp(&poll->items[poll->order[j - 1]], &poll->items[i]) > 0)) {
+            poll->order[j] = poll->order[j - 1];
+            j--;
+        }
+        poll->order[j] = i;
+    }
+
+    poll->blocks_num = 0;
+    reg_poll_block_t * block = NULL;
+    unsigned block_end = 0;
+
+    for (int i = 0; i < poll->items_num; i++) {
+        reg_poll_item_t * item = &poll->items[poll->order[i]];
+        unsigned item_end = item->address + item->count;
+
+        // диапазон поглощается текущим блоком, если пересекается или соседствует с ним
+        // и блок не становится длиннее ограничения ответа
+        if ((block != NULL) && (block->serial == item->serial) && (block->fc == item->fc) &&
+            (block->period_ns == (uint64_t)item->period_ms * NSEC_PER_MSEC) && (item->address <= block_end) &&
+            ((item_end > block_end ? item_end : block_end) - block->address <= (unsigned)block_count_max(item->fc))) {
+            if (item_end > block_end) {
+                block_end = item_end;
+            }
+        } else {
+            block = &poll->blocks[poll->blocks_num++];
+            memset(block, 0, sizeof(*block));
+            block->serial = item->serial;
+            block->fc = item->fc;
+            block->address = item->address;
+            block->period_ns = (uint64_t)item->period_ms * NSEC_PER_MSEC;
+            block->deadline_ns = now_ns;
+            block->first = i;
+            block_end = item_end;
+        }
+        block->count = block_end - block->address;
+        block->items_num++;
+        item->block = block - poll->blocks;
+    }
+    return poll->blocks_num;
+}
+
+static reg_poll_block_t * earliest_block(const reg_poll_t * poll)
+{
+    const reg_poll_block_t * earliest = NULL;
+    for (int i = 0; i < poll->blocks_num; i++) {
+        if ((earliest == NULL) || (poll->blocks[i].deadline_ns < earliest->deadline_ns)) {
+            earliest = &poll->blocks[i];
+        }
+    }
+    return (reg_poll_block_t *)earliest;
+}
+
+uint64_t reg_poll_next_deadline(const reg_poll_t * poll)
+{
+    const reg_poll_block_t * block = earliest_block(poll);
+    return block ? block->deadline_ns : BUS_DEADLINE_NONE;
+}
+
+int reg_poll_run(reg_poll_t * poll, wbmbext_ctx_t * ctx, uint64_t now_ns, reg_poll_cb_t cb, void * arg)
+{
+    reg_poll_block_t * block = earliest_block(poll);
+    if ((block == NULL) || (block->deadline_ns > now_ns)) {
+        return 0;
+    }
+
+    uint16_t values[WBMBEXT_READ_REGS_MAX * 16];
+    int res = wbmbext_read_regs(ctx, poll->ext_cmd, block->serial, block->fc, block->address, block->count, values);
+    poll->reads++;
+    if (res != WBMBEXT_OK) {
+        poll->errors++;
+    }
+
+    for (int i = block->first; i < block->first + block->items_num; i++) {
+        reg_poll_item_t * item = &poll->items[poll->order[i]];
+        item->result = res;
+        if (res == WBMBEXT_OK) {
+            memcpy(&poll->values[item->values_offset], &values[item->address - block->address],
+                item->count * sizeof(values[0]));
+        }
+        if (cb) {
+            cb(arg, poll->order[i], item, &poll->values[item->values_offset]);
+        }
+    }
+
+    // следующий срок отсчитывается от предыдущего, чтобы период не уплывал;
+    // если опрос отстал больше чем на период, пропущенные сроки не наверстываются
+    block->deadline_ns += block->period_ns;
+    uint64_t done_ns = bus_time_now_ns();
+    if (block->deadline_ns < done_ns) {
+        block->deadline_ns = done_ns + block->period_ns;
+        poll->overruns++;
+    }
+    return 1;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "wbmbext.h"
+
+#define REG_POLL_ITEMS_MAX          1024
+#define REG_POLL_VALUES_MAX         16384   // значений всех элементов опроса
+
+/*
+    Периодический опрос регистров по серийному номеру (0x08)
+
+    Элемент опроса - диапазон регистров одного типа (fc 1..4) устройства с периодом.
+    Обращение по серийному номеру позволяет опрашивать и устройства с одинаковыми modbus id.
+
+    reg_poll_plan объединяет пересекающиеся и соседние диапазоны одного устройства, типа
+    и периода в блоки - по запросу на блок, не длиннее ограничения ответа 0x09
+    (WBMBEXT_READ_REGS_MAX регистров или 16 * WBMBEXT_READ_REGS_MAX бит). Блоки
+    опрашиваются по ближайшему сроку: reg_poll_run читает блок с наименьшим deadline,
+    если срок наступил, и переносит срок на период вперед. Если опрос не успевает
+    (шина перегружена), пропущенные сроки не накапливаются, считается overrun.
+*/
+
+typedef struct {
+    uint32_t serial;
+    uint8_t fc;
+    uint16_t address;
+    uint16_t count;
+    uint32_t period_ms;
+
+    int block;                      // блок, в который попал элемент
+    int values_offset;              // значения элемента в reg_poll_t.values
+    int result;                     // результат последнего чтения блока
+} reg_poll_item_t;
+
+typedef struct {
+    uint32_t serial;
+    uint8_t fc;
+    uint16_t address;
+    uint16_t count;
+    uint64_t period_ns;
+    uint64_t deadline_ns;
+    int first;                      // элементы блока: order[first .. first + items_num - 1]
+    int items_num;
+} reg_poll_block_t;
+
+typedef struct {
+    uint8_t ext_cmd;
+
+    reg_poll_item_t items[REG_POLL_ITEMS_MAX];
+    int items_num;
+    int order[REG_POLL_ITEMS_MAX];  // элементы, отсортированные по устройству, типу, периоду и адресу
+
+    reg_poll_block_t blocks[REG_POLL_ITEMS_MAX];
+    int blocks_num;
+
+    uint16_t values[REG_POLL_VALUES_MAX];
+    int values_num;
+
+    uint32_t reads;
+    uint32_t errors;
+    uint32_t overruns;
+} reg_poll_t;
+
+// вызывается для каждого элемента прочитанного блока, index - индекс из reg_poll_add,
+// values - count значений элемента (при ошибке - значения предыдущего успешного чтения)
+typedef void (*reg_poll_cb_t)(void * arg, int index, const reg_poll_item_t * item, const uint16_t * values);
+
+void reg_poll_init(reg_poll_t * poll, uint8_t ext_cmd);
+
+// возвращает индекс элемента или WBMBEXT_ERR_ARG
+int reg_poll_add(reg_poll_t * poll, uint32_t serial, uint8_t fc, uint16_t address, uint16_t count, uint32_t period_ms);
+
+// разбиение элементов на блоки, все блоки получают срок now_ns; возвращает количество блоков
+int reg_poll_plan(reg_poll_t * poll, uint64_t now_ns);
+
+// срок ближайшего блока или BUS_DEADLINE_NONE, если блоков нет
+uint64_t reg_poll_next_deadline(const reg_poll_t * poll);
+
+// чтение блока с наступившим сроком: 1 - блок прочитан (успешно или нет), 0 - сроки не наступили
+int reg_poll_run(reg_poll_t * poll, wbmbext_ctx_t * ctx, uint64_t now_ns, reg_poll_cb_t cb, void * arg);
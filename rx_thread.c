@@ -0,0 +1,186 @@
+#include <string.h>
+#include <errno.h>
+#include "bus_timing.h"
+#include "rx_thread.h"
+
+#if !defined(_WIN32)
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define RX_RING_MASK                (RX_RING_SIZE - 1)
+#define RX_CHUNKS_MASK              (RX_RING_CHUNKS - 1)
+
+static void wake_reader(rx_thread_t * rx)
+{
+    if (__atomic_exchange_n(&rx->waiting, 0, __ATOMIC_SEQ_CST)) {
+        // канал неблокирующий: если он полон, читатель и так проснется
+        ssize_t res = write(rx->wake[1], "", 1);
+        (void)res;
+    }
+}
+
+static void * rx_thread_main(void * arg)
+{
+    rx_thread_t * rx = arg;
+
+    while (!__atomic_load_n(&rx->stop, __ATOMIC_ACQUIRE)) {
+        uint32_t head = rx->data_head;
+        uint32_t free_len = RX_RING_SIZE - (head - __atomic_load_n(&rx->data_tail, __ATOMIC_ACQUIRE));
+        uint32_t pos = head & RX_RING_MASK;
+        uint32_t len = (free_len < RX_RING_SIZE - pos) ? free_len : RX_RING_SIZE - pos;
+
+        if ((len == 0) || (rx->chunk_head - __atomic_load_n(&rx->chunk_tail, __ATOMIC_ACQUIRE) == RX_RING_CHUNKS)) {
+            bus_sleep_until_ns(bus_time_now_ns() + NSEC_PER_MSEC);
+            continue;
+        }
+
+        // возвращает управление сразу после прихода первых байт
+        int rdlen = sp_blocking_read_next(rx->port, &rx->data[pos], len, RX_THREAD_POLL_MS);
+        if (rdlen < 0) {
+            __atomic_store_n(&rx->error, errno ? errno : EIO, __ATOMIC_SEQ_CST);
+            wake_reader(rx);
+            break;
+        }
+        if (rdlen == 0) {
+            continue;
+        }
+
+        rx_chunk_t * c = &rx->chunks[rx->chunk_head & RX_CHUNKS_MASK];
+        c->timestamp_ns = bus_time_now_ns();
+        c->pos = pos;
+        c->len = rdlen;
+        rx->data_head = head + rdlen;
+        __atomic_store_n(&rx->chunk_head, rx->chunk_head + 1, __ATOMIC_SEQ_CST);
+        wake_reader(rx);
+    }
+    return NULL;
+}
+
+int rx_thread_start(rx_thread_t * rx, struct sp_port * port)
+{
+    memset(rx, 0, sizeof(*rx));
+    rx->port = port;
+
+    if (pipe(rx->wake) != 0) {
+        return -1;
+    }
+    fcntl(rx->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(rx->wake[1], F_SETFL, O_NONBLOCK);
+
+    if (pthread_create(&rx->thread, NULL, rx_thread_main, rx) != 0) {
+        close(rx->wake[0]);
+        close(rx->wake[1]);
+        return -1;
+    }
+    return 0;
+}
+
+void rx_thread_stop(rx_thread_t * rx)
+{
+    __atomic_store_n(&rx->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(rx->thread, NULL);
+    close(rx->wake[0]);
+    close(rx->wake[1]);
+}
+
+static void release_chunk(rx_thread_t * rx, const rx_chunk_t * c)
+{
+    rx->chunk_offset = 0;
+    __atomic_store_n(&rx->data_tail, rx->data_tail + c->len, __ATOMIC_RELEASE);
+    __atomic_store_n(&rx->chunk_tail, rx->chunk_tail + 1, __ATOMIC_RELEASE);
+}
+
+int rx_thread_read(rx_thread_t * rx, uint8_t * buf, int len, uint64_t deadline_ns, uint64_t * timestamp_ns)
+{
+    while (1) {
+        if (rx->chunk_tail != __atomic_load_n(&rx->chunk_head, __ATOMIC_ACQUIRE)) {
+            const rx_chunk_t * c = &rx->chunks[rx->chunk_tail & RX_CHUNKS_MASK];
+            uint32_t n = c->len - rx->chunk_offset;
+            if (n > (uint32_t)len) {
+                n = len;
+            }
+            memcpy(buf, &rx->data[c->pos + rx->chunk_offset], n);
+            *timestamp_ns = c->timestamp_ns;
+            rx->chunk_offset += n;
+            if (rx->chunk_offset == c->len) {
+                release_chunk(rx, c);
+            }
+            return n;
+        }
+
+        int error = __atomic_load_n(&rx->error, __ATOMIC_ACQUIRE);
+        if (error) {
+            errno = error;
+            return -1;
+        }
+
+        int timeout_ms = -1;
+        if (deadline_ns != BUS_DEADLINE_NONE) {
+            uint64_t now = bus_time_now_ns();
+            if (now >= deadline_ns) {
+                return 0;
+            }
+            timeout_ms = (deadline_ns - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+        }
+
+        // ожидание объявляется до повторной проверки: либо читатель увидит новый участок,
+        // либо писатель увидит waiting и разбудит его
+        __atomic_store_n(&rx->waiting, 1, __ATOMIC_SEQ_CST);
+        if ((__atomic_load_n(&rx->chunk_head, __ATOMIC_SEQ_CST) == rx->chunk_tail) &&
+            !__atomic_load_n(&rx->error, __ATOMIC_SEQ_CST)) {
+            struct pollfd pfd = { .fd = rx->wake[0], .events = POLLIN };
+            poll(&pfd, 1, timeout_ms);
+        }
+        __atomic_store_n(&rx->waiting, 0, __ATOMIC_SEQ_CST);
+
+        uint8_t drain[16];
+        while (read(rx->wake[0], drain, sizeof(drain)) > 0) {
+        }
+    }
+}
+
+void rx_thread_discard(rx_thread_t * rx, uint64_t before_ns)
+{
+    uint32_t head = __atomic_load_n(&rx->chunk_head, __ATOMIC_ACQUIRE);
+    while (rx->chunk_tail != head) {
+        const rx_chunk_t * c = &rx->chunks[rx->chunk_tail & RX_CHUNKS_MASK];
+        if (c->timestamp_ns >= before_ns) {
+            break;
+        }
+        release_chunk(rx, c);
+    }
+}
+
+#else // _WIN32
+
+int rx_thread_start(rx_thread_t * rx, struct sp_port * port)
+{
+    (void)rx;
+    (void)port;
+    return -1;
+}
+
+void rx_thread_stop(rx_thread_t * rx)
+{
+    (void)rx;
+}
+
+int rx_thread_read(rx_thread_t * rx, uint8_t * buf, int len, uint64_t deadline_ns, uint64_t * timestamp_ns)
+{
+    (void)rx;
+    (void)buf;
+    (void)len;
+    (void)deadline_ns;
+    (void)timestamp_ns;
+    return -1;
+}
+
+void rx_thread_discard(rx_thread_t * rx, uint64_t before_ns)
+{
+    (void)rx;
+    (void)before_ns;
+}
+
+#endif // _WIN32
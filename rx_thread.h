@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <libserialport.h>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+/*
+    Прием из порта в отдельном потоке
+
+    Поток непрерывно читает порт в кольцевой буфер байт и для каждого прочитанного
+    участка записывает в кольцо участков время приема по CLOCK_MONOTONIC. Поток
+    обмена забирает данные из буфера, поэтому вывод на терминал и разбор ответов
+    не задерживают прием, а время прихода байт не зависит от того, когда до них
+    дошла очередь.
+
+    Один писатель (поток приема) и один читатель (поток обмена), без блокировок:
+
+        участок n лежит в chunks[n % RX_RING_CHUNKS] и занимает len байт data с pos,
+        байты участков идут подряд по кольцу data, участок не переходит через конец data;
+        писатель заполняет участок и публикует chunk_head = n + 1,
+        читатель освобождает место, публикуя chunk_tail и data_tail.
+
+    Читатель, которому нечего читать, ждет в poll на канале пробуждения с таймаутом;
+    писатель пишет в канал, только если читатель объявил ожидание (waiting).
+    Если буфер заполнен, поток приема ждет, и данные копятся в буфере драйвера.
+*/
+
+#define RX_RING_SIZE                65536           // байт, степень двойки
+#define RX_RING_CHUNKS              4096            // участков, степень двойки
+#define RX_THREAD_POLL_MS           20              // период проверки остановки потока
+
+typedef struct {
+    uint64_t timestamp_ns;
+    uint32_t pos;
+    uint32_t len;
+} rx_chunk_t;
+
+typedef struct {
+    uint8_t data[RX_RING_SIZE];
+    rx_chunk_t chunks[RX_RING_CHUNKS];
+
+    // меняет поток приема
+    uint32_t chunk_head;
+    uint32_t data_head;
+    int error;                      // errno ошибки чтения, поток приема после нее завершается
+
+    // меняет поток обмена
+    uint32_t chunk_tail;
+    uint32_t data_tail;
+    uint32_t chunk_offset;          // прочитано из текущего участка
+    int waiting;
+    int stop;
+
+    struct sp_port * port;
+    int wake[2];                    // канал пробуждения читателя
+#if !defined(_WIN32)
+    pthread_t thread;
+#endif
+} rx_thread_t;
+
+// 0 или -1, если поток не запущен (в windows не поддерживается) - тогда порт читается напрямую
+int rx_thread_start(rx_thread_t * rx, struct sp_port * port);
+
+void rx_thread_stop(rx_thread_t * rx);
+
+/*
+    Чтение не больше len байт из одного участка, не дольше чем до deadline_ns
+    (BUS_DEADLINE_NONE - без ограничения). В timestamp_ns - время приема участка.
+    Возвращает количество байт, 0 если время истекло, -1 при ошибке порта (errno).
+*/
+int rx_thread_read(rx_thread_t * rx, uint8_t * buf, int len, uint64_t deadline_ns, uint64_t * timestamp_ns);
+
+// отбрасывание участков, принятых раньше before_ns
+void rx_thread_discard(rx_thread_t * rx, uint64_t before_ns);
@@ -4,92 +4,92 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
-#include <libserialport.h>
 #include <limits.h>
 #include <getopt.h>
 #include <time.h>
-#include "modbus_crc.h"
+#include <signal.h>
+#include "bus_workers.h"
+#include "inventory.h"
+#include "event_config.h"
+#include "poll_config.h"
+#include "event_ring.h"
+#include "server.h"
+#include "bus_analyzer.h"
+#include "timing_profile.h"
+#include "port_setup.h"
+#include "wbmbext.h"
 
 #define EXIT_INVALIDARGUMENT        2
 
-#define BUFFER_SIZE                 512
-#define DEVICES_MAX                 100
-
-#define READ_LEN                    16
-#define RESPONCE_MIN_LEN            4
-
-#define SPECIAL_ADDRESS             0xFD
-#define SPECIAL_CMD                 0x46
-#define SPECIAL_CMD_LEGACY          0x60
-
-#define CMD_EXT_SCAN_START          0x01
-#define CMD_EXT_SCAN_NEXT           0x02
-#define CMD_EXT_SCAN_RESP           0x03
-#define CMD_EXT_SCAN_END            0x04
-#define CMD_EXT_EVENTS_REQ          0x10
-#define CMD_EXT_EVENTS_RESP         0x11
-#define CMD_EXT_EVENTS_END          0x12
-#define CMD_EXT_EVENTS_CTRL         0x18
-
-
-#define CMD_EXT_STD_PDU_REQ         0x08
-#define CMD_EXT_STD_PDU_RESP        0x09
-
-#define HOLDREG_WB_SLAVE_ID         128
-
-
-#define PAYLOAD_LEN_FIXED           0
-#define PAYLOAD_EXT_OFFSET          7
-
 int debug = 0;
 
-struct sp_port *port = NULL;
-enum sp_return result;
-struct timespec byte_send_time;
-uint8_t rx_buf[BUFFER_SIZE];
-uint8_t tx_buf[BUFFER_SIZE];
-
-#if defined(_WIN32)
-#include <windows.h>
-
-void delay_send(int len)
-{
-    ULONGLONG StartTime = GetTickCount64();
-    int32_t byte_timeout_ms = len * byte_send_time.tv_nsec / 1000000;
+/*
+    Шина, которую обслуживает поток (при нескольких шинах - по потоку на шину)
 
-    do { }
-    while (GetTickCount64() - StartTime <= byte_timeout_ms);
-}
-#else // _WIN32
-void delay_send(int len)
+    Все состояние работы с портом - в этой структуре, вывод шины идет в out:
+    при нескольких шинах строки помечаются именем порта.
+*/
+typedef struct {
+    const bus_desc_t * desc;
+    FILE * out;
+    char * device_path;             // путь к порту без символьных ссылок
+    wbmbext_ctx_t ctx;
+    bus_capture_t capture;
+    int capture_active;
+
+    // события вместо печати пишутся в кольцевой буфер в разделяемой памяти (-O)
+    event_ring_t event_sink;
+    int event_sink_active;
+
+    // настройки драйвера порта (-k) возвращаются при завершении
+    port_setup_report_t port_setup_report;
+    int port_setup_active;
+
+    sig_atomic_t stats_dumped;      // номер последнего выведенного запроса статистики
+} bus_t;
+
+// статистика задержек транзакций
+int stats_at_exit = 0;
+txn_stats_format_t stats_format = TXN_STATS_TEXT;
+static volatile sig_atomic_t stats_dump_request = 0;    // счетчик SIGUSR1, статистику выводит каждая шина
+
+#ifdef SIGUSR1
+static void stats_signal_handler(int sig)
 {
-    for (int i = 0; i < len; i++) {
-        nanosleep(&byte_send_time, NULL);
-    }
+    (void)sig;
+    stats_dump_request++;
 }
 #endif
 
-void delay_frame(void)
+// задержки транзакций и счетчики ошибок приема
+static void stats_print(bus_t * bus)
 {
-    // 3,5 байта, для надежности 5
-    delay_send(5);
-}
+    const wbmbext_counters_t * c = &bus->ctx.counters;
 
-static inline void u16_to_le_buf8(uint8_t * buf, uint16_t value)
-{
-    buf[0] = (value >> 0) & 0xFF;
-    buf[1] = (value >> 8) & 0xFF;
+    txn_stats_print(&bus->ctx.stats, bus->out, stats_format);
+    if (stats_format == TXN_STATS_JSON) {
+        fprintf(bus->out, "{\"errors\":{\"crc\":%u,\"frame\":%u,\"timeout\":%u,\"retries\":%u,\"scan_restarts\":%u,\"resyncs\":%u}}\n",
+            c->crc_errors, c->frame_errors, c->timeouts, c->retries, c->scan_restarts, c->resyncs);
+    } else {
+        fprintf(bus->out, "Errors: crc %u, frame %u, timeout %u, retries %u, scan restarts %u, resyncs %u\n",
+            c->crc_errors, c->frame_errors, c->timeouts, c->retries, c->scan_restarts, c->resyncs);
+    }
+    fflush(bus->out);
 }
 
-static inline void u16_to_be_buf8(uint8_t * buf, uint16_t value)
+// вывод статистики по SIGUSR1 из безопасного места, а не из обработчика сигнала
+static void stats_dump_pending(bus_t * bus)
 {
-    buf[0] = (value >> 8) & 0xFF;
-    buf[1] = (value >> 0) & 0xFF;
+    sig_atomic_t request = stats_dump_request;
+    if (bus->stats_dumped != request) {
+        bus->stats_dumped = request;
+        stats_print(bus);
+    }
 }
 
-static inline uint16_t u16_from_le_buf8(const uint8_t * buf)
+static void server_idle(void * arg)
 {
-    return (buf[0] << 0) + (buf[1] << 8);
+    stats_dump_pending(arg);
 }
 
 static inline uint16_t u16_from_be_buf8(const uint8_t * buf)
@@ -97,568 +97,1061 @@ static inline uint16_t u16_from_be_buf8(const uint8_t * buf)
     return (buf[0] << 8) + (buf[1] << 0);
 }
 
-static inline void u32_to_be_buf8(uint8_t * buf, uint32_t value)
+// ошибки библиотеки печатаются всегда, отладочный вывод - только с -D
+static void log_to_out(void * arg, wbmbext_log_level_t level, const char * msg)
 {
-    buf[0] = (value >> 24) & 0xFF;
-    buf[1] = (value >> 16) & 0xFF;
-    buf[2] = (value >> 8) & 0xFF;
-    buf[3] = (value >> 0) & 0xFF;
+    bus_t * bus = arg;
+    (void)level;
+    fprintf(bus->out, "%s\n", msg);
 }
 
-static inline uint32_t u32_from_be_buf8(const uint8_t * buf)
+int configure_tty(bus_t * bus, int baud, char parity, uint64_t timing_margin_ns)
 {
-    return (buf[0] << 24) + (buf[1] << 16) + (buf[2] << 8) + (buf[3] << 0);
+    if (wbmbext_baud_supported(baud)) {
+        fprintf(bus->out, "Using baud %d\n", baud);
+    } else {
+        fprintf(bus->out, "Baudrate %d is not supported!\n", baud);
+        return -1;
+    };
+
+    if (wbmbext_parity_supported(parity)) {
+        if (debug) {
+            fprintf(bus->out, "Using parity %c\n", parity);
+        }
+    } else {
+        fprintf(bus->out, "Parity %c is not supported!\n", parity);
+        return -1;
+    }
+
+    return wbmbext_configure(&bus->ctx, baud, parity, timing_margin_ns) == WBMBEXT_OK ? 0 : -1;
 }
 
-void print_hb(char * msg, uint8_t * b, int len)
+#define DEV_INFO_MASK_DEFAULT       (1 << DEV_INFO_MODEL)
+
+// разбор списка полей вида model,fw,signature,bootloader или none
+int parse_dev_info_mask(const char * arg, unsigned * mask)
 {
-    printf("%s : ", msg);
-    for (int i = 0; i < len; i++) {
-        printf(" %02X", b[i]);
+    *mask = 0;
+    if (strcmp(arg, "none") == 0) {
+        return 0;
+    }
+
+    while (*arg) {
+        size_t len = strcspn(arg, ",");
+        int found = 0;
+        for (int i = 0; i < DEV_INFO_FIELDS_NUM; i++) {
+            if ((strlen(wbmbext_dev_info_fields[i].name) == len) && (strncmp(arg, wbmbext_dev_info_fields[i].name, len) == 0)) {
+                *mask |= 1 << i;
+                found = 1;
+            }
+        }
+        if (!found) {
+            return -1;
+        }
+        arg += len;
+        if (*arg == ',') {
+            arg++;
+        }
     }
-    printf("\r\n");
+    return 0;
 }
 
-void send_cmd_in_tx_buf(uint8_t crc_offset)
+void print_dev_info(bus_t * bus, const dev_info_t * dev_info, int num, unsigned info_mask)
 {
-    int len  = crc_offset + 2;
-    u16_to_le_buf8(&tx_buf[crc_offset], modbus_crc(tx_buf, crc_offset));
-    if (debug) {
-        print_hb("    ->", tx_buf, len);
-    }
-    int wlen = sp_nonblocking_write(port, tx_buf, len);
-    if (wlen != (crc_offset + 2)) {
-        printf("Error from write: %d, %d\n", wlen, errno);
+    fprintf(bus->out, "Found device (%2d) with serial %12lld [%08X]  modbus id: %3d", num, (uint64_t)dev_info->serial, dev_info->serial, dev_info->id);
+
+    for (int i = 0; i < DEV_INFO_FIELDS_NUM; i++) {
+        if (info_mask & (1 << i)) {
+            fprintf(bus->out, "  %s: %-*s", wbmbext_dev_info_fields[i].name, wbmbext_dev_info_fields[i].len, dev_info->info[i]);
+        }
     }
-    // ожидание фактического завершения асинхронной отправки
-    delay_send(len);
 }
 
-typedef struct {
-    uint8_t cmd;
-    uint8_t payload_len_index;
-    uint8_t frame_len;
-} cmd_len_desc_t;
+// выводит повторы modbus id устройства n с устройствами перед ним, возвращает количество повторов
+static int print_id_repeats(bus_t * bus, const dev_info_t * devices, int n)
+{
+    int repeats = 0;
+    for (int i = 0; i < n; i++) {
+        if (devices[i].id == devices[n].id) {
+            fprintf(bus->out, "! MODBUS ID REPEAT %3d: serial %12u [%08X] and %12u [%08X]\r\n", devices[n].id,
+                devices[i].serial, devices[i].serial, devices[n].serial, devices[n].serial);
+            repeats++;
+        }
+    }
+    return repeats;
+}
 
 /*
-    Описание возможных команд которые отвечают устройства
+    Сравнение результата сканирования с сохраненным списком устройств
 
-    cmd:                    команда расширенная - то что лежит в buf[2]
-    payload_len_index:      номер байта в буфере от которого зависит длина, если 0 то длина постоянна
-    frame_len:              ожидаемая длина команды включая CRC
+    Информация об устройстве читается заново, только если устройство новое, сменило адрес
+    или в списке нет нужных полей. Выводятся только изменения:
 
-    Пример:
-
-        ответ события отсутствуют
-            FD 46 12 52 5D
+        +   новое устройство
+        -   устройство пропало (только если сканирование завершилось командой 0x04)
+        ~   устройство сменило modbus id
+        !   modbus id повторяется
+*/
+void scan_diff(bus_t * bus, uint8_t ext_cmd, unsigned info_mask, const char * inventory_path, dev_info_t * devices, int dn, int complete)
+{
+    inventory_t inv;
+    inventory_t new_inv;
+    int changes = 0;
+    int info_requests = 0;
+    time_t now = time(NULL);
 
-            cmd = 0x12
-            payload_len_index = PAYLOAD_LEN_FIXED (0)
-            frame_len = 5
+    if (inventory_load(inventory_path, &inv, bus->out) != 0) {
+        return;
+    }
 
-        ответ содержащий события
+    new_inv.num = 0;
+    for (int n = 0; n < dn; n++) {
+        dev_info_t * dev = &devices[n];
+        dev_info_t * known = inventory_find(&inv, dev->serial);
 
-                           ,-- поле переменной длины 3 байта
-                        ___|____
-            0A 46 18 03 05 05 00 XX XX
-                      |          -----
-                      |           CRC
-                      `-- длина (3)
+        if (known && (known->id == dev->id) && ((known->info_mask & info_mask) == info_mask)) {
+            memcpy(dev->info, known->info, sizeof(dev->info));
+            dev->info_mask = known->info_mask;
+        } else if (info_mask) {
+            info_requests += wbmbext_read_dev_info(&bus->ctx, ext_cmd, dev, info_mask);
+        }
 
-            cmd = 0x18
-            payload_len_index = 3
-            frame_len = 6 (включая CRC без учета данных переменной длины
+        if (known == NULL) {
+            fprintf(bus->out, "+ ");
+            print_dev_info(bus, dev, n + 1, info_mask);
+            fprintf(bus->out, "\r\n");
+            changes++;
+        } else if (known->id != dev->id) {
+            fprintf(bus->out, "~ ");
+            print_dev_info(bus, dev, n + 1, info_mask);
+            fprintf(bus->out, "  (was modbus id: %d)\r\n", known->id);
+            changes++;
+        }
 
-*/
+        changes += print_id_repeats(bus, devices, n);
 
-static const cmd_len_desc_t ext_cmd_desc[] = {
-    { .cmd = CMD_EXT_SCAN_RESP, .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 10 },      // Функция ответа на сканирование
-    { .cmd = CMD_EXT_SCAN_END, .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 5 },        // Функция конца сканирования
-    { .cmd = CMD_EXT_EVENTS_RESP, .payload_len_index = 5, .frame_len = 8 },                     // Функция ответа на запрос событий
-    { .cmd = CMD_EXT_EVENTS_END, .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 5 },      // Функция отсутствия событий
-    { .cmd = CMD_EXT_EVENTS_CTRL, .payload_len_index = 3, .frame_len = 6 },                     // Функция ответа на конфигурирование событий
-};
-
-// стандартные функции для отдельной проверки внутри команды 0x09 (обрабатываются специально)
-static const cmd_len_desc_t std_cmd_desc[] = {
-    { .cmd = 0x01, .payload_len_index = 2, .frame_len = 5 },
-    { .cmd = 0x02, .payload_len_index = 2, .frame_len = 5 },
-    { .cmd = 0x03, .payload_len_index = 2, .frame_len = 5 },
-    { .cmd = 0x04, .payload_len_index = 2, .frame_len = 5 },
-
-    { .cmd = 0x05, .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 8 },
-    { .cmd = 0x06, .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 8 },
-    { .cmd = 0x0F, .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 8 },
-    { .cmd = 0x10, .payload_len_index = PAYLOAD_LEN_FIXED, .frame_len = 8 },
-};
-
-// находит структуру описывающую команду
-const cmd_len_desc_t * get_cmd_len_desc(uint8_t cmd, int is_ext)
-{
-    const cmd_len_desc_t * desc;
-    int desc_num;
-
-    if (is_ext) {
-        desc = ext_cmd_desc;
-        desc_num = sizeof(ext_cmd_desc) / sizeof(ext_cmd_desc[0]);
-    } else {
-        desc = std_cmd_desc;
-        desc_num = sizeof(std_cmd_desc) / sizeof(std_cmd_desc[0]);
+        dev->last_seen = now;
+        new_inv.devices[new_inv.num++] = *dev;
     }
 
-    for (int i = 0; i < desc_num; i++) {
-        if (desc[i].cmd == cmd) {
-            return &desc[i];
+    // при неполном сканировании не найденные устройства могли просто не ответить - оставляем их в списке
+    for (int n = 0; n < inv.num; n++) {
+        dev_info_t * dev = &inv.devices[n];
+        int found = 0;
+        for (int i = 0; i < dn; i++) {
+            if (devices[i].serial == dev->serial) {
+                found = 1;
+                break;
+            }
+        }
+        if (found) {
+            continue;
+        }
+        if (complete) {
+            fprintf(bus->out, "- device with serial %12u [%08X]  modbus id: %3d\r\n", dev->serial, dev->serial, dev->id);
+            changes++;
+        } else if (new_inv.num < DEVICES_MAX) {
+            new_inv.devices[new_inv.num++] = *dev;
         }
     }
-    return NULL;
-}
 
-int check_cmd_in_rx_buffer(uint8_t * buf, int available_len)
-{
-    // вся утилита работает только с расширенными ответами
-    if ((buf[1] != SPECIAL_CMD) && (buf[1] != SPECIAL_CMD_LEGACY)) {
-        return 0;
+    if (changes == 0) {
+        fprintf(bus->out, "No changes\r\n");
     }
-
-    if (available_len < 2) {
-        return 0;
+    if (debug) {
+        fprintf(bus->out, "    device info read with %d requests\n", info_requests);
     }
 
-    uint8_t cmd = buf[2];
-    int is_ext = 1;
-    int additional_len = 0;
+    inventory_save(inventory_path, &new_inv, bus->out);
+}
+
+/*
+    Сканирование в два прохода: сначала с максимальной скоростью арбитража собираются
+    серийные номера и адреса всех устройств, затем (если выбраны поля info_mask)
+    читается информация об устройствах.
 
-    int len = 0;
+    Если задан inventory_path, результат сравнивается с сохраненным списком устройств
+    и выводятся только изменения (см. scan_diff).
 
-    if (cmd == CMD_EXT_STD_PDU_RESP) {
-        // Функция ответа на стандартную команду обрабатывается отдельно
-        if (available_len < PAYLOAD_EXT_OFFSET) {
-            return 0;
-        }
+    возвращает количество найденных устройств
+*/
+int tool_scan(bus_t * bus, uint8_t ext_cmd, unsigned info_mask, const char * inventory_path)
+{
+    dev_info_t devices[DEVICES_MAX];
 
-        // команда длиннее на 6 байт. так как PDU начинается с 7го байта, но не имеет байта с адресом устройства как стандартный пакет
-        additional_len = 6;
-        is_ext = 0;
-        cmd = buf[PAYLOAD_EXT_OFFSET];
-    }
+    int end_complete = 0;       // получен ответ об окончании сканирования
+    int dn = wbmbext_scan(&bus->ctx, ext_cmd, devices, DEVICES_MAX, &end_complete);
 
-    const cmd_len_desc_t * desc = get_cmd_len_desc(cmd, is_ext);
+    const char * end_msg = "End SCAN";
+    if (!end_complete) {
+        end_msg = dn ? "No responce, end SCAN" : "No devices found";
+    }
 
-    if (desc == NULL) {
-        return 0;
+    if (inventory_path) {
+        scan_diff(bus, ext_cmd, info_mask, inventory_path, devices, dn, end_complete);
+        fprintf(bus->out, "%s\r\n", end_msg);
+        return dn;
     }
 
-    if (desc->payload_len_index) {
+    int info_requests = 0;
+    for (int n = 0; n < dn; n++) {
+        if (info_mask) {
+            info_requests += wbmbext_read_dev_info(&bus->ctx, ext_cmd, &devices[n], info_mask);
+        }
+
+        print_dev_info(bus, &devices[n], n + 1, info_mask);
 
-        if (available_len < (additional_len + desc->payload_len_index)) {
-            return 0;
+        int rpt = 0;
+        for (int i = 0; i < n; i++) {
+            if (devices[i].id == devices[n].id) {
+                rpt = 1;
+            }
+        }
+        if (rpt) {
+            fprintf(bus->out, "    [MODBUS ID REPEAT]");
         }
 
-        len = buf[additional_len + desc->payload_len_index];
+        fprintf(bus->out, "\r\n");
     }
 
-    len += desc->frame_len;
-    len += additional_len;
+    if (debug && info_requests) {
+        fprintf(bus->out, "    device info read with %d requests\n", info_requests);
+    }
 
-    return len;
+    fprintf(bus->out, "%s\r\n", end_msg);
+    return dn;
 }
 
-
-int read_responce(uint8_t ** ptr)
+/*
+    Автоопределение настроек порта
+
+    Для каждой пары скорость/четность порт перенастраивается без вывода и отправляется
+    команда начала сканирования 0x01. Если ответа нет за расчетный таймаут протокола -
+    устройств с такими настройками нет и перебор сразу переходит к следующей паре.
+    Сначала перебираются наиболее распространенные настройки. Полное сканирование
+    с чтением информации об устройствах выполняется после перебора и только для
+    ответивших групп.
+*/
+int tool_autodetect(bus_t * bus, uint8_t ext_cmd, unsigned info_mask, uint64_t timing_margin_ns)
 {
-    uint8_t * rb = rx_buf;
+    static const int baud_order[] = { 9600, 115200, 19200, 57600, 38400, 4800, 2400, 1200, 230400, 460800, 921600 };
+    static const char parity_order[] = { 'n', 'e', 'o' };
+    dev_info_t devices[DEVICES_MAX];
 
-    while (1) {
-        int rdlen = sp_nonblocking_read(port, rb, READ_LEN);
-        if (rdlen > 0) {
-            // print_hb("   <! ", rb, rdlen);
-            rb += rdlen;
-
-            int data_len = rb - rx_buf;
-
-            if (data_len > (BUFFER_SIZE - READ_LEN)) {
-                printf("Error buffer overload\n");
-                return 0;
+    struct {
+        int baud;
+        char parity;
+        int devices;
+    } found[sizeof(baud_order) / sizeof(baud_order[0]) * sizeof(parity_order)];
+    int found_num = 0;
+
+    uint64_t start_ns = bus_time_now_ns();
+
+    for (unsigned p = 0; p < sizeof(parity_order); p++) {
+        for (unsigned b = 0; b < sizeof(baud_order) / sizeof(baud_order[0]); b++) {
+            if (wbmbext_configure(&bus->ctx, baud_order[b], parity_order[p], timing_margin_ns) != WBMBEXT_OK) {
+                continue;
             }
+            // мусор, принятый на прошлых настройках, не должен попасть в разбор ответа
+            wbmbext_flush_input(&bus->ctx);
 
-            if (data_len >= RESPONCE_MIN_LEN) {
-                for (unsigned i = 0; i < data_len - RESPONCE_MIN_LEN + 1; i++) {
-                    uint8_t * resp = &rx_buf[i];
-
-                    int available_len = data_len - i;
-                    int len = check_cmd_in_rx_buffer(resp, available_len);
-                    if (len) {
-                        if (len <= available_len) {
-                            if (debug) {
-                                print_hb("    <-", rx_buf, data_len);
-                            }
-                            if (modbus_crc(resp, len - 2) == u16_from_le_buf8(&resp[len - 2])) {
-                                *ptr = resp;
-                                return len;
-                            } else {
-                                printf("error: wrong crc\n");
-                                return 0;
-                            }
-                        }
-                    }
-                }
+            int end_complete;
+            int dn = wbmbext_scan(&bus->ctx, ext_cmd, devices, DEVICES_MAX, &end_complete);
+            if (debug) {
+                fprintf(bus->out, "Probe baud %d parity %c: %d device(s)\n", baud_order[b], parity_order[p], dn);
             }
+            if (dn) {
+                found[found_num].baud = baud_order[b];
+                found[found_num].parity = parity_order[p];
+                found[found_num].devices = dn;
+                found_num++;
+            }
+        }
+    }
 
-        } else if (rdlen < 0) {
-            printf("Error from read: %d: %s\n", rdlen, strerror(errno));
-        } else {
-            // printf("Timeout from read\n");
+    for (int i = 0; i < found_num; i++) {
+        if (configure_tty(bus, found[i].baud, found[i].parity, timing_margin_ns) != 0) {
+            continue;
+        }
+        wbmbext_flush_input(&bus->ctx);
+        int dn = tool_scan(bus, ext_cmd, info_mask, NULL);
+        // устройство могло не ответить на повторном сканировании, в итоге - наибольшее из двух
+        if (dn > found[i].devices) {
+            found[i].devices = dn;
         }
     }
-    return 0;
-}
 
-void send_special_cmd(uint8_t ext_cmd, uint8_t cmd, uint16_t len)
-{
-    tx_buf[0] = SPECIAL_ADDRESS;
-    tx_buf[1] = ext_cmd;
-    tx_buf[2] = cmd;
-    send_cmd_in_tx_buf(len);
+    fprintf(bus->out, "Autodetect done in %llu ms\r\n", (unsigned long long)((bus_time_now_ns() - start_ns) / NSEC_PER_MSEC));
+    for (int i = 0; i < found_num; i++) {
+        fprintf(bus->out, "    baud %6d parity %c: %d device(s)\r\n", found[i].baud, found[i].parity, found[i].devices);
+    }
+    if (found_num == 0) {
+        fprintf(bus->out, "    no devices found\r\n");
+    }
+    return found_num;
 }
 
-void send_special_read(uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t len)
+void tool_change_id(bus_t * bus, uint8_t ext_cmd, uint32_t sn, int new_id)
 {
-    u32_to_be_buf8(&tx_buf[3], serial);
-    tx_buf[7] = 3;          // read multiple holding registers
-    u16_to_be_buf8(&tx_buf[8], address);
-    u16_to_be_buf8(&tx_buf[10], len);
-    send_special_cmd(ext_cmd, 8, 12);
+    if ((new_id == 0) || (new_id > 247)) {
+        fprintf(bus->out, "\r\n %d bad ID", new_id);
+    } else {
+        fprintf(bus->out, "Change ID for device with serial %12lld [%08X] New ID: %d\n", (uint64_t)sn, sn, new_id);
+        if (wbmbext_change_id(&bus->ctx, ext_cmd, sn, new_id) == WBMBEXT_ERR_TIMEOUT) {
+            fprintf(bus->out, "No responce from device\n");
+        }
+    }
 }
 
-void send_change_id_cmd(uint8_t ext_cmd, uint32_t serial, uint8_t new_id)
-{
-    uint16_t id16 = new_id;
-    u32_to_be_buf8(&tx_buf[3], serial);
-    tx_buf[7] = 6;          // write single holding register
+/*
+    Устранение повторяющихся адресов за один запуск
 
-    // 128 адрес регистра с slave адресом устройства
-    u16_to_be_buf8(&tx_buf[8], HOLDREG_WB_SLAVE_ID);
-    u16_to_be_buf8(&tx_buf[10], id16);
-    send_special_cmd(ext_cmd, 8, 12);
-}
+    Сканирование, расчет адресов без повторов (см. wbmbext_plan_ids), запись регистра 128
+    по серийному номеру каждому устройству с повтором, проверка записи чтением регистра
+    и повторное сканирование. Все в одном сеансе, порт не переоткрывается.
 
-void send_cmd_scan_init(uint8_t ext_cmd)
-{
-    if (debug) {
-        printf("    send SCAN INIT");
-    }
-    send_special_cmd(ext_cmd, CMD_EXT_SCAN_START, 3);
-}
+    возвращает 0, если после повторного сканирования повторов нет
+*/
+#define FIX_ID_ATTEMPTS             2
 
-void send_cmd_scan_next(uint8_t ext_cmd)
+int tool_fix_ids(bus_t * bus, uint8_t ext_cmd, int reserved_min, int reserved_max)
 {
-    if (debug) {
-        printf("    send SCAN NEXT");
+    dev_info_t devices[DEVICES_MAX];
+    uint8_t new_ids[DEVICES_MAX];
+    int complete;
+    uint64_t start_ns = bus_time_now_ns();
+
+    int dn = wbmbext_scan(&bus->ctx, ext_cmd, devices, DEVICES_MAX, &complete);
+    if (dn == 0) {
+        fprintf(bus->out, "No devices found\r\n");
+        return -1;
+    }
+    if (!complete) {
+        fprintf(bus->out, "WARNING: scan ended without responce, some devices may be missing\r\n");
     }
-    send_special_cmd(ext_cmd, CMD_EXT_SCAN_NEXT, 3);
-}
 
-int parse_special_responce_str(uint8_t * frame, char * str, int len)
-{
-    if (frame[0] != SPECIAL_ADDRESS) {
-        printf("error: received frame have not special address\n");
+    int changes = wbmbext_plan_ids(devices, dn, reserved_min, reserved_max, new_ids);
+    if (changes < 0) {
+        fprintf(bus->out, "Not enough free modbus ids for %d devices\r\n", dn);
         return -1;
     }
+    fprintf(bus->out, "Found %d devices, %d modbus id change(s) needed\r\n", dn, changes);
 
-    // вызов check_cmd_in_rx_buffer при приеме уже проверил что команда или 0x60 или 0x46
+    int failed = 0;
+    for (int n = 0; n < dn; n++) {
+        if (new_ids[n] == 0) {
+            continue;
+        }
 
-    if (frame[2] != CMD_EXT_STD_PDU_RESP) {
-        printf("error: received frame have not pdu sub cmd\n");
-        return -3;
-    }
+        fprintf(bus->out, "Change ID for device with serial %12u [%08X]: %3d -> %3d ", devices[n].serial,
+            devices[n].serial, devices[n].id, new_ids[n]);
 
-    for (size_t i = 0; i < len; i++) {
-        str[i] = (char)frame[7 + 2 + 1 + (i * 2)];
-    }
-    return 0;
-}
+        int ok = 0;
+        for (int attempt = 0; (attempt < FIX_ID_ATTEMPTS) && !ok; attempt++) {
+            uint8_t id = 0;
+            wbmbext_change_id(&bus->ctx, ext_cmd, devices[n].serial, new_ids[n]);
+            // ответ на запись мог потеряться - результат проверяем только чтением
+            ok = (wbmbext_read_id(&bus->ctx, ext_cmd, devices[n].serial, &id) == WBMBEXT_OK) && (id == new_ids[n]);
+        }
 
-int check_baud_get_setting(int param)
-{
-    static const int allowedBaudrates[] = { 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
-    int valueIsIn = 0;
-    for (unsigned int i = 0; i < (sizeof(allowedBaudrates) / sizeof(int)); i++){
-        if (param == allowedBaudrates[i]) {
-            valueIsIn = 1;
-            break;
+        if (ok) {
+            fprintf(bus->out, "ok\r\n");
+        } else {
+            fprintf(bus->out, "FAILED\r\n");
+            failed++;
         }
     }
-    return valueIsIn;
+
+    // повторное сканирование: повторов быть не должно
+    int repeats = 0;
+    if (changes) {
+        dn = wbmbext_scan(&bus->ctx, ext_cmd, devices, DEVICES_MAX, &complete);
+    }
+    for (int n = 0; n < dn; n++) {
+        repeats += print_id_repeats(bus, devices, n);
+    }
+
+    fprintf(bus->out, "Rescan: %d devices, %s, done in %llu ms\r\n", dn, repeats ? "modbus id repeats left" : "no modbus id repeats",
+        (unsigned long long)((bus_time_now_ns() - start_ns) / NSEC_PER_MSEC));
+    return (failed || repeats) ? -1 : 0;
 }
 
-int check_parity_get_setting(char parity, enum sp_parity * sp_parity)
+// печать событий из пакета, первые skip_len байт данных (уже полученные события) пропускаются
+// с -O события не печатаются, а пишутся в кольцевой буфер с временем приема пакета
+// возвращает количество напечатанных событий
+int print_events(bus_t * bus, const struct ext_modbus_event_resp * resp, unsigned skip_len)
 {
-    switch (parity) {
-        case 'n':
-        case 'N':
-            *sp_parity = SP_PARITY_NONE;
-            break;
+    unsigned index = 0;
+    int printed = 0;
+    const event_in_buffer_t * e;
+    int res;
+    uint64_t rx_ns = bus->ctx.txn.ts[TXN_TS_FRAME] ? bus->ctx.txn.ts[TXN_TS_FRAME] : bus_time_now_ns();
+
+    while ((res = wbmbext_event_next(resp, &index, &e)) > 0) {
+        if (index <= skip_len) {
+            continue;
+        }
 
-        case 'e':
-        case 'E':
-            *sp_parity = SP_PARITY_EVEN;
-            break;
+        uint16_t event_id = u16_from_be_buf8(e->event_id);
+        if (bus->event_sink_active) {
+            event_ring_write(&bus->event_sink, rx_ns, resp->slave_id, e->type, event_id, e->data, e->len);
+            printed++;
+            continue;
+        }
 
-        case 'o':
-        case 'O':
-            *sp_parity = SP_PARITY_ODD;
-            break;
+        uint64_t val = 0;
+        memcpy(&val, e->data, e->len < sizeof(val) ? e->len : sizeof(val));
 
-        default:
-            return 0;
-            break;
+        fprintf(bus->out, "Event type: %3d   id: %5d [%04X]   payload: %10lld   device %d\n",
+            e->type, event_id, event_id, val, resp->slave_id);
+        printed++;
     }
-    return 1;
+    if (res < 0) {
+        fprintf(bus->out, "event data truncated\n");
+    }
+    return printed;
 }
 
-int configure_tty(int baud, char parity)
+void tool_event(bus_t * bus, uint8_t min_slave, uint8_t max_event_len, uint8_t confirm_slave_id, uint8_t flag)
 {
-    if (check_baud_get_setting(baud)) {
-        printf("Using baud %d\n", baud);
-    } else {
-        printf("Baudrate %d is not supported!\n", baud);
-        return -1;
-    };
+    struct ext_modbus_event_resp * resp;
+    int len = wbmbext_event_request(&bus->ctx, min_slave, max_event_len, confirm_slave_id, flag, &resp);
 
-    result = sp_set_baudrate(port, baud);
-    if (result != SP_OK) {
-        printf("Error from sp_set_baudrate: %s\n", sp_last_error_message());
-        return -1;
+    if (len == WBMBEXT_ERR_TIMEOUT) {
+        if (debug) {
+            fprintf(bus->out, "NO RESPONCE\n");
+        }
+        return;
+    }
+    if (len < 0) {
+        return;
     }
 
-    enum sp_parity sp_parity;
-    if (check_parity_get_setting(parity, &sp_parity)) {
+    if (resp->sub_cmd == CMD_EXT_EVENTS_END) {
+        if (debug) {
+            fprintf(bus->out, "NO EVENTS\n");
+        }
+        return;
+    } else if (resp->sub_cmd == CMD_EXT_EVENTS_RESP) {
         if (debug) {
-            printf("Using parity %c\n", parity);
+            fprintf(bus->out, "    device: %3d - events: %3d   flag: %1d   event data len: %03d   frame len: %03d\n", resp->slave_id, resp->events_num, resp->flag, resp->data_len, len);
         }
+        print_events(bus, resp, 0);
     } else {
-        printf("Parity %c is not supported!\n", parity);
-        return -1;
+        fprintf(bus->out, "event wrong cmd %02X\n", resp->sub_cmd);
     }
 
-    result = sp_set_parity(port, sp_parity);
+    return;
+}
 
-    if (result != SP_OK) {
-        printf("Error from sp_set_parity: %s\n", sp_last_error_message());
-        return -1;
-    }
+static volatile sig_atomic_t stop_request = 0;
 
-    long nsec = 1000000000 / baud;
+static void stop_signal_handler(int sig)
+{
+    (void)sig;
+    stop_request = 1;
+}
 
-    // 12 бит в одном фрейме
-    nsec *=  12;
+/*
+    Непрерывный опрос событий
 
-    byte_send_time.tv_sec = 0;
-    byte_send_time.tv_nsec = nsec;
+    Порт остается открытым, запросы 0x10 идут друг за другом с минимальной паузой.
+    Каждый запрос подтверждает последний корректно принятый пакет 0x11. При ошибке CRC
+    или отсутствии ответа запрос повторяется с тем же подтверждением - устройство
+    повторит неподтвержденный пакет (см. "Подтверждение получения событий").
 
-    return 0;
-}
+    Для каждого устройства хранится флаг и содержимое последнего принятого пакета.
+    Если устройство прислало пакет с тем же флагом, значит оно не получило подтверждение
+    и повторяет события - уже напечатанные события из него пропускаются (wbmbext_event_skip_len).
 
-void tool_scan(uint8_t ext_cmd)
+    Длина пакета и min_slave каждого запроса выбираются планировщиком (wbmbext_event_sched_t):
+    при target_cycle_us предел длины рассчитывается из скорости шины, устройство,
+    выигрывающее арбитраж подряд с непереданными событиями, пропускается сдвигом min_slave.
+*/
+void tool_event_loop(bus_t * bus, uint8_t min_slave, uint8_t max_event_len, uint8_t confirm_slave_id, uint8_t flag,
+    unsigned target_cycle_us)
 {
-    struct {
-        uint32_t serial;
-        uint8_t id;
-    } devices[DEVICES_MAX];
+    wbmbext_event_packet_t * last_packet = malloc(256 * sizeof(last_packet[0]));
+    if (last_packet == NULL) {
+        fprintf(bus->out, "Error allocate event packets\n");
+        return;
+    }
+    wbmbext_event_packets_init(last_packet, 256);
 
-    typedef struct {
-        uint32_t serial;
-        uint8_t id;
-        char model[20];
-        uint32_t fwver;
-    } dev_info_t;
+    signal(SIGINT, stop_signal_handler);
+    signal(SIGTERM, stop_signal_handler);
 
-    int dn = 0;
+    uint64_t cycles = 0;
+    uint64_t events = 0;
+    uint64_t errors = 0;
+    uint64_t timeouts = 0;
+    uint64_t start_ns = bus_time_now_ns();
 
-    int scan_init = 1;
+    wbmbext_event_sched_t sched;
+    wbmbext_event_sched_init(&sched, &bus->ctx, (uint64_t)target_cycle_us * NSEC_PER_USEC, max_event_len, min_slave);
+    if (debug && target_cycle_us) {
+        fprintf(bus->out, "Event data len limit %d for cycle %u us\n", sched.max_event_len, target_cycle_us);
+    }
 
-    while (1) {
-        if (scan_init) {
-            send_cmd_scan_init(ext_cmd);
-            scan_init = 0;
-        } else {
-            delay_frame();
-            send_cmd_scan_next(ext_cmd);
+    while (!stop_request) {
+        stats_dump_pending(bus);
+
+        struct ext_modbus_event_resp * resp = NULL;
+        int len = wbmbext_event_request(&bus->ctx, sched.min_slave, sched.max_event_len, confirm_slave_id, flag, &resp);
+        fflush(bus->out);
+        cycles++;
+
+        uint8_t prev_min_slave = sched.min_slave;
+        wbmbext_event_sched_update(&sched, len, resp);
+        if (debug && (sched.min_slave != prev_min_slave)) {
+            fprintf(bus->out, "    min slave id: %d -> %d\n", prev_min_slave, sched.min_slave);
         }
 
-        uint8_t * r;
-        int len = read_responce(&r);
+        if (len == WBMBEXT_ERR_TIMEOUT) {
+            timeouts++;
+            continue;
+        }
+        if (len < 0) {
+            errors++;
+            continue;
+        }
 
-        if (len == 0) {
+        if (resp->sub_cmd == CMD_EXT_EVENTS_END) {
+            continue;
+        } else if (resp->sub_cmd != CMD_EXT_EVENTS_RESP) {
+            fprintf(bus->out, "event wrong cmd %02X\n", resp->sub_cmd);
+            errors++;
             continue;
         }
 
-        if (r[2] == CMD_EXT_SCAN_END) {
-            printf("End SCAN\r\n");
-            break;
-        } else if (r[2] == CMD_EXT_SCAN_RESP) {
-            if (len != 10) {
-                printf("ERROR: scan responce len %d", len);
-            }
+        if (debug) {
+            fprintf(bus->out, "    device: %3d - events: %3d   flag: %1d   event data len: %03d   frame len: %03d\n", resp->slave_id, resp->events_num, resp->flag, resp->data_len, len);
+        }
 
-            dev_info_t dev_info = {};
+        events += print_events(bus, resp, wbmbext_event_skip_len(&last_packet[resp->slave_id], resp));
+        fflush(bus->out);
 
-            dev_info.serial = u32_from_be_buf8(&r[3]);
-            dev_info.id = r[PAYLOAD_EXT_OFFSET];
+        wbmbext_event_packet_save(&last_packet[resp->slave_id], resp);
 
-            int rpt = 0;
-            for (int i = 0; i < dn; i++) {
-                if (devices[i].id == dev_info.id) {
-                    rpt = 1;
-                }
-            }
-            devices[dn].id = dev_info.id;
-            devices[dn].serial = dev_info.serial;
+        // подтверждение уходит в следующем запросе
+        confirm_slave_id = resp->slave_id;
+        flag = resp->flag;
+    }
+
+    if (debug) {
+        uint64_t elapsed_us = (bus_time_now_ns() - start_ns) / NSEC_PER_USEC;
+        fprintf(bus->out, "Event polling stopped: %llu cycles, %llu events, %llu errors, %llu timeouts, %llu us per cycle, %u rotations\n",
+            (unsigned long long)cycles, (unsigned long long)events, (unsigned long long)errors,
+            (unsigned long long)timeouts, (unsigned long long)(cycles ? elapsed_us / cycles : 0), sched.rotations);
+    }
+    free(last_packet);
+}
 
-            delay_frame();
+void tool_event_ctrl(bus_t * bus, int id, uint8_t type, uint16_t addr, uint8_t val)
+{
+    wbmbext_event_ctrl(&bus->ctx, id, type, addr, val);
+}
 
-            if (debug) {
-                printf("    read DEVICE MODEL\n");
-            }
-            send_special_read(ext_cmd, dev_info.serial, 200, 20);
-            len = read_responce(&r);
-            if (len) {
-                parse_special_responce_str(r, dev_info.model, 20);
+/*
+    Настройка отправки событий всей шины по файлу (см. event_config.h)
+
+    Настройки группируются по устройствам, каждому устройству отправляется столько кадров 0x18,
+    сколько нужно для всех его регистров. Регистры, для которых результат не совпал
+    с запрошенным (устройство не поддерживает событие), выводятся отдельно.
+
+    возвращает 0, если все настройки применены
+*/
+int tool_event_setup(bus_t * bus, const char * path)
+{
+    uint8_t done[WBMBEXT_ID_MAX + 1] = {0};
+    int failed = 0;
+    int total_frames = 0;
+    uint64_t start_ns = bus_time_now_ns();
+
+    // у каждой шины свои настройки: в них записывается результат
+    event_config_t * cfg = malloc(sizeof(*cfg));
+    wbmbext_event_setting_t * settings = malloc(EVENT_CONFIG_MAX * sizeof(settings[0]));
+    if ((cfg == NULL) || (settings == NULL) || (event_config_load(path, cfg, bus->out) != 0)) {
+        free(cfg);
+        free(settings);
+        return -1;
+    }
+
+    for (int i = 0; i < cfg->num; i++) {
+        uint8_t id = cfg->entries[i].id;
+        if (done[id]) {
+            continue;
+        }
+        done[id] = 1;
+
+        int num = 0;
+        for (int j = i; j < cfg->num; j++) {
+            if (cfg->entries[j].id == id) {
+                settings[num++] = cfg->entries[j].setting;
             }
+        }
+
+        int frames = 0;
+        int matched = wbmbext_event_setup(&bus->ctx, id, settings, num, &frames);
+        total_frames += frames;
 
-            printf ("Found device (%2d) with serial %12lld [%08X]  modbus id: %3d  model: %-20s", dn + 1, (uint64_t)dev_info.serial, dev_info.serial, dev_info.id, dev_info.model);
+        if (matched < 0) {
+            fprintf(bus->out, "device %3d: %s\r\n", id, (matched == WBMBEXT_ERR_TIMEOUT) ? "no responce" : "event setup error");
+            failed++;
+            continue;
+        }
 
-            if (rpt) {
-                printf("    [MODBUS ID REPEAT]");
+        fprintf(bus->out, "device %3d: %d registers, %d applied, %d frames\r\n", id, num, matched, frames);
+        for (int k = 0; k < num; k++) {
+            wbmbext_event_setting_t * st = &settings[k];
+            if (st->done && (st->enabled != (st->ctrl != WBMBEXT_EVENT_CTRL_DISABLED))) {
+                fprintf(bus->out, "    type %2d address %5d: %s\r\n", st->type, st->address, st->enabled ? "still enabled" : "not supported");
             }
+        }
+        if (matched != num) {
+            failed++;
+        }
+    }
 
-            dn++;
+    fprintf(bus->out, "Event setup done in %llu ms, %d frames\r\n",
+        (unsigned long long)((bus_time_now_ns() - start_ns) / NSEC_PER_MSEC), total_frames);
+    free(cfg);
+    free(settings);
+    return failed ? -1 : 0;
+}
 
-            printf("\r\n");
-        } else {
-            printf("ERROR: responce type %d", r[2]);
+/*
+    Периодический опрос регистров по файлу (см. poll_config.h)
+
+    Значения элемента печатаются при первом чтении и при каждом изменении,
+    ошибка чтения - один раз, пока она не сменится другим результатом.
+*/
+typedef struct {
+    FILE * out;
+    uint64_t start_ns;
+    uint16_t printed[REG_POLL_VALUES_MAX];
+    int8_t printed_result[REG_POLL_ITEMS_MAX];      // 1 - значения еще не печатались
+} reg_poll_print_t;
+
+static void print_polled(void * arg, int index, const reg_poll_item_t * item, const uint16_t * values)
+{
+    reg_poll_print_t * p = arg;
+    uint16_t * printed = &p->printed[item->values_offset];
+
+    if (item->result != WBMBEXT_OK) {
+        if (p->printed_result[index] != item->result) {
+            fprintf(p->out, "[%8llu ms] sn %10u %-8s %5d: %s\r\n",
+                (unsigned long long)((bus_time_now_ns() - p->start_ns) / NSEC_PER_MSEC), item->serial,
+                poll_config_type_name(item->fc), item->address,
+                (item->result == WBMBEXT_ERR_TIMEOUT) ? "no responce" : "read error");
+            p->printed_result[index] = item->result;
         }
+        return;
     }
+
+    if ((p->printed_result[index] == WBMBEXT_OK) && (memcmp(printed, values, item->count * sizeof(values[0])) == 0)) {
+        return;
+    }
+    p->printed_result[index] = WBMBEXT_OK;
+    memcpy(printed, values, item->count * sizeof(values[0]));
+
+    fprintf(p->out, "[%8llu ms] sn %10u %-8s %5d:", (unsigned long long)((bus_time_now_ns() - p->start_ns) / NSEC_PER_MSEC),
+        item->serial, poll_config_type_name(item->fc), item->address);
+    for (int i = 0; i < item->count; i++) {
+        fprintf(p->out, " %u", values[i]);
+    }
+    fprintf(p->out, "\r\n");
 }
 
-void tool_change_id(uint8_t ext_cmd, uint32_t sn, int new_id)
+int tool_reg_poll(bus_t * bus, uint8_t ext_cmd, const char * path)
 {
-    if ((new_id == 0) || (new_id > 247)) {
-        printf("\r\n %d bad ID", new_id);
-    } else {
-        printf("Change ID for device with serial %12lld [%08X] New ID: %d\n", (uint64_t)sn, sn, new_id);
-        send_change_id_cmd(ext_cmd, sn, new_id);
-        uint8_t * ptr;
-        read_responce(&ptr);
-    }
-}
-
-void tool_event(uint8_t min_slave, uint8_t max_event_len, uint8_t confirm_slave_id, uint8_t flag)
-{
-    typedef struct {
-        uint8_t ext_brodcast_id;
-        uint8_t ext_cmd;
-        uint8_t ext_sub_cmd;
-        uint8_t arbitration_min_slave_id;
-        uint8_t event_limit;
-        uint8_t confirm_slave_id;
-        uint8_t confirm_flag;
-        uint8_t crc[2];
-    } ext_modbus_event_resp_cmd_t;
-
-    typedef struct {
-        uint8_t len;
-        uint8_t type;
-        uint8_t event_id[2];
-        uint8_t data[];
-    } event_in_buffer_t;
-
-    struct ext_modbus_event_resp {
-        uint8_t slave_id;
-        uint8_t ext_cmd;
-        uint8_t sub_cmd;
-        uint8_t flag;
-        uint8_t events_num;
-        uint8_t data_len;
-        uint8_t data[];
-    };
+    reg_poll_t * poll = malloc(sizeof(*poll));
+    reg_poll_print_t * print = malloc(sizeof(*print));
+    if ((poll == NULL) || (print == NULL)) {
+        fprintf(bus->out, "Error allocate register polling\n");
+        free(poll);
+        free(print);
+        return -1;
+    }
+
+    // при нескольких шинах опрашивается только секция своего порта
+    reg_poll_init(poll, ext_cmd);
+    if (poll_config_load(path, bus->desc->device, poll, bus->out) != 0) {
+        free(poll);
+        free(print);
+        return -1;
+    }
 
-    delay_frame();
+    print->out = bus->out;
+    print->start_ns = bus_time_now_ns();
+    for (int i = 0; i < REG_POLL_ITEMS_MAX; i++) {
+        print->printed_result[i] = 1;
+    }
 
+    int blocks = reg_poll_plan(poll, print->start_ns);
+    fprintf(bus->out, "Polling %d ranges with %d requests\r\n", poll->items_num, blocks);
     if (debug) {
-        printf("    send EVENT GET");
+        for (int i = 0; i < blocks; i++) {
+            const reg_poll_block_t * b = &poll->blocks[i];
+            fprintf(bus->out, "    request %3d: sn %10u %-8s %5d..%-5d every %llu ms, %d ranges\n", i, b->serial,
+                poll_config_type_name(b->fc), b->address, b->address + b->count - 1,
+                (unsigned long long)(b->period_ns / NSEC_PER_MSEC), b->items_num);
+        }
     }
 
-    ext_modbus_event_resp_cmd_t * req_frame = (ext_modbus_event_resp_cmd_t *)tx_buf;
-    req_frame->arbitration_min_slave_id = min_slave;
-    req_frame->event_limit = max_event_len;
-    req_frame->confirm_slave_id = confirm_slave_id;
-    req_frame->confirm_flag = flag;
-    send_special_cmd(SPECIAL_CMD , CMD_EXT_EVENTS_REQ, sizeof(ext_modbus_event_resp_cmd_t) - 2);
+    signal(SIGINT, stop_signal_handler);
+    signal(SIGTERM, stop_signal_handler);
 
-    struct ext_modbus_event_resp * resp;
-    fflush(stdout);
-    int len = read_responce((uint8_t **)&resp);
+    while (!stop_request && blocks) {
+        stats_dump_pending(bus);
 
-    if (resp->sub_cmd == CMD_EXT_EVENTS_END) {
-        if (debug) {
-            printf("NO EVENTS\n");
+        if (reg_poll_run(poll, &bus->ctx, bus_time_now_ns(), print_polled, print)) {
+            fflush(bus->out);
+            continue;
         }
+
+        // ожидание ближайшего срока частями, чтобы не задерживать выход по сигналу
+        uint64_t deadline = reg_poll_next_deadline(poll);
+        uint64_t limit = bus_time_now_ns() + 100 * NSEC_PER_MSEC;
+        bus_sleep_until_ns(deadline < limit ? deadline : limit);
+    }
+
+    if (debug) {
+        uint64_t elapsed_ms = (bus_time_now_ns() - print->start_ns) / NSEC_PER_MSEC;
+        fprintf(bus->out, "Register polling stopped: %u requests, %u errors, %u overruns in %llu ms\n",
+            poll->reads, poll->errors, poll->overruns, (unsigned long long)elapsed_ms);
+    }
+    free(poll);
+    free(print);
+    return 0;
+}
+
+/*
+    Разбор записи обмена без порта (см. bus_capture.h)
+
+    Принятые участки подаются в разборщик кадров так же, как при работе с портом,
+    моменты транзакций берутся из записи, поэтому статистика задержек совпадает с той,
+    что была бы получена при записи. Запрос, за которым следует новый запрос без
+    принятого кадра, считается оставшимся без ответа. Разбор идет без пауз, с -D
+    печатается каждый кадр со временем от начала сессии.
+*/
+typedef struct {
+    uint64_t tx;
+    uint64_t rx_chunks;
+    uint64_t rx_bytes;
+    uint64_t frames;
+    uint64_t crc_errors;
+    uint64_t timeouts;
+    uint64_t scan_devices;
+    uint64_t event_packets;
+    uint64_t events;
+    uint64_t pdu;
+    uint64_t exceptions;
+    uint64_t other;
+} replay_counters_t;
+
+static void replay_decode(replay_counters_t * cnt, uint8_t * frame, int len)
+{
+    if ((len < 5) || ((frame[1] != SPECIAL_CMD) && (frame[1] != SPECIAL_CMD_LEGACY))) {
+        cnt->other++;
         return;
-    } else if (resp->sub_cmd == CMD_EXT_EVENTS_RESP) {
-        if (debug) {
-            printf("    device: %3d - events: %3d   flag: %1d   event data len: %03d   frame len: %03d\n", resp->slave_id, resp->events_num, resp->flag, resp->data_len, len);
+    }
+
+    switch (frame[2]) {
+    case CMD_EXT_SCAN_RESP:
+        cnt->scan_devices++;
+        break;
+
+    case CMD_EXT_EVENTS_RESP: {
+        const struct ext_modbus_event_resp * resp = (const struct ext_modbus_event_resp *)frame;
+        unsigned index = 0;
+        const event_in_buffer_t * e;
+        cnt->event_packets++;
+        while (wbmbext_event_next(resp, &index, &e) > 0) {
+            cnt->events++;
+        }
+        break;
+    }
+
+    case CMD_EXT_STD_PDU_RESP:
+        cnt->pdu++;
+        if ((len > PAYLOAD_EXT_OFFSET) && (frame[PAYLOAD_EXT_OFFSET] & MODBUS_EXCEPTION_FLAG)) {
+            cnt->exceptions++;
         }
-        unsigned event_len = resp->data_len;
-        if (resp->data_len) {
-            unsigned index = 0;
-            while (index < event_len) {
-                event_in_buffer_t * e = (event_in_buffer_t *)&resp->data[index];
-                uint16_t event_id = u16_from_be_buf8(e->event_id);
-                uint64_t val = 0;
-                memcpy(&val, e->data, e->len);
+        break;
 
-                printf("Event type: %3d   id: %5d [%04X]   payload: %10lld   device %d\n",
-                    e->type, event_id, event_id, val, resp->slave_id);
+    case CMD_EXT_SCAN_END:
+    case CMD_EXT_EVENTS_END:
+    case CMD_EXT_EVENTS_CTRL:
+        break;
 
-                index += sizeof(event_in_buffer_t) + e->len;
+    default:
+        cnt->other++;
+        break;
+    }
+}
+
+static void replay_print_frame(uint64_t ts_ns, uint64_t session_ns, const char * dir, const uint8_t * buf, int len)
+{
+    uint64_t us = (ts_ns - session_ns) / NSEC_PER_USEC;
+    printf("[%6llu.%06llu] %s", (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000), dir);
+    for (int i = 0; i < len; i++) {
+        printf(" %02X", buf[i]);
+    }
+    printf("\n");
+}
+
+int tool_replay(const char * path)
+{
+    static bus_capture_reader_t reader;
+    static frame_parser_t parser;
+    static txn_t txn;
+    static txn_stats_t stats;
+    bus_timing_t timing;
+    replay_counters_t cnt;
+    bus_capture_record_t rec;
+    uint64_t session_ns = 0;
+    int sessions = 0;
+    int res;
+
+    if (bus_capture_load(&reader, path) != 0) {
+        printf("Error read capture %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    memset(&cnt, 0, sizeof(cnt));
+    bus_timing_init(&timing, 9600, 11, 0);
+    frame_parser_reset(&parser);
+    uint64_t start_ns = bus_time_now_ns();
+
+    while ((res = bus_capture_next(&reader, &rec)) > 0) {
+        if (rec.kind == BUS_CAPTURE_SESSION) {
+            bus_timing_init(&timing, rec.baud, rec.char_bits, 0);
+            frame_parser_reset(&parser);
+            txn.active = 0;
+            session_ns = rec.timestamp_ns;
+            sessions++;
+            if (debug) {
+                printf("Session: baud %u, %d bits per char\n", rec.baud, rec.char_bits);
             }
+            continue;
         }
 
-    } else {
-        printf("event wrong cmd %02X\n", resp->sub_cmd);
+        if (rec.kind == BUS_CAPTURE_TX) {
+            if (txn.active) {
+                txn_end(&txn, &stats, TXN_RESULT_TIMEOUT);
+                cnt.timeouts++;
+            }
+            if (debug) {
+                replay_print_frame(rec.timestamp_ns, session_ns, "->", rec.data, rec.len);
+            }
+            frame_parser_reset(&parser);
+            txn_begin(&txn, txn_type_of_request(rec.data, rec.len), rec.timestamp_ns);
+            txn_mark(&txn, TXN_TS_TX_DONE, rec.timestamp_ns + rec.len * timing.char_ns);
+            cnt.tx++;
+            continue;
+        }
+
+        cnt.rx_chunks++;
+        cnt.rx_bytes += rec.len;
+        txn_mark(&txn, TXN_TS_RX_FIRST, rec.timestamp_ns);
+        for (uint32_t i = 0; i < rec.len; i++) {
+            if (rec.data[i] != ARBITRATION_BYTE) {
+                txn_mark(&txn, TXN_TS_RX_DATA, rec.timestamp_ns);
+                break;
+            }
+        }
+
+        uint32_t pos = 0;
+        while (pos < rec.len) {
+            int space;
+            uint8_t * wp = frame_parser_write_ptr(&parser, &space);
+            int chunk = (rec.len - pos < (uint32_t)space) ? (int)(rec.len - pos) : space;
+            memcpy(wp, &rec.data[pos], chunk);
+            frame_parser_commit(&parser, chunk);
+            pos += chunk;
+
+            uint8_t * frame;
+            int len;
+            while ((len = frame_parser_next(&parser, &frame)) != FRAME_NEED_MORE) {
+                if (len == FRAME_CRC_ERROR) {
+                    cnt.crc_errors++;
+                    txn_end(&txn, &stats, TXN_RESULT_ERROR);
+                    if (debug) {
+                        printf("    wrong crc\n");
+                    }
+                    continue;
+                }
+                cnt.frames++;
+                txn_mark(&txn, TXN_TS_FRAME, rec.timestamp_ns);
+                txn_end(&txn, &stats, TXN_RESULT_OK);
+                if (debug) {
+                    replay_print_frame(rec.timestamp_ns, session_ns, "<-", frame, len);
+                }
+                replay_decode(&cnt, frame, len);
+            }
+        }
+    }
+    if (txn.active) {
+        txn_end(&txn, &stats, TXN_RESULT_TIMEOUT);
+        cnt.timeouts++;
     }
 
-    return;
+    uint64_t elapsed_ns = bus_time_now_ns() - start_ns;
+    if (res < 0) {
+        printf("Capture truncated at byte %llu\n", (unsigned long long)reader.pos);
+    }
+
+    printf("Replay %s: %d sessions, %llu bytes in %.3f ms, %.1f MB/s\n", path, sessions, (unsigned long long)reader.len,
+        (double)elapsed_ns / NSEC_PER_MSEC, elapsed_ns ? (double)reader.len * NSEC_PER_SEC / elapsed_ns / 1e6 : 0.0);
+    printf("Requests: %llu, no responce: %llu\n", (unsigned long long)cnt.tx, (unsigned long long)cnt.timeouts);
+    printf("Received: %llu chunks, %llu bytes, %llu frames, %llu crc errors\n", (unsigned long long)cnt.rx_chunks,
+        (unsigned long long)cnt.rx_bytes, (unsigned long long)cnt.frames, (unsigned long long)cnt.crc_errors);
+    printf("Decoded: %llu scanned devices, %llu event packets with %llu events, %llu pdu responces (%llu exceptions), %llu other\n",
+        (unsigned long long)cnt.scan_devices, (unsigned long long)cnt.event_packets, (unsigned long long)cnt.events,
+        (unsigned long long)cnt.pdu, (unsigned long long)cnt.exceptions, (unsigned long long)cnt.other);
+    txn_stats_print(&stats, stdout, stats_format);
+
+    bus_capture_unload(&reader);
+    return res < 0 ? -1 : 0;
 }
 
-void tool_event_ctrl(int id, uint8_t type, uint16_t addr, uint8_t val)
+/*
+    Анализ времянок шины и калибровка паузы и таймаута порта (-Y)
+
+    Для каждой паузы перед запросом из analyze_gaps, начиная с минимальной по протоколу,
+    выполняется заданное количество циклов: полное сканирование и несколько запросов
+    событий без подтверждения (события остаются в устройствах). Обмен пишется во временный
+    файл записи и разбирается анализатором (bus_analyzer.h).
+
+    Выбирается наименьшая пауза, при которой ошибок не больше, чем при любой другой:
+    ошибки от помех на линии не зависят от паузы и выбор не сдвигают. Запас таймаута -
+    удвоенное наибольшее по всем измерениям превышение тишины над формулой протокола
+    плюс ANALYZE_MARGIN_RESERVE_US на задержки планировщика, которых за время измерения
+    могло не случиться.
+*/
+#define ANALYZE_EVENTS_PER_CYCLE    8
+#define ANALYZE_MARGIN_RESERVE_US   1000
+
+// паузы в десятых долях символа
+static const unsigned analyze_gaps[] = { 35, 50, 70, 100 };
+
+static uint64_t analyze_gap_ns(const bus_timing_t * t, unsigned g)
 {
-    typedef struct __attribute__((__packed__)) {
-        uint8_t type;
-        uint8_t event_id[2];
-        uint8_t len;
-        uint8_t ctrl;
-    } event_ctrl_t;
+    return (bus_bits_ns(t, analyze_gaps[g] * t->char_bits) + 9) / 10;
+}
 
-    tx_buf[0] = id;
-    tx_buf[1] = SPECIAL_CMD;
-    tx_buf[2] = CMD_EXT_EVENTS_CTRL;
-    tx_buf[3] = sizeof(event_ctrl_t);      // fixed only one reg config
+int tool_analyze(bus_t * bus, uint8_t ext_cmd, int cycles, const char * profile_path, int baud, char parity)
+{
+    bus_analyzer_t analyzer;
+    dev_info_t devices[DEVICES_MAX];
+    bus_capture_reader_t reader;
+    bus_capture_t capture;
+    bus_capture_t * prev_capture = bus->ctx.capture;
+    const bus_timing_t * t = &bus->ctx.timing;
+    const unsigned gaps_num = sizeof(analyze_gaps) / sizeof(analyze_gaps[0]);
+    int gap_errors[sizeof(analyze_gaps) / sizeof(analyze_gaps[0])];
+    uint64_t overrun_ns = 0;
+    uint64_t answered = 0;
+
+    for (unsigned g = 0; g < gaps_num; g++) {
+        FILE * f = tmpfile();
+        if (f == NULL) {
+            fprintf(bus->out, "Error create temporary capture: %s\n", strerror(errno));
+            return -1;
+        }
+        bus_capture_attach(&capture, f);
+        wbmbext_set_capture(&bus->ctx, &capture);
+
+        uint64_t try_gap_ns = analyze_gap_ns(t, g);
+        wbmbext_set_frame_gap(&bus->ctx, try_gap_ns);
+
+        int errors = 0;
+        uint64_t start_ns = bus_time_now_ns();
+        for (int c = 0; c < cycles; c++) {
+            int complete;
+            wbmbext_scan(&bus->ctx, ext_cmd, devices, DEVICES_MAX, &complete);
+            if (!complete) {
+                errors++;
+            }
+            for (int e = 0; e < ANALYZE_EVENTS_PER_CYCLE; e++) {
+                struct ext_modbus_event_resp * resp;
+                if (wbmbext_event_request(&bus->ctx, 0, 0xFF, 0, 0, &resp) < 0) {
+                    errors++;
+                }
+            }
+        }
+        uint64_t cycle_us = (bus_time_now_ns() - start_ns) / NSEC_PER_USEC / cycles;
+        wbmbext_set_capture(&bus->ctx, prev_capture);
 
-    event_ctrl_t * ectrl = (event_ctrl_t *)&tx_buf[4];
+        if (bus_capture_load_file(&reader, f) != 0) {
+            fprintf(bus->out, "Error read temporary capture: %s\n", strerror(errno));
+            bus_capture_close(&capture);
+            return -1;
+        }
+        bus_capture_close(&capture);
 
-    ectrl->type = type;
-    u16_to_be_buf8(ectrl->event_id, addr);
-    ectrl->len = 1;
-    ectrl->ctrl = val;
+        bus_analyzer_init(&analyzer, t);
+        bus_capture_record_t rec;
+        while (bus_capture_next(&reader, &rec) > 0) {
+            bus_analyzer_record(&analyzer, &rec);
+        }
+        bus_analyzer_finish(&analyzer);
+        bus_capture_unload(&reader);
 
-    send_cmd_in_tx_buf(9);
+        fprintf(bus->out, "\nGap %u.%u chars (%llu us): %d cycles, %llu us per cycle, %d errors\n", analyze_gaps[g] / 10, analyze_gaps[g] % 10,
+            (unsigned long long)(try_gap_ns / NSEC_PER_USEC), cycles, (unsigned long long)cycle_us, errors);
+        bus_analyzer_print(&analyzer, bus->out);
 
-    uint8_t * r;
-    int len = read_responce(&r);
-    return;
+        gap_errors[g] = errors;
+        answered += analyzer.requests - analyzer.lost;
+        if (bus_analyzer_overrun_ns(&analyzer) > overrun_ns) {
+            overrun_ns = bus_analyzer_overrun_ns(&analyzer);
+        }
+    }
+    wbmbext_set_frame_gap(&bus->ctx, 0);
+
+    if (answered == 0) {
+        fprintf(bus->out, "\nNo responces, timing profile not calibrated\n");
+        return -1;
+    }
+
+    unsigned best = 0;
+    for (unsigned g = 1; g < gaps_num; g++) {
+        if (gap_errors[g] < gap_errors[best]) {
+            best = g;
+        }
+    }
+    uint64_t gap_ns = analyze_gap_ns(t, best);
+    uint64_t margin_ns = 2 * overrun_ns + ANALYZE_MARGIN_RESERVE_US * NSEC_PER_USEC;
+
+    // в профиле - микросекунды с округлением вверх, запас кратен 100 мкс
+    uint32_t gap_us = (gap_ns + NSEC_PER_USEC - 1) / NSEC_PER_USEC;
+    uint32_t margin_us = (margin_ns + 100 * NSEC_PER_USEC - 1) / (100 * NSEC_PER_USEC) * 100;
+    fprintf(bus->out, "\nCalibrated: gap %u us, response timeout margin %u us\n", gap_us, margin_us);
+
+    if (profile_path) {
+        // профиль общий для всех шин: чтение, замена строки порта и запись - без чужих записей между ними
+        timing_profiles_t profiles;
+        int res = -1;
+        bus_workers_lock();
+        if (timing_profiles_load(profile_path, &profiles, bus->out) == 0) {
+            timing_profile_t * p = timing_profiles_get(&profiles, bus->device_path, baud, parity);
+            if (p == NULL) {
+                fprintf(bus->out, "Error timing profile %s: too many ports\n", profile_path);
+            } else {
+                p->gap_us = gap_us;
+                p->margin_us = margin_us;
+                res = timing_profiles_save(profile_path, &profiles, bus->out);
+            }
+        }
+        bus_workers_unlock();
+        if (res != 0) {
+            return -1;
+        }
+        fprintf(bus->out, "Saved to timing profile %s\n", profile_path);
+    }
+    return 0;
 }
 
 char* get_real_path(const char* path) {
@@ -667,10 +1160,37 @@ char* get_real_path(const char* path) {
     realpath(path, pathbuf);
     return strdup(pathbuf);
 #else
-    return path;
+    return strdup(path);
 #endif
 }
 
+// разбор описания порта вида device[:baud[:parity]]
+int parse_bus_desc(char * arg, bus_desc_t * bus)
+{
+    bus->device = arg;
+    bus->baud = 0;
+    bus->parity = 0;
+
+    char * sep = strchr(arg, ':');
+    if (sep == NULL) {
+        return 0;
+    }
+    *sep++ = 0;
+
+    char * parity_sep = strchr(sep, ':');
+    if (parity_sep != NULL) {
+        *parity_sep++ = 0;
+        if (strlen(parity_sep) != 1) {
+            return -1;
+        }
+        bus->parity = parity_sep[0];
+    }
+    if ((*sep != 0) && (sscanf(sep, "%d", &bus->baud) != 1)) {
+        return -1;
+    }
+    return 0;
+}
+
 void print_help(const char* argv0)
 {
         printf(
@@ -678,30 +1198,317 @@ void print_help(const char* argv0)
             "Usage: %s -d device [-b baud] [-s sn] [-i id] [-D]\n"
             "\n"
             "Options:\n"
-            "    -d device      TTY serial device\n"
+            "    -d device      TTY serial device, may be repeated to work with several buses in parallel,\n"
+            "                   per-device settings can be given as device:baud[:parity]\n"
             "    -b baud        Baudrate, default 9600\n"
             "    -p parity      Parity, can be n|e|o, default n\n"
+            "    -T us          extra response timeout for host/adapter latency, default %d us\n"
+            "    -n num         retries after crc error, wrong responce or timeout, default %d;\n"
+            "                   scan restarts from SCAN INIT, events are requested with the same confirm\n"
+            "    -k opts        linux port setup, restored at exit: low_latency,rs485[=before/after ms],vmin=N,vtime=N\n"
+            "                   prints what the driver accepted\n"
             "    -L             use 0x60 (deprecated) cmd instead of 0x46 in scan\n"
+            "    -A             scan with every supported baud and parity, report settings with devices\n"
+            "    -I fields      device info read after scan: none or list of model,fw,signature,bootloader,\n"
+            "                   default model\n"
+            "    -C file        devices list saved between scans, print only changes against it\n"
+            "    -M format      print transaction latency stats at exit: text|json,\n"
+            "                   stats are also printed on SIGUSR1\n"
+            "    -F             resolve modbus id repeats: assign free ids, verify and rescan\n"
+            "    -R min-max     ids reserved from assignment by -F\n"
             "    -s sn          device sn\n"
             "    -i id          slave id\n"
             "    -D             debug mode\n"
             "    -l len         max len of event data field\n"
             "    -e id          event request with confirm 0 for slave id\n"
             "    -E id          event request with confirm 1 for slave id\n"
+            "    -P             poll events continuously, confirming each received packet\n"
+            "    -W us          target event poll cycle, limits event data len by baudrate (for -P)\n"
+            "    -O name        write events to shared memory ring /dev/shm/name instead of printing\n"
             "    -r reg         event control reg\n"
             "    -t type        event control type\n"
             "    -c ctrl        event control value\n"
+            "    -g file        setup events of all devices from config file\n"
+            "    -Q file        poll registers by device sn periodically from config file,\n"
+            "                   with several ports split into [port] sections\n"
+            "    -S path        server mode: keep the port open and serve requests on unix socket,\n"
+            "                   with several ports on path.port socket of each port\n"
+            "    -w file        append all sent and received bus data to binary capture file\n"
+            "    -x file        replay capture file offline: parse frames, print stats\n"
+            "    -Y cycles      analyze bus timing with scan and event cycles, calibrate frame gap\n"
+            "                   and response timeout margin\n"
+            "    -K file        per-port timing profile: saved by -Y, applied in other modes\n"
             "    -h             show help\n"
             "\n"
             "For scan use:              %s -d device [-b baud] [-D]\n"
+            "For scan several buses:    %s -d device1[:baud[:parity]] -d device2[:baud[:parity]] [-D]\n"
+            "For find port settings:    %s -d device -A [-L] [-D]\n"
             "For scan some old fw use:  %s -d device [-b baud] -L [-D]\n"
             "For set slave id use:      %s -d device [-b baud] -s sn -i id [-D]\n"
+            "For fix repeated ids use:  %s -d device [-b baud] -F [-R min-max] [-D]\n"
             "For setup event use:       %s -d device [-b baud] -i id -r reg -t type -c ctrl\n"
+            "For setup events of bus:   %s -d device [-b baud] -g file\n"
+            "For poll registers use:    %s -d device [-b baud] -Q file [-D]\n"
+            "For server mode use:       %s -d device [-b baud] -S path [-D]\n"
+            "For replay capture use:    %s -x file [-M text|json] [-D]\n"
+            "For calibrate timing use:  %s -d device [-b baud] -Y cycles [-K file] [-D]\n"
+            "For usb adapter latency:   %s -d device [-b baud] -k low_latency -P\n"
             "Event request examples:\n"
             "         %s -d device [-b baud] -e 0               (request + nothing to confirm)\n"
             "         %s -d device [-b baud] -e 4               (request + confirm events from slave 4 flag 0)\n"
             "         %s -d device [-b baud] -E 6               (request + confirm events from slave 6 flag 1)\n"
-            , argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+            "         %s -d device [-b baud] -P                 (poll events until interrupted)\n"
+            "         %s -d device [-b baud] -P -W 20000        (poll events, cycle up to 20 ms)\n"
+            "         %s -d device [-b baud] -P -O wb-events    (poll events to /dev/shm/wb-events)\n"
+            , argv0, BUS_TIMEOUT_MARGIN_DEFAULT_US, WBMBEXT_RETRIES_DEFAULT, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+// при нескольких шинах у каждого порта свой файл: file.ttyRS485-1 для /dev/ttyRS485-1
+static void bus_file_path(char * path, size_t size, const char * base, int bus_num, const char * device)
+{
+    if (bus_num > 1) {
+        char name[PATH_MAX];
+        bus_port_name(name, sizeof(name), device);
+        snprintf(path, size, "%s.%s", base, name);
+    } else {
+        snprintf(path, size, "%s", base);
+    }
+}
+
+// настройки из командной строки, общие для всех шин; после разбора только читаются
+typedef struct {
+    int bus_num;
+    int margin_us;
+    int margin_set;         // -T overrides timing profile
+    int retries;            // repeats after crc, frame errors and timeouts
+    port_setup_t port_setup;                        // low latency and rs485 driver setup, -k
+    int port_setup_set;
+    uint64_t sn;
+    int id;
+    uint8_t ext_cmd;
+
+    // events options
+    int confirm_id;         // events confirm slave id
+    int event_request;      // events request cmd + confirm flag value
+    int event_poll;         // continuous events polling
+    int autodetect;         // scan with all port settings
+    int fix_ids;            // resolve modbus id repeats
+    int reserved_min;       // ids not assigned by fix_ids, empty range by default
+    int reserved_max;
+    unsigned info_mask;     // device info fields read after scan
+    const char * inventory_path;                    // saved devices list to compare scan with
+    int maxlen;             // max len of events field in responce
+    int cycle_us;           // target events poll cycle, 0 - fixed maxlen
+    const char * event_sink_name;                   // shared memory ring for events
+    int ev_r;               // event register address
+    int ev_t;               // event register type
+    int ev_c;               // event ctrl value
+    const char * event_config_path;                 // bulk event setup config
+    const char * poll_config_path;                  // registers polled by sn
+    const char * server_path;                       // unix socket of server mode
+    const char * capture_path;                      // bus capture written while working
+    int analyze_cycles;                             // timing analysis and calibration
+    const char * profile_path;                      // calibrated gap and timeout per port
+} options_t;
+
+// работа с одной шиной от открытия порта до результата, возвращает код завершения
+static int bus_serve(bus_t * bus, const options_t * opt)
+{
+    int baud = bus->desc->baud;
+    char parity = bus->desc->parity;
+    int margin_us = opt->margin_us;
+    uint8_t ext_cmd = opt->ext_cmd;
+
+    wbmbext_set_log(&bus->ctx, log_to_out, bus, debug);
+    for (int t = 0; t < TXN_OTHER; t++) {
+        wbmbext_set_retries(&bus->ctx, t, opt->retries);
+    }
+
+    if (opt->capture_path) {
+        char path[PATH_MAX];
+        bus_file_path(path, sizeof(path), opt->capture_path, opt->bus_num, bus->desc->device);
+        if (bus_capture_open(&bus->capture, path) != 0) {
+            fprintf(bus->out, "Error open capture %s: %s\n", path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        bus->capture_active = 1;
+        wbmbext_set_capture(&bus->ctx, &bus->capture);
+    }
+
+    // путь сокета проверяется до открытия порта
+    int listen_fd = -1;
+    char server_path[PATH_MAX];
+    if (opt->server_path) {
+        bus_file_path(server_path, sizeof(server_path), opt->server_path, opt->bus_num, bus->desc->device);
+        listen_fd = server_listen(server_path, bus->out);
+        if (listen_fd < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf(bus->out, "Serial port: %s\n", bus->desc->device);
+    bus->device_path = get_real_path(bus->desc->device);
+    if (wbmbext_open(&bus->ctx, bus->device_path) != WBMBEXT_OK) {
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            unlink(server_path);
+        }
+        return EXIT_FAILURE;
+    }
+
+    // настройки драйвера не обязательны для обмена: печатаем, что принято, и работаем дальше
+    if (opt->port_setup_set) {
+        int res = port_setup_apply(bus->ctx.port, bus->device_path, &opt->port_setup, &bus->port_setup_report);
+        port_setup_print(&bus->port_setup_report, bus->out);
+        if (res != 0) {
+            fprintf(bus->out, "Port setup is not fully applied, latency may be higher\n");
+        }
+        bus->port_setup_active = 1;
+    }
+
+    if (opt->autodetect) {
+        tool_autodetect(bus, ext_cmd, opt->info_mask, (uint64_t)margin_us * NSEC_PER_USEC);
+        return EXIT_SUCCESS;
+    }
+
+    // калибровка идет с паузами по протоколу, сохраненный профиль при ней не применяется
+    timing_profiles_t profiles;
+    timing_profile_t * profile = NULL;
+    if (opt->profile_path && !opt->analyze_cycles) {
+        if (timing_profiles_load(opt->profile_path, &profiles, bus->out) != 0) {
+            return EXIT_FAILURE;
+        }
+        profile = timing_profiles_find(&profiles, bus->device_path, baud, parity);
+        if (profile && !opt->margin_set) {
+            margin_us = profile->margin_us;
+        }
+    }
+
+    if (configure_tty(bus, baud, parity, (uint64_t)margin_us * NSEC_PER_USEC) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (profile) {
+        uint64_t gap_ns = (uint64_t)profile->gap_us * NSEC_PER_USEC;
+        if (gap_ns < bus_silence_ns(&bus->ctx.timing)) {
+            gap_ns = 0;
+        }
+        wbmbext_set_frame_gap(&bus->ctx, gap_ns);
+        fprintf(bus->out, "Using timing profile: gap %llu us, response timeout margin %d us\n",
+            (unsigned long long)(bus_frame_gap_ns(&bus->ctx.timing) / NSEC_PER_USEC), margin_us);
+    }
+
+    if (opt->analyze_cycles) {
+        return tool_analyze(bus, ext_cmd, opt->analyze_cycles, opt->profile_path, baud, parity) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (opt->event_request || opt->event_poll) {
+        int maxlen = (opt->maxlen > 0xFF) ? 0xFF : opt->maxlen;
+        if (opt->event_sink_name) {
+            // у буфера один писатель, и в записи нет номера шины: на каждую шину свой буфер
+            char name[PATH_MAX];
+            bus_file_path(name, sizeof(name), opt->event_sink_name, opt->bus_num, bus->desc->device);
+            if (event_ring_create(&bus->event_sink, name, EVENT_RING_CAPACITY_DEFAULT) != 0) {
+                fprintf(bus->out, "Error create event ring %s: %s\n", name, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            bus->event_sink_active = 1;
+            fprintf(bus->out, "Events are written to shared memory ring %s, %d records\n", name, EVENT_RING_CAPACITY_DEFAULT);
+        }
+        if (opt->event_poll) {
+            tool_event_loop(bus, opt->id, maxlen, opt->confirm_id, opt->event_request ? opt->event_request - 1 : 0, opt->cycle_us);
+        } else {
+            tool_event(bus, opt->id, maxlen, opt->confirm_id, opt->event_request - 1);
+        }
+        return 0;
+    }
+    if (opt->server_path) {
+        return server_run(&bus->ctx, ext_cmd, listen_fd, server_path, bus->out, server_idle, bus) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (opt->poll_config_path) {
+        return tool_reg_poll(bus, ext_cmd, opt->poll_config_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (opt->event_config_path) {
+        return tool_event_setup(bus, opt->event_config_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (opt->ev_r != -1) {
+        if ((opt->ev_r < 0) || (opt->ev_r > 0xFFFF)) {
+            fprintf(bus->out, "WRONG reg\n");
+            return 1;
+        }
+        if (opt->ev_t != 15 && ((opt->ev_t < 1) || (opt->ev_t > 4))) {
+            // support types for standard regtypes and 15 as system type
+            fprintf(bus->out, "WRONG type\n");
+            return 1;
+        }
+        if ((opt->ev_c < 0) || (opt->ev_c > 2)) {
+            fprintf(bus->out, "WRONG control\n");
+            return 1;
+        }
+        if ((opt->id < 1) || (opt->id > 247)) {
+            fprintf(bus->out, "WRONG id\n");
+            return 1;
+        }
+        tool_event_ctrl(bus, opt->id, opt->ev_t, opt->ev_r, opt->ev_c);
+        return 0;
+    }
+
+    if (opt->fix_ids) {
+        return tool_fix_ids(bus, ext_cmd, opt->reserved_min, opt->reserved_max) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if ((opt->sn != 0) || (opt->id != 0)) {
+        if ((opt->sn != 0) && (opt->id != 0)) {
+            tool_change_id(bus, ext_cmd, opt->sn, opt->id);
+        } else {
+            fprintf(bus->out, "both sn and new id are necessary to change id\n");
+            return EXIT_FAILURE;
+        }
+    } else {
+        // scan function
+        char path[PATH_MAX];
+        if (opt->inventory_path) {
+            bus_file_path(path, sizeof(path), opt->inventory_path, opt->bus_num, bus->desc->device);
+        }
+        tool_scan(bus, ext_cmd, opt->info_mask, opt->inventory_path ? path : NULL);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// обработчик шины для bus_workers_run: у каждой шины свое состояние, освобождаемое по завершении
+static int bus_worker(const bus_desc_t * desc, FILE * out, void * arg)
+{
+    const options_t * opt = arg;
+    bus_t * bus = calloc(1, sizeof(*bus));
+    if (bus == NULL) {
+        fprintf(out, "Error allocate bus state\n");
+        return EXIT_FAILURE;
+    }
+    bus->desc = desc;
+    bus->out = out;
+    bus->stats_dumped = stats_dump_request;
+    wbmbext_init(&bus->ctx);
+
+    int exit_code = bus_serve(bus, opt);
+
+    if (bus->port_setup_active && (port_setup_restore(bus->ctx.port, bus->device_path, &bus->port_setup_report) != 0)) {
+        fprintf(out, "Port setup is not fully restored\n");
+    }
+    if (stats_at_exit) {
+        stats_print(bus);
+    }
+
+    wbmbext_close(&bus->ctx);
+    if (bus->event_sink_active) {
+        event_ring_close(&bus->event_sink);
+    }
+    if (bus->capture_active) {
+        bus_capture_close(&bus->capture);
+    }
+    free(bus->device_path);
+    free(bus);
+    return exit_code;
 }
 
 int main(int argc, char *argv[])
@@ -714,32 +1521,34 @@ int main(int argc, char *argv[])
     int c;
     int baud = 9600;
     char parity = 'n';
-    uint64_t sn = 0;
-    int id = 0;
-    uint8_t ext_cmd = SPECIAL_CMD;
+    const char * replay_path = NULL;                // bus capture replayed offline
+    options_t opt = {
+        .margin_us = BUS_TIMEOUT_MARGIN_DEFAULT_US,
+        .retries = WBMBEXT_RETRIES_DEFAULT,
+        .ext_cmd = SPECIAL_CMD,
+        .reserved_min = 1,
+        .info_mask = DEV_INFO_MASK_DEFAULT,
+        .maxlen = 0xFF,
+        .ev_r = -1,
+        .ev_t = -1,
+        .ev_c = -1,
+    };
 
-    // events options
-    int confirm_id = 0;     // events confirm slave id
-    int event_request = 0;  // events request cmd + confirm flag value
-    int maxlen = 0xFF;      // max len of events field in responce
-    int ev_r = -1;          // event register address
-    int ev_t = -1;          // event register type
-    int ev_c = -1;          // event ctrl value
-
-    while ((c = getopt(argc, argv, "d:b:Ls:i:l:r:t:c:e:p:E:Dh")) != -1) {
+    bus_desc_t buses[BUSES_MAX];
+    int bus_num = 0;
+
+    while ((c = getopt(argc, argv, "d:b:Ls:i:l:r:t:c:e:p:E:T:n:k:PW:O:AI:C:M:FR:g:Q:S:w:x:Y:K:Dh")) != -1) {
         switch(c) {
         case 'd':
-            printf("Serial port: %s\n", optarg);
-            result = sp_get_port_by_name(get_real_path(optarg), &port);
-            if (result != SP_OK) {
-                printf("sp_get_port_by_name() failed!\n");
-                return EXIT_FAILURE;
+            if (bus_num == BUSES_MAX) {
+                printf("Too many serial ports, max %d\n", BUSES_MAX);
+                return EXIT_INVALIDARGUMENT;
             }
-            result = sp_open(port, SP_MODE_READ_WRITE);
-            if (result != SP_OK) {
-                printf("sp_open() failed\n");
-                return EXIT_FAILURE;
+            if (parse_bus_desc(optarg, &buses[bus_num]) != 0) {
+                printf("Wrong serial port description: %s\n", optarg);
+                return EXIT_INVALIDARGUMENT;
             }
+            bus_num++;
             break;
 
         case 'D':
@@ -754,16 +1563,77 @@ int main(int argc, char *argv[])
             sscanf(optarg, "%c", &parity);
             break;
 
+        case 'T':
+            sscanf(optarg, "%d", &opt.margin_us);
+            if (opt.margin_us < 0) {
+                opt.margin_us = 0;
+            }
+            opt.margin_set = 1;
+            break;
+
+        case 'n':
+            if ((sscanf(optarg, "%d", &opt.retries) != 1) || (opt.retries < 0) || (opt.retries > 255)) {
+                printf("Wrong retries number: %s\n", optarg);
+                return EXIT_INVALIDARGUMENT;
+            }
+            break;
+
+        case 'k':
+            if (port_setup_parse(optarg, &opt.port_setup) != 0) {
+                printf("Wrong port setup: %s\n", optarg);
+                return EXIT_INVALIDARGUMENT;
+            }
+            opt.port_setup_set = 1;
+            break;
+
         case 'L':
-            ext_cmd = SPECIAL_CMD_LEGACY;
+            opt.ext_cmd = SPECIAL_CMD_LEGACY;
+            break;
+
+        case 'A':
+            opt.autodetect = 1;
+            break;
+
+        case 'F':
+            opt.fix_ids = 1;
+            break;
+
+        case 'R':
+            if ((sscanf(optarg, "%d-%d", &opt.reserved_min, &opt.reserved_max) != 2) || (opt.reserved_min > opt.reserved_max)) {
+                printf("Wrong reserved ids range: %s\n", optarg);
+                return EXIT_INVALIDARGUMENT;
+            }
+            break;
+
+        case 'C':
+            opt.inventory_path = optarg;
+            break;
+
+        case 'M':
+            if (strcmp(optarg, "text") == 0) {
+                stats_format = TXN_STATS_TEXT;
+            } else if (strcmp(optarg, "json") == 0) {
+                stats_format = TXN_STATS_JSON;
+            } else {
+                printf("Wrong latency stats format: %s\n", optarg);
+                return EXIT_INVALIDARGUMENT;
+            }
+            stats_at_exit = 1;
+            break;
+
+        case 'I':
+            if (parse_dev_info_mask(optarg, &opt.info_mask) != 0) {
+                printf("Wrong device info fields: %s\n", optarg);
+                return EXIT_INVALIDARGUMENT;
+            }
             break;
 
         case 's':
-            sscanf(optarg, "%lld", &sn);
+            sscanf(optarg, "%lld", &opt.sn);
             break;
 
         case 'i':
-            sscanf(optarg, "%d", &id);
+            sscanf(optarg, "%d", &opt.id);
             break;
 
         case 'h':
@@ -773,29 +1643,75 @@ int main(int argc, char *argv[])
 // events options
 
         case 'l':
-            sscanf(optarg, "%d", &maxlen);
+            sscanf(optarg, "%d", &opt.maxlen);
             break;
 
         case 'r':
-            sscanf(optarg, "%d", &ev_r);
+            sscanf(optarg, "%d", &opt.ev_r);
             break;
 
         case 't':
-            sscanf(optarg, "%d", &ev_t);
+            sscanf(optarg, "%d", &opt.ev_t);
             break;
 
         case 'c':
-            sscanf(optarg, "%d", &ev_c);
+            sscanf(optarg, "%d", &opt.ev_c);
             break;
 
         case 'e':
-            event_request = 1;
-            sscanf(optarg, "%d", &confirm_id);
+            opt.event_request = 1;
+            sscanf(optarg, "%d", &opt.confirm_id);
             break;
 
         case 'E':
-            event_request = 2;
-            sscanf(optarg, "%d", &confirm_id);
+            opt.event_request = 2;
+            sscanf(optarg, "%d", &opt.confirm_id);
+            break;
+
+        case 'P':
+            opt.event_poll = 1;
+            break;
+
+        case 'O':
+            opt.event_sink_name = optarg;
+            break;
+
+        case 'W':
+            sscanf(optarg, "%d", &opt.cycle_us);
+            if (opt.cycle_us < 0) {
+                opt.cycle_us = 0;
+            }
+            break;
+
+        case 'g':
+            opt.event_config_path = optarg;
+            break;
+
+        case 'Q':
+            opt.poll_config_path = optarg;
+            break;
+
+        case 'S':
+            opt.server_path = optarg;
+            break;
+
+        case 'w':
+            opt.capture_path = optarg;
+            break;
+
+        case 'x':
+            replay_path = optarg;
+            break;
+
+        case 'Y':
+            if ((sscanf(optarg, "%d", &opt.analyze_cycles) != 1) || (opt.analyze_cycles < 1)) {
+                printf("Wrong analysis cycles number: %s\n", optarg);
+                return EXIT_INVALIDARGUMENT;
+            }
+            break;
+
+        case 'K':
+            opt.profile_path = optarg;
             break;
 
         default:
@@ -804,55 +1720,46 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (port == 0) {
-        printf("Serial port not specified\n");
-        return EXIT_INVALIDARGUMENT;
+    // разбор записи не использует порт
+    if (replay_path) {
+        return tool_replay(replay_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    if (configure_tty(baud, parity) != 0) {
-        return EXIT_FAILURE;
+    if (bus_num == 0) {
+        printf("Serial port not specified\n");
+        return EXIT_INVALIDARGUMENT;
     }
 
-    if (event_request) {
-        if (maxlen > 0xFF) {
-            maxlen = 0xFF;
+    // -b и -p задают настройки для портов, у которых они не указаны явно
+    for (int i = 0; i < bus_num; i++) {
+        if (buses[i].baud == 0) {
+            buses[i].baud = baud;
         }
-        tool_event(id, maxlen, confirm_id,  event_request - 1);
-        return 0;
-    }
-    if (ev_r != -1) {
-        if ((ev_r < 0) || (ev_r > 0xFFFF)) {
-            printf("WRONG reg\n");
-            return 1;
+        if (buses[i].parity == 0) {
+            buses[i].parity = parity;
         }
-        if (ev_t != 15 && ((ev_t < 1) || (ev_t > 4))) {
-            // support types for standard regtypes and 15 as system type
-            printf("WRONG type\n");
-            return 1;
-        }
-        if ((ev_c < 0) || (ev_c > 2)) {
-            printf("WRONG control\n");
-            return 1;
-        }
-        if ((id < 1) || (id > 247)) {
-            printf("WRONG id\n");
-            return 1;
-        }
-        tool_event_ctrl(id, ev_t, ev_r, ev_c);
-        return 0;
     }
 
-    if ((sn != 0) || (id != 0)) {
-        if ((sn != 0) && (id != 0)) {
-            tool_change_id(ext_cmd, sn, id);
-        } else {
-            printf("both sn and new id are necessary to change id\n");
-            return EXIT_FAILURE;
+    // файлы шин различаются по имени порта
+    for (int i = 0; i < bus_num; i++) {
+        char name[PATH_MAX];
+        bus_port_name(name, sizeof(name), buses[i].device);
+        for (int j = 0; j < i; j++) {
+            char other[PATH_MAX];
+            bus_port_name(other, sizeof(other), buses[j].device);
+            if (strcmp(name, other) == 0) {
+                printf("Serial port %s is given twice\n", buses[i].device);
+                return EXIT_INVALIDARGUMENT;
+            }
         }
-    } else {
-        // scan function
-        tool_scan(ext_cmd);
     }
+    opt.bus_num = bus_num;
 
-    return EXIT_SUCCESS;
+    // статистика задержек выводится по SIGUSR1 и по завершении работы с шиной, если указан -M
+#ifdef SIGUSR1
+    signal(SIGUSR1, stats_signal_handler);
+#endif
+
+    // несколько шин обслуживаются параллельно, по потоку на шину
+    return bus_workers_run(buses, bus_num, bus_worker, &opt);
 }
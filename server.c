@@ -0,0 +1,561 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server.h"
+
+#if defined(_WIN32)
+
+int server_listen(const char * path, FILE * out)
+{
+    (void)path;
+    fprintf(out, "Server mode is not supported on this platform\n");
+    return -1;
+}
+
+int server_run(wbmbext_ctx_t * ctx, uint8_t ext_cmd, int listen_fd, const char * path, FILE * out,
+    server_idle_fn_t idle, void * idle_arg)
+{
+    (void)ctx;
+    (void)ext_cmd;
+    (void)listen_fd;
+    (void)path;
+    (void)out;
+    (void)idle;
+    (void)idle_arg;
+    return -1;
+}
+
+#else // _WIN32
+
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#define SERVER_LINE_MAX             256
+#define SERVER_REPLY_MAX            16384
+#define SERVER_POLL_MS              100     // сигнал остановки может прийти в поток другой шины
+
+typedef struct {
+    int fd;                         // -1 - свободно
+    int closing;                    // клиент закрыл соединение, оставшиеся запросы выполняются
+    int in_len;
+    char in[SERVER_LINE_MAX * 4];
+    int out_len;                    // ответ, который еще не ушел в сокет
+    char out[SERVER_REPLY_MAX];
+} server_client_t;
+
+typedef struct {
+    wbmbext_ctx_t * ctx;
+    uint8_t ext_cmd;
+
+    server_client_t clients[SERVER_CLIENTS_MAX];
+    int next_client;                // очередь клиентов по кругу
+
+    char reply[SERVER_REPLY_MAX];
+    int reply_len;
+
+    // подтверждение последнего пакета событий и его данные для пропуска повторов
+    uint8_t confirm_id;
+    uint8_t confirm_flag;
+    wbmbext_event_packet_t last_packet[256];
+
+    dev_info_t devices[DEVICES_MAX];
+
+    uint32_t requests;
+} server_t;
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_signal_handler(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+static void reply(server_t * s, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(&s->reply[s->reply_len], sizeof(s->reply) - s->reply_len, fmt, args);
+    va_end(args);
+    if (len > 0) {
+        s->reply_len += len;
+        if (s->reply_len > (int)sizeof(s->reply) - 1) {
+            s->reply_len = sizeof(s->reply) - 1;
+        }
+    }
+}
+
+static void reply_error(server_t * s, int res)
+{
+    switch (res) {
+    case WBMBEXT_ERR_TIMEOUT:
+        reply(s, "error timeout\n");
+        break;
+    case WBMBEXT_ERR_CRC:
+        reply(s, "error crc\n");
+        break;
+    case WBMBEXT_ERR_IO:
+        reply(s, "error io\n");
+        break;
+    case WBMBEXT_ERR_EXCEPTION:
+        reply(s, "error exception %d\n", s->ctx->last_exception);
+        break;
+    case WBMBEXT_ERR_ARG:
+        reply(s, "error arguments\n");
+        break;
+    default:
+        reply(s, "error frame\n");
+        break;
+    }
+}
+
+static void cmd_scan(server_t * s)
+{
+    dev_info_t * devices = s->devices;
+    int complete = 0;
+    int dn = wbmbext_scan(s->ctx, s->ext_cmd, devices, DEVICES_MAX, &complete);
+
+    for (int i = 0; i < dn; i++) {
+        reply(s, "device %u %d\n", devices[i].serial, devices[i].id);
+    }
+    if (!complete && (dn == 0)) {
+        reply_error(s, WBMBEXT_ERR_TIMEOUT);
+        return;
+    }
+    reply(s, "ok %d\n", dn);
+}
+
+static void cmd_read(server_t * s, unsigned long long serial, unsigned fc, unsigned address, unsigned count)
+{
+    uint16_t values[WBMBEXT_READ_REGS_MAX * 16];
+    if ((serial > 0xFFFFFFFF) || (address > 0xFFFF) || (count > WBMBEXT_READ_REGS_MAX * 16)) {
+        reply_error(s, WBMBEXT_ERR_ARG);
+        return;
+    }
+
+    int res = wbmbext_read_regs(s->ctx, s->ext_cmd, serial, fc, address, count, values);
+    if (res != WBMBEXT_OK) {
+        reply_error(s, res);
+        return;
+    }
+    reply(s, "ok");
+    for (unsigned i = 0; i < count; i++) {
+        reply(s, " %u", values[i]);
+    }
+    reply(s, "\n");
+}
+
+static void cmd_events(server_t * s, unsigned min_slave, unsigned max_len)
+{
+    struct ext_modbus_event_resp * resp;
+    int len = wbmbext_event_request(s->ctx, min_slave, max_len, s->confirm_id, s->confirm_flag, &resp);
+    if (len < 0) {
+        reply_error(s, len);
+        return;
+    }
+    if (resp->sub_cmd == CMD_EXT_EVENTS_END) {
+        reply(s, "ok 0\n");
+        return;
+    }
+
+    // устройство не получило подтверждение и повторяет пакет, дополненный новыми событиями:
+    // уже отданные клиентам события пропускаются
+    unsigned skip_len = wbmbext_event_skip_len(&s->last_packet[resp->slave_id], resp);
+
+    unsigned index = 0;
+    int num = 0;
+    const event_in_buffer_t * e;
+    int res;
+    while ((res = wbmbext_event_next(resp, &index, &e)) > 0) {
+        if (index <= skip_len) {
+            continue;
+        }
+        reply(s, "event %d %d %d ", resp->slave_id, e->type, (e->event_id[0] << 8) | e->event_id[1]);
+        for (int i = 0; i < e->len; i++) {
+            reply(s, "%02X", e->data[i]);
+        }
+        reply(s, "\n");
+        num++;
+    }
+
+    wbmbext_event_packet_save(&s->last_packet[resp->slave_id], resp);
+
+    // подтверждение уходит со следующим запросом events
+    s->confirm_id = resp->slave_id;
+    s->confirm_flag = resp->flag;
+
+    if (res < 0) {
+        reply_error(s, res);
+        return;
+    }
+    reply(s, "ok %d\n", num);
+}
+
+static void cmd_evctrl(server_t * s, unsigned id, unsigned type, unsigned address, unsigned ctrl)
+{
+    if ((id < WBMBEXT_ID_MIN) || (id > WBMBEXT_ID_MAX) || (address > 0xFFFF) || (ctrl > WBMBEXT_EVENT_CTRL_HIGH)) {
+        reply_error(s, WBMBEXT_ERR_ARG);
+        return;
+    }
+    wbmbext_event_setting_t setting = { .type = type, .address = address, .ctrl = ctrl };
+    int res = wbmbext_event_setup(s->ctx, id, &setting, 1, NULL);
+    if (res < 0) {
+        reply_error(s, res);
+        return;
+    }
+    reply(s, "ok %d\n", setting.enabled);
+}
+
+static void execute(server_t * s, char * line)
+{
+    char cmd[16];
+    unsigned long long serial;
+    unsigned a;
+    unsigned b;
+    unsigned c;
+    unsigned d;
+
+    if (sscanf(line, "%15s", cmd) != 1) {
+        return;
+    }
+    s->requests++;
+
+    if (strcmp(cmd, "scan") == 0) {
+        cmd_scan(s);
+    } else if (strcmp(cmd, "read") == 0) {
+        if (sscanf(line, "%*s %llu %u %u %u", &serial, &a, &b, &c) != 4) {
+            reply_error(s, WBMBEXT_ERR_ARG);
+            return;
+        }
+        cmd_read(s, serial, a, b, c);
+    } else if (strcmp(cmd, "write") == 0) {
+        if ((sscanf(line, "%*s %llu %u %u", &serial, &a, &b) != 3) || (serial > 0xFFFFFFFF) || (a > 0xFFFF) || (b > 0xFFFF)) {
+            reply_error(s, WBMBEXT_ERR_ARG);
+            return;
+        }
+        int res = wbmbext_write_reg(s->ctx, s->ext_cmd, serial, a, b);
+        if (res == WBMBEXT_OK) {
+            reply(s, "ok\n");
+        } else {
+            reply_error(s, res);
+        }
+    } else if (strcmp(cmd, "setid") == 0) {
+        if ((sscanf(line, "%*s %llu %u", &serial, &a) != 2) || (serial > 0xFFFFFFFF) || (a > WBMBEXT_ID_MAX)) {
+            reply_error(s, WBMBEXT_ERR_ARG);
+            return;
+        }
+        int res = wbmbext_change_id(s->ctx, s->ext_cmd, serial, a);
+        if (res == WBMBEXT_OK) {
+            reply(s, "ok\n");
+        } else {
+            reply_error(s, res);
+        }
+    } else if (strcmp(cmd, "events") == 0) {
+        // оба аргумента необязательные
+        a = 0;
+        b = 0xFF;
+        sscanf(line, "%*s %u %u", &a, &b);
+        if ((a > WBMBEXT_ID_MAX) || (b > 0xFF)) {
+            reply_error(s, WBMBEXT_ERR_ARG);
+            return;
+        }
+        cmd_events(s, a, b);
+    } else if (strcmp(cmd, "evctrl") == 0) {
+        if (sscanf(line, "%*s %u %u %u %u", &a, &b, &c, &d) != 4) {
+            reply_error(s, WBMBEXT_ERR_ARG);
+            return;
+        }
+        cmd_evctrl(s, a, b, c, d);
+    } else {
+        reply(s, "error unknown command\n");
+    }
+}
+
+static void client_close(server_client_t * c)
+{
+    close(c->fd);
+    c->fd = -1;
+}
+
+// клиент, который не принимает ответы, отключается: оставшиеся запросы и ответы отбрасываются
+static void client_drop(server_client_t * c)
+{
+    c->closing = 1;
+    c->in_len = 0;
+    c->out_len = 0;
+}
+
+// отправка ответа без ожидания, остаток уходит, когда сокет будет готов к записи
+static void client_flush(server_client_t * c)
+{
+    while (c->out_len) {
+        int len = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+        if (len < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                client_drop(c);
+            }
+            return;
+        }
+        c->out_len -= len;
+        memmove(c->out, &c->out[len], c->out_len);
+    }
+}
+
+// первая полная строка из буфера клиента, 0 - полной строки нет
+static int client_take_line(server_client_t * c, char * line)
+{
+    char * end = memchr(c->in, '\n', c->in_len);
+    if (end == NULL) {
+        return 0;
+    }
+    int len = end - c->in;
+    memcpy(line, c->in, len < SERVER_LINE_MAX ? len : SERVER_LINE_MAX - 1);
+    line[len < SERVER_LINE_MAX ? len : SERVER_LINE_MAX - 1] = 0;
+    line[strcspn(line, "\r")] = 0;
+
+    c->in_len -= len + 1;
+    memmove(c->in, end + 1, c->in_len);
+    return 1;
+}
+
+// следующий запрос клиента выполняется только после того, как ушел ответ на предыдущий:
+// клиент, который не читает ответы, задерживает только свою очередь
+static int client_has_line(const server_client_t * c)
+{
+    return (c->fd >= 0) && (c->out_len == 0) && (memchr(c->in, '\n', c->in_len) != NULL);
+}
+
+static void client_read(server_client_t * c)
+{
+    int len = read(c->fd, &c->in[c->in_len], sizeof(c->in) - c->in_len);
+    if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+        return;
+    }
+    if (len <= 0) {
+        c->closing = 1;
+        return;
+    }
+    c->in_len += len;
+
+    // строка длиннее буфера не может быть запросом
+    if ((c->in_len == (int)sizeof(c->in)) && !memchr(c->in, '\n', c->in_len)) {
+        c->closing = 1;
+        c->in_len = 0;
+    }
+}
+
+// выполнение одного запроса следующего по очереди клиента; 0 - запросов нет
+static int serve_next(server_t * s)
+{
+    for (int n = 0; n < SERVER_CLIENTS_MAX; n++) {
+        server_client_t * c = &s->clients[(s->next_client + n) % SERVER_CLIENTS_MAX];
+        if (!client_has_line(c)) {
+            continue;
+        }
+        s->next_client = (s->next_client + n + 1) % SERVER_CLIENTS_MAX;
+
+        char line[SERVER_LINE_MAX];
+        client_take_line(c, line);
+        s->reply_len = 0;
+        execute(s, line);
+
+        memcpy(c->out, s->reply, s->reply_len);
+        c->out_len = s->reply_len;
+        client_flush(c);
+        return 1;
+    }
+    return 0;
+}
+
+static int remove_stale_socket(const char * path, const struct sockaddr_un * addr, FILE * out)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(out, "Error check %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(out, "%s exists and is not a socket\n", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(out, "Error create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    int res = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    int err = errno;
+    close(fd);
+
+    if (res == 0) {
+        fprintf(out, "%s is served by another process\n", path);
+        return -1;
+    }
+    if (err != ECONNREFUSED) {
+        fprintf(out, "Error check %s: %s\n", path, strerror(err));
+        return -1;
+    }
+    unlink(path);
+    return 0;
+}
+
+int server_listen(const char * path, FILE * out)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(out, "Socket path too long: %s\n", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(out, "Error create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // сокет, оставшийся от прошлого запуска, удаляется, только если его никто не слушает:
+    // второй сервер на том же пути отобрал бы шину у работающего
+    if (remove_stale_socket(path, &addr, out) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, SERVER_CLIENTS_MAX) != 0)) {
+        fprintf(out, "Error listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int server_run(wbmbext_ctx_t * ctx, uint8_t ext_cmd, int listen_fd, const char * path, FILE * out,
+    server_idle_fn_t idle, void * idle_arg)
+{
+    // у каждой шины свой сервер
+    server_t * s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        fprintf(out, "Error allocate server\n");
+        close(listen_fd);
+        unlink(path);
+        return -1;
+    }
+    s->ctx = ctx;
+    s->ext_cmd = ext_cmd;
+    for (int i = 0; i < SERVER_CLIENTS_MAX; i++) {
+        s->clients[i].fd = -1;
+    }
+    wbmbext_event_packets_init(s->last_packet, 256);
+
+    signal(SIGINT, server_signal_handler);
+    signal(SIGTERM, server_signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(out, "Listening on %s\n", path);
+    fflush(out);
+
+    while (!server_stop) {
+        if (idle) {
+            idle(idle_arg);
+        }
+
+        struct pollfd pfd[SERVER_CLIENTS_MAX + 1];
+        int pending = 0;
+
+        pfd[0].fd = listen_fd;
+        pfd[0].events = POLLIN;
+        for (int i = 0; i < SERVER_CLIENTS_MAX; i++) {
+            server_client_t * c = &s->clients[i];
+            pfd[i + 1].fd = -1;
+            pfd[i + 1].events = 0;
+            if (c->fd >= 0) {
+                // пока буфер запросов полон, данные клиента ждут в сокете
+                if (!c->closing && (c->in_len < (int)sizeof(c->in))) {
+                    pfd[i + 1].events |= POLLIN;
+                }
+                if (c->out_len) {
+                    pfd[i + 1].events |= POLLOUT;
+                }
+                pfd[i + 1].fd = pfd[i + 1].events ? c->fd : -1;
+            }
+            pending |= client_has_line(c);
+        }
+
+        // пока есть запросы, poll только забирает новые данные без ожидания, иначе ждет
+        // ограниченное время: флаг остановки проверяется, даже если сигнал принял другой поток
+        if (poll(pfd, SERVER_CLIENTS_MAX + 1, pending ? 0 : SERVER_POLL_MS) < 0) {
+            if (errno != EINTR) {
+                fprintf(out, "Error poll: %s\n", strerror(errno));
+                break;
+            }
+            continue;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            int slot = -1;
+            for (int i = 0; (fd >= 0) && (i < SERVER_CLIENTS_MAX); i++) {
+                if (s->clients[i].fd < 0) {
+                    slot = i;
+                    break;
+                }
+            }
+            if (slot >= 0) {
+                memset(&s->clients[slot], 0, sizeof(s->clients[slot]));
+                s->clients[slot].fd = fd;
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            } else if (fd >= 0) {
+                send(fd, "error too many clients\n", 23, MSG_NOSIGNAL);
+                close(fd);
+            }
+        }
+
+        for (int i = 0; i < SERVER_CLIENTS_MAX; i++) {
+            server_client_t * c = &s->clients[i];
+            if ((pfd[i + 1].revents & POLLOUT) || (c->out_len && (pfd[i + 1].revents & (POLLHUP | POLLERR)))) {
+                client_flush(c);
+            }
+            if ((pfd[i + 1].events & POLLIN) && (pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                client_read(c);
+            }
+        }
+
+        serve_next(s);
+        fflush(out);
+
+        // закрывшиеся клиенты освобождаются после выполнения их оставшихся запросов
+        for (int i = 0; i < SERVER_CLIENTS_MAX; i++) {
+            server_client_t * c = &s->clients[i];
+            if ((c->fd >= 0) && c->closing && (c->out_len == 0) && !client_has_line(c)) {
+                client_close(c);
+            }
+        }
+    }
+
+    for (int i = 0; i < SERVER_CLIENTS_MAX; i++) {
+        if (s->clients[i].fd >= 0) {
+            client_close(&s->clients[i]);
+        }
+    }
+    close(listen_fd);
+    unlink(path);
+
+    fprintf(out, "Server stopped: %u requests\n", s->requests);
+    free(s);
+    return 0;
+}
+
+#endif // _WIN32
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include "wbmbext.h"
+
+#define SERVER_CLIENTS_MAX          16
+
+/*
+    Режим сервера: процесс держит порт открытым и выполняет запросы клиентов,
+    подключенных к локальному unix сокету.
+
+    Запрос - одна текстовая строка, ответ - ноль или больше строк данных и итоговая
+    строка "ok ..." или "error ...":
+
+        scan                                device <serial> <id> ...        ok <num>
+        read <serial> <fc> <addr> <count>   ok <value> ...
+        write <serial> <addr> <value>       ok
+        setid <serial> <id>                 ok
+        events [min_slave [max_len]]        event <id> <type> <event_id> <hex data> ...   ok <num>
+        evctrl <id> <type> <addr> <ctrl>    ok <enabled>
+
+    Запросы всех клиентов выполняются по одному, клиенты обслуживаются по очереди, по
+    запросу за раз; следующий запрос отправляется на шину сразу после ответа на предыдущий.
+    Следующий запрос клиента выполняется, когда ответ на предыдущий ушел в его сокет:
+    клиент, который не читает ответы, не задерживает шину и остальных клиентов.
+    Подтверждение пакета событий общее для всех клиентов: его отправляет следующий запрос
+    events, от какого бы клиента он ни пришел.
+
+    idle, если задан, вызывается на каждом проходе цикла между запросами (и не реже раза
+    в 100 мс при ожидании) - например, для вывода статистики по SIGUSR1. Сообщения сервера
+    печатаются в out. Серверы нескольких шин работают в своих потоках независимо.
+
+    Возвращает 0 после остановки по SIGINT/SIGTERM.
+*/
+typedef void (*server_idle_fn_t)(void * arg);
+
+int server_run(wbmbext_ctx_t * ctx, uint8_t ext_cmd, int listen_fd, const char * path, FILE * out,
+    server_idle_fn_t idle, void * idle_arg);
+
+/*
+    Сокет сервера создается до открытия порта: если путь занят работающим сервером,
+    шина не затрагивается. Оставшийся от прошлого запуска сокет удаляется, только если
+    к нему не подключиться, файл другого типа не удаляется. Возвращает дескриптор
+    для server_run или -1, ошибка печатается в out.
+*/
+int server_listen(const char * path, FILE * out);
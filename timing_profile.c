@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "timing_profile.h"
+
+#define TIMING_PROFILE_LINE_MAX     256
+#define TIMING_PROFILE_HEADER       "# device\tbaud\tparity\tgap_us\tmargin_us\n"
+
+int timing_profiles_load(const char * path, timing_profiles_t * list, FILE * out)
+{
+    list->num = 0;
+
+    FILE * f = fopen(path, "r");
+    if (f == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(out, "Error open timing profile %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[TIMING_PROFILE_LINE_MAX];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_num++;
+        line[strcspn(line, "#\r\n")] = 0;
+
+        timing_profile_t p;
+        int fields = sscanf(line, "%127s %d %c %u %u", p.device, &p.baud, &p.parity, &p.gap_us, &p.margin_us);
+        if (fields <= 0) {
+            continue;
+        }
+        if ((fields != 5) || (p.baud <= 0)) {
+            fprintf(out, "Error timing profile %s:%d: wrong format\n", path, line_num);
+            fclose(f);
+            return -1;
+        }
+        if (list->num == TIMING_PROFILES_MAX) {
+            fprintf(out, "Error timing profile %s: too many ports\n", path);
+            fclose(f);
+            return -1;
+        }
+        list->profiles[list->num++] = p;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int timing_profiles_save(const char * path, const timing_profiles_t * list, FILE * out)
+{
+    size_t tmp_len = strlen(path) + 5;
+    char * tmp_path = malloc(tmp_len);
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    FILE * f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        fprintf(out, "Error write timing profile %s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return -1;
+    }
+
+    fputs(TIMING_PROFILE_HEADER, f);
+    for (int n = 0; n < list->num; n++) {
+        const timing_profile_t * p = &list->profiles[n];
+        fprintf(f, "%s\t%d\t%c\t%u\t%u\n", p->device, p->baud, p->parity, p->gap_us, p->margin_us);
+    }
+
+    int err = ferror(f);
+    err |= fclose(f);
+#if defined(_WIN32)
+    // rename в windows не заменяет существующий файл
+    if (!err) {
+        remove(path);
+    }
+#endif
+    if (err || (rename(tmp_path, path) != 0)) {
+        fprintf(out, "Error write timing profile %s: %s\n", path, strerror(errno));
+        remove(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    free(tmp_path);
+    return 0;
+}
+
+timing_profile_t * timing_profiles_find(timing_profiles_t * list, const char * device, int baud, char parity)
+{
+    for (int n = 0; n < list->num; n++) {
+        timing_profile_t * p = &list->profiles[n];
+        if ((strcmp(p->device, device) == 0) && (p->baud == baud) && (p->parity == parity)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+timing_profile_t * timing_profiles_get(timing_profiles_t * list, const char * device, int baud, char parity)
+{
+    timing_profile_t * p = timing_profiles_find(list, device, baud, parity);
+    if (p || (list->num == TIMING_PROFILES_MAX)) {
+        return p;
+    }
+
+    p = &list->profiles[list->num++];
+    memset(p, 0, sizeof(*p));
+    snprintf(p->device, sizeof(p->device), "%s", device);
+    p->baud = baud;
+    p->parity = parity;
+    return p;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TIMING_PROFILES_MAX         64
+#define TIMING_PROFILE_DEVICE_MAX   128
+
+/*
+    Калиброванные паузы и таймауты портов, сохраняемые между запусками (-K)
+
+    Текстовый файл, по строке на порт и настройки порта:
+
+        # device            baud    parity  gap_us  margin_us
+        /dev/ttyRS485-1     115200  n       304     1200
+
+    gap_us - пауза перед каждым запросом, margin_us - запас таймаута ответа (как -T).
+    Файл записывает анализатор времянок (-Y), строка с тем же портом, скоростью и
+    четностью заменяется, строки других портов сохраняются.
+*/
+typedef struct {
+    char device[TIMING_PROFILE_DEVICE_MAX];
+    int baud;
+    char parity;
+    uint32_t gap_us;
+    uint32_t margin_us;
+} timing_profile_t;
+
+typedef struct {
+    int num;
+    timing_profile_t profiles[TIMING_PROFILES_MAX];
+} timing_profiles_t;
+
+// отсутствующий файл - пустой список, возвращает -1 при ошибке чтения или формата, ошибка печатается в out
+int timing_profiles_load(const char * path, timing_profiles_t * list, FILE * out);
+
+// запись через временный файл, как и список устройств
+int timing_profiles_save(const char * path, const timing_profiles_t * list, FILE * out);
+
+timing_profile_t * timing_profiles_find(timing_profiles_t * list, const char * device, int baud, char parity);
+
+// поиск или добавление строки порта, NULL если список заполнен
+timing_profile_t * timing_profiles_get(timing_profiles_t * list, const char * device, int baud, char parity);
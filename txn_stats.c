@@ -0,0 +1,204 @@
+#include <string.h>
+#include "txn_stats.h"
+#include "modbus_ext.h"
+
+static const char * const type_names[TXN_TYPES_NUM] = {
+    [TXN_SCAN_INIT] = "scan_init",
+    [TXN_SCAN_NEXT] = "scan_next",
+    [TXN_SERIAL] = "serial",
+    [TXN_EVENT_REQ] = "event_req",
+    [TXN_EVENT_CTRL] = "event_ctrl",
+    [TXN_OTHER] = "other",
+};
+
+static const char * const phase_names[TXN_PHASES_NUM] = {
+    [TXN_PHASE_TX] = "tx",
+    [TXN_PHASE_TURNAROUND] = "turnaround",
+    [TXN_PHASE_ARBITRATION] = "arbitration",
+    [TXN_PHASE_FRAME] = "frame",
+    [TXN_PHASE_TOTAL] = "total",
+};
+
+static const char * const result_names[TXN_RESULTS_NUM] = {
+    [TXN_RESULT_OK] = "ok",
+    [TXN_RESULT_TIMEOUT] = "timeout",
+    [TXN_RESULT_ERROR] = "error",
+};
+
+// начальный и конечный момент каждого интервала
+static const struct {
+    txn_ts_t from;
+    txn_ts_t to;
+} phase_ts[TXN_PHASES_NUM] = {
+    [TXN_PHASE_TX] = { TXN_TS_TX_START, TXN_TS_TX_DONE },
+    [TXN_PHASE_TURNAROUND] = { TXN_TS_TX_DONE, TXN_TS_RX_FIRST },
+    [TXN_PHASE_ARBITRATION] = { TXN_TS_RX_FIRST, TXN_TS_RX_DATA },
+    [TXN_PHASE_FRAME] = { TXN_TS_RX_DATA, TXN_TS_FRAME },
+    [TXN_PHASE_TOTAL] = { TXN_TS_TX_START, TXN_TS_FRAME },
+};
+
+txn_type_t txn_type_of_request(const uint8_t * frame, int len)
+{
+    if ((len < 3) || ((frame[1] != SPECIAL_CMD) && (frame[1] != SPECIAL_CMD_LEGACY))) {
+        return TXN_OTHER;
+    }
+
+    switch (frame[2]) {
+    case CMD_EXT_SCAN_START:
+        return TXN_SCAN_INIT;
+    case CMD_EXT_SCAN_NEXT:
+        return TXN_SCAN_NEXT;
+    case CMD_EXT_STD_PDU_REQ:
+        return TXN_SERIAL;
+    case CMD_EXT_EVENTS_REQ:
+        return TXN_EVENT_REQ;
+    case CMD_EXT_EVENTS_CTRL:
+        return TXN_EVENT_CTRL;
+    default:
+        return TXN_OTHER;
+    }
+}
+
+const char * txn_type_name(txn_type_t type)
+{
+    return type_names[type];
+}
+
+void txn_begin(txn_t * t, txn_type_t type, uint64_t tx_start_ns)
+{
+    memset(t, 0, sizeof(*t));
+    t->active = 1;
+    t->type = type;
+    t->ts[TXN_TS_TX_START] = tx_start_ns;
+}
+
+static unsigned hist_bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned b = 0;
+    while (us && (b < TXN_HIST_BUCKETS - 1)) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static void hist_add(txn_hist_t * h, uint64_t ns)
+{
+    if ((h->count == 0) || (ns < h->min_ns)) {
+        h->min_ns = ns;
+    }
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+    h->count++;
+    h->sum_ns += ns;
+    h->buckets[hist_bucket(ns)]++;
+}
+
+void txn_end(txn_t * t, txn_stats_t * s, txn_result_t result)
+{
+    if (!t->active) {
+        return;
+    }
+    t->active = 0;
+    s->results[t->type][result]++;
+
+    for (int p = 0; p < TXN_PHASES_NUM; p++) {
+        uint64_t from = t->ts[phase_ts[p].from];
+        uint64_t to = t->ts[phase_ts[p].to];
+        if (from && to && (to >= from)) {
+            hist_add(&s->hist[t->type][p], to - from);
+        }
+    }
+}
+
+void txn_stats_reset(txn_stats_t * s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+// верхняя граница корзины, в которую попадает доля p значений
+static uint64_t hist_percentile_us(const txn_hist_t * h, unsigned p)
+{
+    uint64_t need = ((uint64_t)h->count * p + 99) / 100;
+    uint64_t acc = 0;
+    for (unsigned b = 0; b < TXN_HIST_BUCKETS; b++) {
+        acc += h->buckets[b];
+        if (acc >= need) {
+            return (b == TXN_HIST_BUCKETS - 1) ? h->max_ns / 1000 : (1ULL << b);
+        }
+    }
+    return h->max_ns / 1000;
+}
+
+static void print_text(const txn_stats_t * s, FILE * out)
+{
+    fprintf(out, "Transaction latency, us:\n");
+    for (int t = 0; t < TXN_TYPES_NUM; t++) {
+        uint32_t total = 0;
+        for (int r = 0; r < TXN_RESULTS_NUM; r++) {
+            total += s->results[t][r];
+        }
+        if (total == 0) {
+            continue;
+        }
+
+        fprintf(out, "%-10s ok %u timeout %u error %u\n", type_names[t],
+            s->results[t][TXN_RESULT_OK], s->results[t][TXN_RESULT_TIMEOUT], s->results[t][TXN_RESULT_ERROR]);
+
+        for (int p = 0; p < TXN_PHASES_NUM; p++) {
+            const txn_hist_t * h = &s->hist[t][p];
+            if (h->count == 0) {
+                continue;
+            }
+            fprintf(out, "    %-12s count %6u  min %8llu  avg %8llu  max %8llu  p50 <%8llu  p99 <%8llu\n",
+                phase_names[p], h->count,
+                (unsigned long long)(h->min_ns / 1000),
+                (unsigned long long)(h->sum_ns / h->count / 1000),
+                (unsigned long long)(h->max_ns / 1000),
+                (unsigned long long)hist_percentile_us(h, 50),
+                (unsigned long long)hist_percentile_us(h, 99));
+        }
+    }
+}
+
+// одной строкой, чтобы при работе с несколькими шинами каждая строка получила префикс порта
+static void print_json(const txn_stats_t * s, FILE * out)
+{
+    fprintf(out, "{\"bucket_upper_us\":[");
+    for (int b = 0; b < TXN_HIST_BUCKETS - 1; b++) {
+        fprintf(out, "%s%llu", b ? "," : "", 1ULL << b);
+    }
+    fprintf(out, ",null],\"transactions\":{");
+
+    for (int t = 0; t < TXN_TYPES_NUM; t++) {
+        fprintf(out, "%s\"%s\":{", t ? "," : "", type_names[t]);
+        for (int r = 0; r < TXN_RESULTS_NUM; r++) {
+            fprintf(out, "\"%s\":%u,", result_names[r], s->results[t][r]);
+        }
+
+        for (int p = 0; p < TXN_PHASES_NUM; p++) {
+            const txn_hist_t * h = &s->hist[t][p];
+            fprintf(out, "%s\"%s\":{\"count\":%u,\"min_ns\":%llu,\"max_ns\":%llu,\"sum_ns\":%llu,\"buckets\":[",
+                p ? "," : "", phase_names[p], h->count,
+                (unsigned long long)h->min_ns, (unsigned long long)h->max_ns, (unsigned long long)h->sum_ns);
+            for (int b = 0; b < TXN_HIST_BUCKETS; b++) {
+                fprintf(out, "%s%u", b ? "," : "", h->buckets[b]);
+            }
+            fprintf(out, "]}");
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "}}\n");
+}
+
+void txn_stats_print(const txn_stats_t * s, FILE * out, txn_stats_format_t format)
+{
+    if (format == TXN_STATS_JSON) {
+        print_json(s, out);
+    } else {
+        print_text(s, out);
+    }
+    fflush(out);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TXN_HIST_BUCKETS            24      // 0: < 1 мкс, i: [2^(i-1), 2^i) мкс, последний - все что больше
+
+typedef enum {
+    TXN_SCAN_INIT,
+    TXN_SCAN_NEXT,
+    TXN_SERIAL,             // обращение к регистрам по серийному номеру (0x08)
+    TXN_EVENT_REQ,
+    TXN_EVENT_CTRL,
+    TXN_OTHER,
+    TXN_TYPES_NUM
+} txn_type_t;
+
+// моменты времени транзакции
+typedef enum {
+    TXN_TS_TX_START,
+    TXN_TS_TX_DONE,
+    TXN_TS_RX_FIRST,        // первый принятый байт, в том числе байт арбитража
+    TXN_TS_RX_DATA,         // первый байт, отличный от 0xFF - начало кадра ответа
+    TXN_TS_FRAME,           // кадр принят целиком
+    TXN_TS_NUM
+} txn_ts_t;
+
+// интервалы между моментами, по каждому ведется гистограмма
+typedef enum {
+    TXN_PHASE_TX,           // передача запроса
+    TXN_PHASE_TURNAROUND,   // от конца запроса до первого байта
+    TXN_PHASE_ARBITRATION,  // от первого байта до начала кадра
+    TXN_PHASE_FRAME,        // прием кадра
+    TXN_PHASE_TOTAL,        // от начала запроса до конца ответа
+    TXN_PHASES_NUM
+} txn_phase_t;
+
+typedef enum {
+    TXN_RESULT_OK,
+    TXN_RESULT_TIMEOUT,
+    TXN_RESULT_ERROR,
+    TXN_RESULTS_NUM
+} txn_result_t;
+
+typedef struct {
+    int active;
+    txn_type_t type;
+    uint64_t ts[TXN_TS_NUM];        // 0 - момент не наступил
+} txn_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t sum_ns;
+    uint32_t buckets[TXN_HIST_BUCKETS];
+} txn_hist_t;
+
+/*
+    Статистика задержек транзакций
+
+    Память фиксирована: на каждый тип транзакции - счетчики результатов и гистограммы
+    по интервалам с логарифмическими корзинами. Интервал учитывается, только если оба
+    его момента наступили: у транзакции без ответа есть только время передачи.
+*/
+typedef struct {
+    uint32_t results[TXN_TYPES_NUM][TXN_RESULTS_NUM];
+    txn_hist_t hist[TXN_TYPES_NUM][TXN_PHASES_NUM];
+} txn_stats_t;
+
+typedef enum {
+    TXN_STATS_TEXT,
+    TXN_STATS_JSON
+} txn_stats_format_t;
+
+// тип транзакции по кадру запроса
+txn_type_t txn_type_of_request(const uint8_t * frame, int len);
+
+const char * txn_type_name(txn_type_t type);
+
+void txn_begin(txn_t * t, txn_type_t type, uint64_t tx_start_ns);
+
+// отмечается только первое наступление момента
+static inline void txn_mark(txn_t * t, txn_ts_t ts, uint64_t now_ns)
+{
+    if (t->active && (t->ts[ts] == 0)) {
+        t->ts[ts] = now_ns;
+    }
+}
+
+// завершение транзакции и учет ее интервалов в статистике
+void txn_end(txn_t * t, txn_stats_t * s, txn_result_t result);
+
+void txn_stats_reset(txn_stats_t * s);
+
+void txn_stats_print(const txn_stats_t * s, FILE * out, txn_stats_format_t format);
@@ -0,0 +1,907 @@
+/*
+    Симулятор шины RS-485 с устройствами Wiren Board
+
+    Открывает псевдотерминал и эмулирует на нем N устройств, поддерживающих расширение
+    протокола (см. docs/protocol.ru.md):
+
+        0x01 - 0x04     сканирование с арбитражем по серийному номеру
+        0x08 / 0x09     обращение к регистрам по серийному номеру
+        0x10 - 0x12     опрос событий с подтверждением
+        0x18            настройка отправки событий
+
+    Временные параметры арбитража (пауза перед арбитражем, окна арбитража с байтами 0xFF,
+    время передачи кадра) выдерживаются по указанной скорости, так что время сканирования
+    и опроса событий соответствует реальной шине. Утилите указывается путь к подчиненной
+    стороне псевдотерминала: wb-modbus-scanner -d /dev/pts/N
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <poll.h>
+#include <termios.h>
+#include "modbus_crc.h"
+#include "modbus_ext.h"
+#include "bus_timing.h"
+
+#define EXIT_INVALIDARGUMENT        2
+
+#define SIM_DEVICES_MAX             247
+#define SIM_REQ_BUF_SIZE            512
+#define SIM_EVENT_QUEUE_SIZE        1024
+#define SIM_EVENT_REGS_MAX          64
+
+#define SCAN_ARBITRATION_BITS       32
+#define EVENT_ARBITRATION_BITS      12
+
+// маркер приоритета пакета событий - старшие 4 бита значения арбитража
+#define EVENT_MARKER_HIGH           0x3
+#define EVENT_MARKER_LOW            0x7
+#define EVENT_MARKER_NONE           0xF
+
+#define EVENT_TYPE_SYSTEM           0x0F
+#define EVENT_ID_POWER_ON           0
+
+#define EVENT_CTRL_DISABLED         0
+#define EVENT_CTRL_LOW              1
+#define EVENT_CTRL_HIGH             2
+
+typedef struct {
+    uint8_t type;
+    uint16_t address;
+    uint8_t ctrl;
+} sim_event_reg_t;
+
+typedef struct {
+    uint32_t serial;
+    uint8_t id;
+    uint8_t scanned;
+    char model[20];
+
+    // очередь событий в формате пакета 0x11: len, type, id (2 байта), данные
+    uint8_t queue[SIM_EVENT_QUEUE_SIZE];
+    int queue_len;
+    int queue_events;
+    int high_events;            // событий с высоким приоритетом в очереди
+
+    // отправленный и еще не подтвержденный пакет - начало очереди
+    uint8_t flag;
+    int sent_len;
+    int sent_events;
+    int sent_high;
+
+    sim_event_reg_t regs[SIM_EVENT_REGS_MAX];
+    int regs_num;
+    uint16_t counter;
+} sim_dev_t;
+
+int debug = 0;
+int fast = 0;                   // не выдерживать временные параметры шины
+double noise = 0;               // вероятность искажения кадра ответа
+
+int master_fd = -1;
+bus_timing_t timing;
+
+sim_dev_t devices[SIM_DEVICES_MAX];
+int dev_num = 0;
+
+static volatile sig_atomic_t stop_request = 0;
+
+static void stop_signal_handler(int sig)
+{
+    (void)sig;
+    stop_request = 1;
+}
+
+static inline void u16_to_be_buf8(uint8_t * buf, uint16_t value)
+{
+    buf[0] = (value >> 8) & 0xFF;
+    buf[1] = (value >> 0) & 0xFF;
+}
+
+static inline uint16_t u16_from_be_buf8(const uint8_t * buf)
+{
+    return (buf[0] << 8) + (buf[1] << 0);
+}
+
+static inline void u32_to_be_buf8(uint8_t * buf, uint32_t value)
+{
+    buf[0] = (value >> 24) & 0xFF;
+    buf[1] = (value >> 16) & 0xFF;
+    buf[2] = (value >> 8) & 0xFF;
+    buf[3] = (value >> 0) & 0xFF;
+}
+
+static inline uint32_t u32_from_be_buf8(const uint8_t * buf)
+{
+    return ((uint32_t)buf[0] << 24) + (buf[1] << 16) + (buf[2] << 8) + (buf[3] << 0);
+}
+
+void print_hb(char * msg, uint8_t * b, int len)
+{
+    printf("%s : ", msg);
+    for (int i = 0; i < len; i++) {
+        printf(" %02X", b[i]);
+    }
+    printf("\r\n");
+}
+
+void sim_sleep_until(uint64_t t)
+{
+    if (!fast) {
+        bus_sleep_until_ns(t);
+    }
+}
+
+void sim_write(const uint8_t * buf, int len)
+{
+    while (len > 0) {
+        int w = write(master_fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error from write: %s\n", strerror(errno));
+            return;
+        }
+        buf += w;
+        len -= w;
+    }
+}
+
+/*
+    Ответ на запрос: пауза перед арбитражем, окна арбитража, затем кадр.
+    В окнах, где у победителя бит 0 (доминантный), на шину выдается байт 0xFF,
+    рецессивный бит - тишина. Шина занята до конца передачи кадра.
+*/
+void sim_respond(uint64_t req_end, uint32_t arbitration_value, int windows, int legacy, uint8_t * frame, int len)
+{
+    uint64_t start_ns;
+    uint64_t window_ns;
+
+    if (legacy) {
+        start_ns = bus_bits_ns(&timing, 44);
+        window_ns = bus_bits_ns(&timing, 20);
+    } else {
+        start_ns = bus_silence_ns(&timing);
+        window_ns = (bus_response_timeout_ns(&timing, 1, 0) - bus_response_timeout_ns(&timing, 0, 0));
+    }
+
+    uint64_t t = req_end + start_ns;
+    for (int w = 0; w < windows; w++) {
+        if (!(arbitration_value & (1u << (windows - 1 - w)))) {
+            sim_sleep_until(t);
+            uint8_t dominant = ARBITRATION_BYTE;
+            sim_write(&dominant, 1);
+        }
+        t += window_ns;
+    }
+
+    uint16_t crc = modbus_crc(frame, len);
+    frame[len] = crc & 0xFF;
+    frame[len + 1] = crc >> 8;
+    len += 2;
+
+    if ((noise > 0) && ((double)rand() / RAND_MAX < noise)) {
+        frame[rand() % len] ^= 1 << (rand() % 8);
+    }
+
+    sim_sleep_until(t);
+    sim_write(frame, len);
+    if (debug) {
+        print_hb("    ->", frame, len);
+    }
+    sim_sleep_until(t + len * timing.char_ns);
+}
+
+// события
+
+int event_reg_ctrl(const sim_dev_t * dev, uint8_t type, uint16_t address)
+{
+    for (int i = 0; i < dev->regs_num; i++) {
+        if ((dev->regs[i].type == type) && (dev->regs[i].address == address)) {
+            return dev->regs[i].ctrl;
+        }
+    }
+    // событие включения разрешено, пока его не отключат
+    if ((type == EVENT_TYPE_SYSTEM) && (address == EVENT_ID_POWER_ON)) {
+        return EVENT_CTRL_LOW;
+    }
+    return EVENT_CTRL_DISABLED;
+}
+
+void event_push(sim_dev_t * dev, uint8_t type, uint16_t address, const uint8_t * data, int data_len, int high)
+{
+    if (dev->queue_len + 4 + data_len > SIM_EVENT_QUEUE_SIZE) {
+        return;
+    }
+    uint8_t * e = &dev->queue[dev->queue_len];
+    e[0] = data_len;
+    e[1] = type;
+    u16_to_be_buf8(&e[2], address);
+    memcpy(&e[4], data, data_len);
+
+    dev->queue_len += 4 + data_len;
+    dev->queue_events++;
+    if (high) {
+        dev->high_events++;
+    }
+}
+
+// новое событие на случайном разрешенном регистре устройства
+void event_generate(sim_dev_t * dev)
+{
+    int enabled[SIM_EVENT_REGS_MAX];
+    int enabled_num = 0;
+
+    for (int i = 0; i < dev->regs_num; i++) {
+        if ((dev->regs[i].ctrl != EVENT_CTRL_DISABLED) && (dev->regs[i].type != EVENT_TYPE_SYSTEM)) {
+            enabled[enabled_num++] = i;
+        }
+    }
+
+    uint8_t data[2];
+    dev->counter++;
+    data[0] = dev->counter & 0xFF;
+    data[1] = dev->counter >> 8;
+
+    if (enabled_num) {
+        sim_event_reg_t * reg = &dev->regs[enabled[rand() % enabled_num]];
+        int len = ((reg->type == 1) || (reg->type == 2)) ? 1 : 2;
+        event_push(dev, reg->type, reg->address, data, len, reg->ctrl == EVENT_CTRL_HIGH);
+    } else {
+        // устройство без настройки - событие входного регистра счетчика
+        event_push(dev, 4, dev->counter % 32, data, 2, 0);
+    }
+}
+
+uint8_t event_marker(const sim_dev_t * dev)
+{
+    if (dev->queue_events == 0) {
+        return EVENT_MARKER_NONE;
+    }
+    if (dev->sent_high || dev->high_events) {
+        return EVENT_MARKER_HIGH;
+    }
+    return EVENT_MARKER_LOW;
+}
+
+// подтверждение пакета: устройство удаляет отправленные события из очереди
+void event_confirm(sim_dev_t * dev, uint8_t flag)
+{
+    if ((dev->sent_len == 0) || (dev->flag != flag)) {
+        return;
+    }
+    memmove(dev->queue, &dev->queue[dev->sent_len], dev->queue_len - dev->sent_len);
+    dev->queue_len -= dev->sent_len;
+    dev->queue_events -= dev->sent_events;
+    dev->high_events -= dev->sent_high;
+    if (dev->high_events < 0) {
+        dev->high_events = 0;
+    }
+    dev->sent_len = 0;
+    dev->sent_events = 0;
+    dev->sent_high = 0;
+}
+
+// пакет 0x11: неподтвержденный пакет отправляется повторно с тем же флагом,
+// при этом в него могут быть добавлены новые события
+int event_packet(sim_dev_t * dev, uint8_t event_limit, uint8_t * frame)
+{
+    if (dev->sent_len == 0) {
+        dev->flag ^= 1;
+    }
+
+    int len = dev->sent_len;
+    int events = dev->sent_events;
+    while (len < dev->queue_len) {
+        int e_len = 4 + dev->queue[len];
+        if (len + e_len > event_limit) {
+            break;
+        }
+        len += e_len;
+        events++;
+    }
+    dev->sent_len = len;
+    dev->sent_events = events;
+    dev->sent_high = dev->high_events < events ? dev->high_events : events;
+
+    frame[0] = dev->id;
+    frame[1] = SPECIAL_CMD;
+    frame[2] = CMD_EXT_EVENTS_RESP;
+    frame[3] = dev->flag;
+    frame[4] = dev->queue_events > 0xFF ? 0xFF : dev->queue_events;
+    frame[5] = len;
+    memcpy(&frame[6], dev->queue, len);
+    return 6 + len;
+}
+
+// обработка запросов
+
+void handle_scan(uint8_t ext_cmd, uint8_t sub_cmd, uint64_t req_end)
+{
+    uint8_t frame[16];
+    int legacy = (ext_cmd == SPECIAL_CMD_LEGACY);
+
+    if (sub_cmd == CMD_EXT_SCAN_START) {
+        for (int i = 0; i < dev_num; i++) {
+            devices[i].scanned = 0;
+        }
+    }
+
+    // побеждает устройство с наименьшим значением: сначала не отсканированные, среди них - с наименьшим серийным номером
+    sim_dev_t * winner = NULL;
+    uint32_t winner_value = 0;
+    for (int i = 0; i < dev_num; i++) {
+        uint32_t value = ((uint32_t)devices[i].scanned << 31) | (devices[i].serial & 0x7FFFFFFF);
+        if ((winner == NULL) || (value < winner_value)) {
+            winner = &devices[i];
+            winner_value = value;
+        }
+    }
+    if (winner == NULL) {
+        return;
+    }
+
+    frame[0] = SPECIAL_ADDRESS;
+    frame[1] = ext_cmd;
+    if (winner->scanned) {
+        frame[2] = CMD_EXT_SCAN_END;
+        sim_respond(req_end, winner_value, SCAN_ARBITRATION_BITS, legacy, frame, 3);
+    } else {
+        winner->scanned = 1;
+        frame[2] = CMD_EXT_SCAN_RESP;
+        u32_to_be_buf8(&frame[3], winner->serial);
+        frame[PAYLOAD_EXT_OFFSET] = winner->id;
+        sim_respond(req_end, winner_value, SCAN_ARBITRATION_BITS, legacy, frame, 8);
+    }
+}
+
+uint16_t read_register(const sim_dev_t * dev, uint16_t address, int * ok)
+{
+    *ok = 1;
+    if (address == HOLDREG_WB_SLAVE_ID) {
+        return dev->id;
+    }
+    if ((address >= 200) && (address < 220)) {
+        return (uint8_t)dev->model[address - 200];
+    }
+    if ((address >= 250) && (address < 266)) {
+        static const char fw[] = "1.2.3";
+        return (address - 250 < (int)sizeof(fw) - 1) ? fw[address - 250] : 0;
+    }
+    if ((address >= 290) && (address < 302)) {
+        static const char signature[] = "simdev";
+        return (address - 290 < (int)sizeof(signature) - 1) ? signature[address - 290] : 0;
+    }
+    if ((address >= 330) && (address < 337)) {
+        static const char bootloader[] = "1.0.0";
+        return (address - 330 < (int)sizeof(bootloader) - 1) ? bootloader[address - 330] : 0;
+    }
+    if (address < 200) {
+        return 0;
+    }
+    *ok = 0;
+    return 0;
+}
+
+void handle_std_pdu(uint8_t ext_cmd, const uint8_t * req, int req_len, uint64_t req_end)
+{
+    uint32_t serial = u32_from_be_buf8(&req[3]);
+    sim_dev_t * dev = NULL;
+    for (int i = 0; i < dev_num; i++) {
+        if (devices[i].serial == serial) {
+            dev = &devices[i];
+            break;
+        }
+    }
+    if (dev == NULL) {
+        return;
+    }
+
+    uint8_t frame[SIM_REQ_BUF_SIZE];
+    const uint8_t * pdu = &req[PAYLOAD_EXT_OFFSET];
+    uint8_t fc = pdu[0];
+    int len = PAYLOAD_EXT_OFFSET;
+
+    memcpy(frame, req, PAYLOAD_EXT_OFFSET);
+    frame[1] = ext_cmd;
+    frame[2] = CMD_EXT_STD_PDU_RESP;
+
+    uint16_t address = u16_from_be_buf8(&pdu[1]);
+    uint16_t count = u16_from_be_buf8(&pdu[3]);
+    int exception = 0;
+
+    switch (fc) {
+    case 0x01:
+    case 0x02:
+        if ((count == 0) || (count > 2000)) {
+            exception = 3;
+            break;
+        }
+        frame[len++] = fc;
+        frame[len++] = (count + 7) / 8;
+        memset(&frame[len], 0, (count + 7) / 8);
+        len += (count + 7) / 8;
+        break;
+
+    case 0x03:
+    case 0x04:
+        if ((count == 0) || (count > 125)) {
+            exception = 3;
+            break;
+        }
+        frame[len++] = fc;
+        frame[len++] = count * 2;
+        for (int i = 0; i < count; i++) {
+            int ok;
+            uint16_t value = read_register(dev, address + i, &ok);
+            // входные регистры 0..31 - счетчик событий устройства, меняется с событиями
+            if ((fc == 0x04) && (address + i < 32)) {
+                value = dev->counter;
+            }
+            if (!ok) {
+                exception = 2;
+                break;
+            }
+            u16_to_be_buf8(&frame[len], value);
+            len += 2;
+        }
+        break;
+
+    case 0x06:
+        if (address == HOLDREG_WB_SLAVE_ID) {
+            if ((count == 0) || (count > 247)) {
+                exception = 3;
+                break;
+            }
+            dev->id = count;
+        }
+        frame[len++] = fc;
+        memcpy(&frame[len], &pdu[1], 4);
+        len += 4;
+        break;
+
+    case 0x05:
+    case 0x0F:
+    case 0x10:
+        frame[len++] = fc;
+        memcpy(&frame[len], &pdu[1], 4);
+        len += 4;
+        break;
+
+    default:
+        exception = 1;
+        break;
+    }
+    (void)req_len;
+
+    if (exception) {
+        len = PAYLOAD_EXT_OFFSET;
+        frame[len++] = fc | MODBUS_EXCEPTION_FLAG;
+        frame[len++] = exception;
+    }
+
+    // устройство выбрано по серийному номеру, арбитража нет
+    sim_respond(req_end, 0, 0, ext_cmd == SPECIAL_CMD_LEGACY, frame, len);
+}
+
+void handle_events_req(const uint8_t * req, uint64_t req_end)
+{
+    uint8_t min_slave = req[3];
+    uint8_t event_limit = req[4];
+    uint8_t confirm_id = req[5];
+    uint8_t confirm_flag = req[6];
+
+    // подтверждение получают все устройства, даже не участвующие в арбитраже
+    for (int i = 0; i < dev_num; i++) {
+        if (devices[i].id == confirm_id) {
+            event_confirm(&devices[i], confirm_flag);
+        }
+    }
+
+    sim_dev_t * winner = NULL;
+    uint32_t winner_value = 0;
+    for (int i = 0; i < dev_num; i++) {
+        if (devices[i].id < min_slave) {
+            continue;
+        }
+        uint32_t value = ((uint32_t)event_marker(&devices[i]) << 8) | devices[i].id;
+        if ((winner == NULL) || (value < winner_value)) {
+            winner = &devices[i];
+            winner_value = value;
+        }
+    }
+    if (winner == NULL) {
+        return;
+    }
+
+    uint8_t frame[SIM_REQ_BUF_SIZE];
+    int len;
+    if (winner->queue_events == 0) {
+        frame[0] = SPECIAL_ADDRESS;
+        frame[1] = SPECIAL_CMD;
+        frame[2] = CMD_EXT_EVENTS_END;
+        len = 3;
+    } else {
+        len = event_packet(winner, event_limit, frame);
+    }
+    sim_respond(req_end, winner_value, EVENT_ARBITRATION_BITS, 0, frame, len);
+}
+
+void handle_events_ctrl(const uint8_t * req, uint64_t req_end)
+{
+    sim_dev_t * dev = NULL;
+    for (int i = 0; i < dev_num; i++) {
+        if (devices[i].id == req[0]) {
+            dev = &devices[i];
+            break;
+        }
+    }
+    if (dev == NULL) {
+        return;
+    }
+
+    uint8_t frame[SIM_REQ_BUF_SIZE];
+    int len = 4;
+    int settings_len = req[3];
+    const uint8_t * s = &req[4];
+
+    frame[0] = dev->id;
+    frame[1] = SPECIAL_CMD;
+    frame[2] = CMD_EXT_EVENTS_CTRL;
+
+    while (s + 4 <= &req[4 + settings_len]) {
+        uint8_t type = s[0];
+        uint16_t address = u16_from_be_buf8(&s[1]);
+        uint8_t count = s[3];
+        uint8_t mask = 0;
+
+        for (int i = 0; i < count; i++) {
+            uint8_t ctrl = s[4 + i];
+            int ok;
+            int supported = ((type >= 1) && (type <= 4) && (read_register(dev, address + i, &ok), ok)) ||
+                ((type == EVENT_TYPE_SYSTEM) && (address + i == EVENT_ID_POWER_ON));
+            if (supported) {
+                int found = 0;
+                for (int r = 0; r < dev->regs_num; r++) {
+                    if ((dev->regs[r].type == type) && (dev->regs[r].address == address + i)) {
+                        dev->regs[r].ctrl = ctrl;
+                        found = 1;
+                    }
+                }
+                if (!found && (dev->regs_num < SIM_EVENT_REGS_MAX)) {
+                    dev->regs[dev->regs_num].type = type;
+                    dev->regs[dev->regs_num].address = address + i;
+                    dev->regs[dev->regs_num].ctrl = ctrl;
+                    dev->regs_num++;
+                }
+                if (ctrl != EVENT_CTRL_DISABLED) {
+                    mask |= 1 << (i % 8);
+                }
+            }
+            if ((i % 8 == 7) || (i == count - 1)) {
+                frame[len++] = mask;
+                mask = 0;
+            }
+        }
+        s += 4 + count;
+    }
+
+    frame[3] = len - 4;
+    sim_respond(req_end, 0, 0, 0, frame, len);
+}
+
+// длина запроса по его началу: длина, 0 - нужно больше байт, -1 - не запрос
+int request_len(const uint8_t * buf, int len)
+{
+    if (len < 3) {
+        return 0;
+    }
+    if ((buf[1] != SPECIAL_CMD) && (buf[1] != SPECIAL_CMD_LEGACY)) {
+        return -1;
+    }
+
+    switch (buf[2]) {
+    case CMD_EXT_SCAN_START:
+    case CMD_EXT_SCAN_NEXT:
+        return 5;
+
+    case CMD_EXT_EVENTS_REQ:
+        return 9;
+
+    case CMD_EXT_EVENTS_CTRL:
+        if (len < 4) {
+            return 0;
+        }
+        return 4 + buf[3] + 2;
+
+    case CMD_EXT_STD_PDU_REQ:
+        if (len <= PAYLOAD_EXT_OFFSET) {
+            return 0;
+        }
+        if ((buf[PAYLOAD_EXT_OFFSET] == 0x0F) || (buf[PAYLOAD_EXT_OFFSET] == 0x10)) {
+            if (len <= PAYLOAD_EXT_OFFSET + 5) {
+                return 0;
+            }
+            return PAYLOAD_EXT_OFFSET + 6 + buf[PAYLOAD_EXT_OFFSET + 5] + 2;
+        }
+        return PAYLOAD_EXT_OFFSET + 5 + 2;
+
+    default:
+        return -1;
+    }
+}
+
+void handle_request(const uint8_t * req, int len, uint64_t req_end)
+{
+    if (debug) {
+        print_hb("    <-", (uint8_t *)req, len);
+    }
+
+    if (req[2] == CMD_EXT_EVENTS_CTRL) {
+        handle_events_ctrl(req, req_end);
+        return;
+    }
+
+    if (req[0] != SPECIAL_ADDRESS) {
+        return;
+    }
+
+    switch (req[2]) {
+    case CMD_EXT_SCAN_START:
+    case CMD_EXT_SCAN_NEXT:
+        handle_scan(req[1], req[2], req_end);
+        break;
+
+    case CMD_EXT_STD_PDU_REQ:
+        handle_std_pdu(req[1], req, len, req_end);
+        break;
+
+    case CMD_EXT_EVENTS_REQ:
+        if (req[1] == SPECIAL_CMD) {
+            handle_events_req(req, req_end);
+        }
+        break;
+    }
+}
+
+void init_devices(int num, int duplicates, uint32_t seed)
+{
+    srand(seed);
+    dev_num = num;
+
+    for (int i = 0; i < num; i++) {
+        sim_dev_t * dev = &devices[i];
+        memset(dev, 0, sizeof(*dev));
+
+        // уникальные серийные номера в пределах 28 бит
+        int unique;
+        do {
+            dev->serial = ((uint32_t)rand() << 8 ^ rand()) & 0x0FFFFFFF;
+            unique = (dev->serial != 0);
+            for (int j = 0; j < i; j++) {
+                if (devices[j].serial == dev->serial) {
+                    unique = 0;
+                }
+            }
+        } while (!unique);
+
+        // последние duplicates устройств получают адреса уже занятые другими
+        if ((i >= num - duplicates) && (i > 0)) {
+            dev->id = devices[rand() % (num - duplicates > 0 ? num - duplicates : 1)].id;
+        } else {
+            dev->id = i + 1;
+        }
+        snprintf(dev->model, sizeof(dev->model), "SIMDEV%d", i % 4);
+        dev->flag = 1;
+
+        uint8_t zero = 0;
+        event_push(dev, EVENT_TYPE_SYSTEM, EVENT_ID_POWER_ON, &zero, 0, 0);
+    }
+}
+
+int open_pty(const char * link_path)
+{
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master_fd < 0) || (grantpt(master_fd) != 0) || (unlockpt(master_fd) != 0)) {
+        printf("Error open pseudo terminal: %s\n", strerror(errno));
+        return -1;
+    }
+
+    const char * slave_path = ptsname(master_fd);
+
+    // держим подчиненную сторону открытой, чтобы терминал не закрывался между запусками утилиты
+    int slave_fd = open(slave_path, O_RDWR | O_NOCTTY);
+    struct termios t;
+    if ((slave_fd >= 0) && (tcgetattr(slave_fd, &t) == 0)) {
+        cfmakeraw(&t);
+        tcsetattr(slave_fd, TCSANOW, &t);
+    }
+
+    if (link_path) {
+        unlink(link_path);
+        if (symlink(slave_path, link_path) != 0) {
+            printf("Error create link %s: %s\n", link_path, strerror(errno));
+            return -1;
+        }
+    }
+
+    printf("Simulator port: %s\n", slave_path);
+    fflush(stdout);
+    return 0;
+}
+
+void print_help(const char * argv0)
+{
+    printf(
+        "Wirenboard modbus extension bus simulator. version: " VERSION "\n"
+        "Usage: %s [-n devices] [-b baud] [-r rate] [-D]\n"
+        "\n"
+        "Options:\n"
+        "    -n num         number of devices, default 10, max %d\n"
+        "    -u num         number of devices with repeated modbus id, default 0\n"
+        "    -b baud        baudrate used for bus timing, default 9600\n"
+        "    -c bits        bits per character on the line, default 11\n"
+        "    -r rate        generated events per second on the whole bus, default 0\n"
+        "    -B num         burst: once a second a random device queues num events at once, default 0\n"
+        "    -N prob        probability of response frame corruption, 0..1, default 0\n"
+        "    -S seed        random seed for serial numbers and events, default 1\n"
+        "    -f             fast mode: do not keep bus timing, respond immediately\n"
+        "    -l path        create symlink to the simulator port\n"
+        "    -D             debug mode\n"
+        "    -h             show help\n"
+        , argv0, SIM_DEVICES_MAX);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    int num = 10;
+    int duplicates = 0;
+    int baud = 9600;
+    int char_bits = 11;
+    double rate = 0;
+    int burst = 0;
+    unsigned seed = 1;
+    const char * link_path = NULL;
+
+    while ((c = getopt(argc, argv, "n:u:b:c:r:B:N:S:fl:Dh")) != -1) {
+        switch (c) {
+        case 'n':
+            sscanf(optarg, "%d", &num);
+            break;
+        case 'u':
+            sscanf(optarg, "%d", &duplicates);
+            break;
+        case 'b':
+            sscanf(optarg, "%d", &baud);
+            break;
+        case 'c':
+            sscanf(optarg, "%d", &char_bits);
+            break;
+        case 'r':
+            sscanf(optarg, "%lf", &rate);
+            break;
+        case 'B':
+            sscanf(optarg, "%d", &burst);
+            break;
+        case 'N':
+            sscanf(optarg, "%lf", &noise);
+            break;
+        case 'S':
+            sscanf(optarg, "%u", &seed);
+            break;
+        case 'f':
+            fast = 1;
+            break;
+        case 'l':
+            link_path = optarg;
+            break;
+        case 'D':
+            debug = 1;
+            break;
+        case 'h':
+            print_help(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            print_help(argv[0]);
+            return EXIT_INVALIDARGUMENT;
+        }
+    }
+
+    if ((num < 1) || (num > SIM_DEVICES_MAX) || (duplicates < 0) || (duplicates >= num) || (baud <= 0) || (char_bits < 7) || (burst < 0)) {
+        print_help(argv[0]);
+        return EXIT_INVALIDARGUMENT;
+    }
+
+    bus_timing_init(&timing, baud, char_bits, 0);
+    init_devices(num, duplicates, seed);
+
+    if (open_pty(link_path) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, stop_signal_handler);
+    signal(SIGTERM, stop_signal_handler);
+
+    uint8_t buf[SIM_REQ_BUF_SIZE];
+    int buf_len = 0;
+    uint64_t event_period = rate > 0 ? (uint64_t)(NSEC_PER_SEC / rate) : 0;
+    uint64_t next_event = bus_time_now_ns() + event_period;
+    uint64_t next_burst = bus_time_now_ns() + NSEC_PER_SEC;
+
+    while (!stop_request) {
+        int timeout_ms = -1;
+        if (event_period || burst) {
+            uint64_t now = bus_time_now_ns();
+            uint64_t next = next_burst;
+            if (event_period && (next_event < next)) {
+                next = next_event;
+            }
+            timeout_ms = next > now ? (next - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC : 0;
+        }
+
+        struct pollfd pfd = { .fd = master_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout_ms);
+
+        if (event_period) {
+            uint64_t now = bus_time_now_ns();
+            while (next_event <= now) {
+                event_generate(&devices[rand() % dev_num]);
+                next_event += event_period;
+            }
+        }
+
+        // пачка событий одного устройства - очередь длиннее одного пакета
+        if (burst && (bus_time_now_ns() >= next_burst)) {
+            sim_dev_t * dev = &devices[rand() % dev_num];
+            for (int i = 0; i < burst; i++) {
+                event_generate(dev);
+            }
+            next_burst += NSEC_PER_SEC;
+        }
+
+        if ((ready <= 0) || !(pfd.revents & POLLIN)) {
+            continue;
+        }
+
+        int rdlen = read(master_fd, &buf[buf_len], sizeof(buf) - buf_len);
+        if (rdlen <= 0) {
+            continue;
+        }
+        buf_len += rdlen;
+
+        // запрос считается переданным по шине целиком к моменту приема его последнего байта
+        uint64_t req_end = bus_time_now_ns();
+
+        while (buf_len > 0) {
+            int len = request_len(buf, buf_len);
+            if (len == 0) {
+                break;
+            }
+            if ((len < 0) || (len > (int)sizeof(buf)) || ((len <= buf_len) && (modbus_crc(buf, len) != 0))) {
+                memmove(buf, &buf[1], --buf_len);
+                continue;
+            }
+            if (len > buf_len) {
+                break;
+            }
+
+            handle_request(buf, len, req_end);
+            buf_len -= len;
+            memmove(buf, &buf[len], buf_len);
+        }
+        fflush(stdout);
+    }
+
+    if (link_path) {
+        unlink(link_path);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,987 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include "wbmbext.h"
+
+const wbmbext_dev_info_field_t wbmbext_dev_info_fields[DEV_INFO_FIELDS_NUM] = {
+    [DEV_INFO_MODEL] = { .name = "model", .address = 200, .len = 20 },
+    [DEV_INFO_FWVER] = { .name = "fw", .address = 250, .len = 16 },
+    [DEV_INFO_SIGNATURE] = { .name = "signature", .address = 290, .len = 12 },
+    [DEV_INFO_BOOTLOADER] = { .name = "bootloader", .address = 330, .len = 7 },
+};
+
+static inline void u16_to_be_buf8(uint8_t * buf, uint16_t value)
+{
+    buf[0] = (value >> 8) & 0xFF;
+    buf[1] = (value >> 0) & 0xFF;
+}
+
+static inline uint16_t u16_from_be_buf8(const uint8_t * buf)
+{
+    return (buf[0] << 8) + (buf[1] << 0);
+}
+
+static void lib_log(wbmbext_ctx_t * ctx, wbmbext_log_level_t level, const char * fmt, ...)
+{
+    if ((ctx->log_cb == NULL) || ((level == WBMBEXT_LOG_DEBUG) && !ctx->debug)) {
+        return;
+    }
+
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    ctx->log_cb(ctx->log_arg, level, msg);
+}
+
+// отладочный вывод кадра в виде "msg :  XX XX ..."
+static void log_frame(wbmbext_ctx_t * ctx, const char * msg, const uint8_t * b, int len)
+{
+    if ((ctx->log_cb == NULL) || !ctx->debug) {
+        return;
+    }
+
+    char line[32 + WBMBEXT_BUFFER_SIZE * 3];
+    int pos = snprintf(line, sizeof(line), "%s : ", msg);
+    for (int i = 0; (i < len) && (pos < (int)sizeof(line) - 4); i++) {
+        pos += snprintf(&line[pos], sizeof(line) - pos, " %02X", b[i]);
+    }
+    ctx->log_cb(ctx->log_arg, WBMBEXT_LOG_DEBUG, line);
+}
+
+void wbmbext_init(wbmbext_ctx_t * ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    frame_parser_reset(&ctx->rx_parser);
+    for (int t = 0; t < TXN_TYPES_NUM; t++) {
+        ctx->retries[t] = (t == TXN_OTHER) ? 0 : WBMBEXT_RETRIES_DEFAULT;
+    }
+}
+
+void wbmbext_set_log(wbmbext_ctx_t * ctx, wbmbext_log_cb_t cb, void * arg, int debug)
+{
+    ctx->log_cb = cb;
+    ctx->log_arg = arg;
+    ctx->debug = debug;
+}
+
+void wbmbext_set_capture(wbmbext_ctx_t * ctx, bus_capture_t * capture)
+{
+    ctx->capture = capture;
+}
+
+void wbmbext_set_retries(wbmbext_ctx_t * ctx, txn_type_t type, int retries)
+{
+    ctx->retries[type] = (retries < 0) ? 0 : (retries > 255) ? 255 : retries;
+}
+
+int wbmbext_open(wbmbext_ctx_t * ctx, const char * device)
+{
+    if (sp_get_port_by_name(device, &ctx->port) != SP_OK) {
+        lib_log(ctx, WBMBEXT_LOG_ERROR, "sp_get_port_by_name() failed!");
+        return WBMBEXT_ERR_IO;
+    }
+    if (sp_open(ctx->port, SP_MODE_READ_WRITE) != SP_OK) {
+        lib_log(ctx, WBMBEXT_LOG_ERROR, "sp_open() failed");
+        sp_free_port(ctx->port);
+        ctx->port = NULL;
+        return WBMBEXT_ERR_IO;
+    }
+
+    ctx->rx = malloc(sizeof(rx_thread_t));
+    if (ctx->rx && (rx_thread_start(ctx->rx, ctx->port) != 0)) {
+        free(ctx->rx);
+        ctx->rx = NULL;
+    }
+    if (ctx->rx == NULL) {
+        lib_log(ctx, WBMBEXT_LOG_DEBUG, "Receive thread is not started, port is read inline");
+    }
+    return WBMBEXT_OK;
+}
+
+void wbmbext_close(wbmbext_ctx_t * ctx)
+{
+    // поток приема читает порт до закрытия
+    if (ctx->rx) {
+        rx_thread_stop(ctx->rx);
+        free(ctx->rx);
+        ctx->rx = NULL;
+    }
+    if (ctx->port) {
+        sp_close(ctx->port);
+        sp_free_port(ctx->port);
+        ctx->port = NULL;
+    }
+}
+
+int wbmbext_baud_supported(int baud)
+{
+    static const int allowedBaudrates[] = { 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
+    for (unsigned int i = 0; i < (sizeof(allowedBaudrates) / sizeof(int)); i++) {
+        if (baud == allowedBaudrates[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parity_to_sp(char parity, enum sp_parity * sp_parity)
+{
+    switch (parity) {
+        case 'n':
+        case 'N':
+            *sp_parity = SP_PARITY_NONE;
+            break;
+
+        case 'e':
+        case 'E':
+            *sp_parity = SP_PARITY_EVEN;
+            break;
+
+        case 'o':
+        case 'O':
+            *sp_parity = SP_PARITY_ODD;
+            break;
+
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+int wbmbext_parity_supported(char parity)
+{
+    enum sp_parity sp_parity;
+    return parity_to_sp(parity, &sp_parity);
+}
+
+int wbmbext_configure(wbmbext_ctx_t * ctx, int baud, char parity, uint64_t timing_margin_ns)
+{
+    enum sp_parity sp_parity;
+
+    if (!wbmbext_baud_supported(baud) || !parity_to_sp(parity, &sp_parity)) {
+        return WBMBEXT_ERR_ARG;
+    }
+
+    if (sp_set_baudrate(ctx->port, baud) != SP_OK) {
+        lib_log(ctx, WBMBEXT_LOG_ERROR, "Error from sp_set_baudrate: %s", sp_last_error_message());
+        return WBMBEXT_ERR_IO;
+    }
+
+    if (sp_set_parity(ctx->port, sp_parity) != SP_OK) {
+        lib_log(ctx, WBMBEXT_LOG_ERROR, "Error from sp_set_parity: %s", sp_last_error_message());
+        return WBMBEXT_ERR_IO;
+    }
+
+    // длительность символа считаем по фактическому формату кадра порта
+    int data_bits = 8;
+    int stop_bits = (sp_parity == SP_PARITY_NONE) ? 2 : 1;
+    struct sp_port_config * config;
+    if (sp_new_config(&config) == SP_OK) {
+        if (sp_get_config(ctx->port, config) == SP_OK) {
+            sp_get_config_bits(config, &data_bits);
+            sp_get_config_stopbits(config, &stop_bits);
+        }
+        sp_free_config(config);
+    }
+    lib_log(ctx, WBMBEXT_LOG_DEBUG, "Using frame format %d%c%d", data_bits, parity, stop_bits);
+
+    bus_timing_init(&ctx->timing, baud, bus_char_bits(data_bits, sp_parity != SP_PARITY_NONE, stop_bits), timing_margin_ns);
+    if (ctx->capture) {
+        bus_capture_session(ctx->capture, bus_time_now_ns(), baud, ctx->timing.char_bits);
+    }
+
+    return WBMBEXT_OK;
+}
+
+void wbmbext_set_frame_gap(wbmbext_ctx_t * ctx, uint64_t gap_ns)
+{
+    ctx->timing.gap_ns = gap_ns;
+}
+
+void wbmbext_flush_input(wbmbext_ctx_t * ctx)
+{
+    sp_flush(ctx->port, SP_BUF_INPUT);
+    if (ctx->rx) {
+        rx_thread_discard(ctx->rx, bus_time_now_ns());
+    }
+    frame_parser_reset(&ctx->rx_parser);
+}
+
+// обмен
+
+// отправка кадра, подготовленного в tx_buf кодировщиком (вместе с CRC)
+static void send_frame(wbmbext_ctx_t * ctx, int len)
+{
+    uint8_t * tx_buf = ctx->tx_buf;
+
+    if (ctx->debug) {
+        char label[64];
+        snprintf(label, sizeof(label), "%s    ->", ctx->tx_label ? ctx->tx_label : "");
+        log_frame(ctx, label, tx_buf, len);
+    }
+    ctx->tx_label = NULL;
+
+    // пауза между кадрами отсчитывается от последней активности на шине, уже прошедшее время не ждем
+    bus_sleep_until_ns(ctx->timing.last_activity_ns + bus_frame_gap_ns(&ctx->timing));
+
+    // шина полудуплексная: все принятое до запроса к нему не относится
+    frame_parser_reset(&ctx->rx_parser);
+
+    // предыдущая транзакция без чтения ответа - ответ не ожидался
+    txn_end(&ctx->txn, &ctx->stats, TXN_RESULT_OK);
+
+    uint64_t tx_start = bus_time_now_ns();
+    txn_begin(&ctx->txn, txn_type_of_request(tx_buf, len), tx_start);
+    if (ctx->rx) {
+        rx_thread_discard(ctx->rx, tx_start);
+    }
+
+    int wlen = sp_nonblocking_write(ctx->port, tx_buf, len);
+    if (ctx->capture) {
+        bus_capture_chunk(ctx->capture, BUS_CAPTURE_TX, tx_start, tx_buf, len);
+    }
+    if (wlen != len) {
+        lib_log(ctx, WBMBEXT_LOG_ERROR, "Error from write: %d, %d", wlen, errno);
+    }
+
+    // ожидание фактического завершения асинхронной отправки: одно ожидание до расчетного момента,
+    // затем проверка, что драйвер действительно отдал все байты (если передача началась с задержкой)
+    uint64_t tx_end = tx_start + len * ctx->timing.char_ns;
+    bus_sleep_until_ns(tx_end);
+
+    int queued = sp_output_waiting(ctx->port);
+    if (queued > 0) {
+        tx_end = bus_time_now_ns() + queued * ctx->timing.char_ns;
+        bus_sleep_until_ns(tx_end);
+    }
+    bus_activity(&ctx->timing, tx_end);
+    txn_mark(&ctx->txn, TXN_TS_TX_DONE, tx_end);
+}
+
+// блокирующее ожидание данных из порта, не дольше чем до deadline_ns, в timestamp_ns - время приема
+// возвращает количество прочитанных байт, 0 если время истекло, < 0 при ошибке
+static int read_port_until(wbmbext_ctx_t * ctx, uint8_t * buf, int len, uint64_t deadline_ns, uint64_t * timestamp_ns)
+{
+    if (ctx->rx) {
+        return rx_thread_read(ctx->rx, buf, len, deadline_ns, timestamp_ns);
+    }
+
+    unsigned int timeout_ms = 0;        // 0 - ожидание без ограничения
+    int rdlen;
+
+    uint64_t now = bus_time_now_ns();
+    if ((deadline_ns != BUS_DEADLINE_NONE) && (now >= deadline_ns)) {
+        rdlen = sp_nonblocking_read(ctx->port, buf, len);
+    } else {
+        if (deadline_ns != BUS_DEADLINE_NONE) {
+            timeout_ms = (deadline_ns - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+        }
+        // возвращает управление сразу после прихода первых байт
+        rdlen = sp_blocking_read_next(ctx->port, buf, len, timeout_ms);
+    }
+    *timestamp_ns = bus_time_now_ns();
+    return rdlen;
+}
+
+/*
+    timeout_ns - допустимое время тишины на шине: до первого байта ответа и между байтами
+    возвращает длину принятого кадра или код ошибки
+
+    После кадра с ошибкой CRC прием продолжается: разборщик ищет кадр со следующего
+    байта, а ожидание сокращается до тишины 3.5 символа с запасом margin_ns - ответ на
+    запрос один, и если за поврежденным кадром ничего нет, ждать арбитража уже незачем.
+*/
+static int read_responce(wbmbext_ctx_t * ctx, uint8_t ** ptr, uint64_t timeout_ns)
+{
+    frame_parser_t * rx = &ctx->rx_parser;
+    uint64_t deadline_ns = BUS_DEADLINE_NONE;
+    int crc_error = 0;
+    uint64_t rx_ns = bus_time_now_ns();     // время приема последнего участка
+
+    if (timeout_ns != BUS_TIMEOUT_NONE) {
+        deadline_ns = rx_ns + timeout_ns;
+    }
+
+    rx->skipped = 0;
+
+    while (1) {
+        // сначала разбираем то, что осталось в буфере с прошлого приема
+        int len = frame_parser_next(rx, ptr);
+        if (len > 0) {
+            txn_mark(&ctx->txn, TXN_TS_FRAME, rx_ns);
+            txn_end(&ctx->txn, &ctx->stats, TXN_RESULT_OK);
+            if (crc_error) {
+                ctx->counters.resyncs++;
+            }
+            if (rx->skipped) {
+                lib_log(ctx, WBMBEXT_LOG_DEBUG, "    <- %u bytes before frame skipped", rx->skipped);
+            }
+            log_frame(ctx, "    <-", *ptr, len);
+            return len;
+        } else if (len == FRAME_CRC_ERROR) {
+            ctx->counters.crc_errors++;
+            lib_log(ctx, WBMBEXT_LOG_DEBUG, "    wrong crc, resync");
+            crc_error = 1;
+            if (timeout_ns != BUS_TIMEOUT_NONE) {
+                timeout_ns = bus_silence_ns(&ctx->timing) + ctx->timing.margin_ns;
+                deadline_ns = bus_time_now_ns() + timeout_ns;
+            }
+            continue;
+        }
+
+        int space;
+        uint8_t * wp = frame_parser_write_ptr(rx, &space);
+
+        uint64_t now;
+        int rdlen = read_port_until(ctx, wp, space, deadline_ns, &now);
+        if (rdlen > 0) {
+            rx_ns = now;
+            frame_parser_commit(rx, rdlen);
+            bus_activity(&ctx->timing, now);
+            if (ctx->capture) {
+                bus_capture_chunk(ctx->capture, BUS_CAPTURE_RX, now, wp, rdlen);
+            }
+
+            txn_mark(&ctx->txn, TXN_TS_RX_FIRST, now);
+            for (int i = 0; i < rdlen; i++) {
+                if (wp[i] != ARBITRATION_BYTE) {
+                    txn_mark(&ctx->txn, TXN_TS_RX_DATA, now);
+                    break;
+                }
+            }
+
+            // пока идет арбитраж или передача кадра, шина активна - продлеваем ожидание;
+            // тишина отсчитывается от приема участка, а не от момента, когда до него дошла очередь
+            if (timeout_ns != BUS_TIMEOUT_NONE) {
+                deadline_ns = now + timeout_ns;
+            }
+        } else if (rdlen < 0) {
+            txn_end(&ctx->txn, &ctx->stats, TXN_RESULT_ERROR);
+            lib_log(ctx, WBMBEXT_LOG_ERROR, "Error from read: %d: %s", rdlen, strerror(errno));
+            return WBMBEXT_ERR_IO;
+        } else if (bus_time_now_ns() >= deadline_ns) {
+            if (rx->frame_len) {
+                log_frame(ctx, "    <- (incomplete)", rx->frame, rx->frame_len);
+            }
+            if (crc_error) {
+                txn_end(&ctx->txn, &ctx->stats, TXN_RESULT_ERROR);
+                lib_log(ctx, WBMBEXT_LOG_DEBUG, "    wrong crc");
+                return WBMBEXT_ERR_CRC;
+            }
+            ctx->counters.timeouts++;
+            lib_log(ctx, WBMBEXT_LOG_DEBUG, "    timeout");
+            txn_end(&ctx->txn, &ctx->stats, TXN_RESULT_TIMEOUT);
+            return WBMBEXT_ERR_TIMEOUT;
+        }
+    }
+}
+
+static int frame_error(wbmbext_ctx_t * ctx)
+{
+    ctx->counters.frame_errors++;
+    return WBMBEXT_ERR_FRAME;
+}
+
+// после ошибки приема: 1 - повторить запрос, 0 - вернуть ошибку
+static int retry_needed(wbmbext_ctx_t * ctx, int res, int attempt)
+{
+    if ((res != WBMBEXT_ERR_CRC) && (res != WBMBEXT_ERR_FRAME) && (res != WBMBEXT_ERR_TIMEOUT)) {
+        return 0;
+    }
+    if (attempt >= ctx->retries[ctx->txn.type]) {
+        if (res == WBMBEXT_ERR_CRC) {
+            lib_log(ctx, WBMBEXT_LOG_ERROR, "error: wrong crc");
+        }
+        return 0;
+    }
+
+    // остаток испорченного ответа не должен попасть в разбор ответа на повтор
+    wbmbext_flush_input(ctx);
+    ctx->counters.retries++;
+    lib_log(ctx, WBMBEXT_LOG_DEBUG, "    retry %d", attempt + 1);
+    return 1;
+}
+
+// разбор принятого кадра по типу ответа: WBMBEXT_OK или код ошибки, результат разбора - в resp
+typedef int (*check_resp_t)(wbmbext_ctx_t * ctx, const frame_view_t * v, const void * arg, void * resp);
+
+/*
+    Транзакция из одного запроса, подготовленного в tx_buf, и одного ответа
+
+    Ответ с ошибкой CRC, не прошедший проверку длины или check (WBMBEXT_ERR_FRAME)
+    или отсутствие ответа приводят к повтору того же кадра по политике типа запроса.
+    Исключение modbus и ошибки порта не повторяются. Возвращает длину кадра ответа
+    или код ошибки.
+*/
+static int transact(wbmbext_ctx_t * ctx, int frame_len, uint64_t timeout_ns, check_resp_t check, const void * arg, void * resp)
+{
+    const char * label = ctx->tx_label;
+
+    for (int attempt = 0; ; attempt++) {
+        ctx->tx_label = label;
+        send_frame(ctx, frame_len);
+
+        uint8_t * r;
+        frame_view_t v;
+        int len = read_responce(ctx, &r, timeout_ns);
+        if (len >= 0) {
+            int res = (frame_decode(r, len, &v) == 0) ? check(ctx, &v, arg, resp) : frame_error(ctx);
+            if (res == WBMBEXT_OK) {
+                return len;
+            }
+            len = res;
+        }
+        if (!retry_needed(ctx, len, attempt)) {
+            return len;
+        }
+    }
+}
+
+// таймаут ответа на запросы, адресованные по серийному номеру и при сканировании
+static uint64_t scan_timeout_ns(const wbmbext_ctx_t * ctx, uint8_t ext_cmd)
+{
+    return bus_response_timeout_ns(&ctx->timing, ARBITRATION_WINDOWS_SCAN, ext_cmd == SPECIAL_CMD_LEGACY);
+}
+
+// запрос PDU по серийному номеру: что должно прийти в ответе
+typedef struct {
+    uint32_t serial;
+    uint8_t fc;
+    int data_len;               // для чтения - сколько байт данных запрошено
+} pdu_req_t;
+
+// ответ на PDU по серийному номеру: тот же серийный номер и функция
+static int check_pdu_resp(wbmbext_ctx_t * ctx, const frame_view_t * v, const void * arg, void * resp)
+{
+    const pdu_req_t * req = arg;
+    frame_pdu_resp_t * pdu = resp;
+
+    // разбор кадра при приеме уже проверил что команда или 0x60 или 0x46
+    if ((v->slave_id != SPECIAL_ADDRESS) || (frame_decode_pdu_resp(v, pdu) != 0)) {
+        lib_log(ctx, WBMBEXT_LOG_ERROR, "error: received frame have not pdu sub cmd");
+        return frame_error(ctx);
+    }
+    if ((pdu->serial != req->serial) || (pdu->fc != req->fc)) {
+        return frame_error(ctx);
+    }
+    if (pdu->exception) {
+        ctx->last_exception = pdu->exception;
+        lib_log(ctx, WBMBEXT_LOG_DEBUG, "    read error: exception %d", ctx->last_exception);
+        return WBMBEXT_ERR_EXCEPTION;
+    }
+
+    // чтение: данных не меньше, чем запрошено
+    if (pdu->data_len < req->data_len) {
+        lib_log(ctx, WBMBEXT_LOG_ERROR, "error: received frame too short");
+        return frame_error(ctx);
+    }
+    return WBMBEXT_OK;
+}
+
+// запрос стандартного PDU по серийному номеру, подготовленный в tx_buf; повторяется тем же чтением или записью
+static int special_pdu(wbmbext_ctx_t * ctx, uint8_t ext_cmd, int frame_len, const pdu_req_t * req, frame_pdu_resp_t * pdu)
+{
+    return transact(ctx, frame_len, scan_timeout_ns(ctx, ext_cmd), check_pdu_resp, req, pdu);
+}
+
+// сканирование
+
+int wbmbext_scan(wbmbext_ctx_t * ctx, uint8_t ext_cmd, dev_info_t * devices, int max, int * complete)
+{
+    int dn = 0;
+    int scan_init = 1;
+    int passes = 0;
+    int pass_errors = 0;
+
+    *complete = 0;
+
+    while (1) {
+        int was_init = scan_init;
+        if (scan_init) {
+            ctx->tx_label = "    send SCAN INIT";
+            send_frame(ctx, frame_encode_scan(ctx->tx_buf, ext_cmd, CMD_EXT_SCAN_START));
+            scan_init = 0;
+            pass_errors = 0;
+            passes++;
+        } else {
+            ctx->tx_label = "    send SCAN NEXT";
+            send_frame(ctx, frame_encode_scan(ctx->tx_buf, ext_cmd, CMD_EXT_SCAN_NEXT));
+        }
+
+        uint8_t * r;
+        frame_view_t v;
+        frame_scan_resp_t dev;
+        int len = read_responce(ctx, &r, scan_timeout_ns(ctx, ext_cmd));
+
+        // по протоколу устройства отвечают 0x04, тишина после SCAN INIT - на шине нет устройств с такими настройками
+        if ((len == WBMBEXT_ERR_TIMEOUT) && was_init && (ctx->txn.ts[TXN_TS_RX_FIRST] == 0)) {
+            return dn;
+        }
+        if ((len >= 0) && (frame_decode(r, len, &v) != 0)) {
+            lib_log(ctx, WBMBEXT_LOG_ERROR, "ERROR: scan responce len %d", len);
+            len = frame_error(ctx);
+        } else if ((len >= 0) && (v.cmd != CMD_EXT_SCAN_END) && (frame_decode_scan_resp(&v, &dev) != 0)) {
+            lib_log(ctx, WBMBEXT_LOG_ERROR, "ERROR: responce type %d", v.cmd);
+            len = frame_error(ctx);
+        }
+        if (len == WBMBEXT_ERR_IO) {
+            return dn;
+        }
+
+        // испорченный ответ: устройство уже отметило себя найденным, проход продолжается
+        // со следующего, а потерянное устройство найдет следующий проход
+        if ((len == WBMBEXT_ERR_CRC) || (len == WBMBEXT_ERR_FRAME)) {
+            pass_errors++;
+            continue;
+        }
+
+        // конец прохода: 0x04 или ответ 0x04 потерян целиком
+        if ((len == WBMBEXT_ERR_TIMEOUT) || (v.cmd == CMD_EXT_SCAN_END)) {
+            *complete = (len >= 0);
+            if ((len >= 0) && (pass_errors == 0)) {
+                return dn;
+            }
+            if (passes > ctx->retries[TXN_SCAN_INIT]) {
+                lib_log(ctx, WBMBEXT_LOG_ERROR, "ERROR: scan errors in %d passes", passes);
+                return dn;
+            }
+            ctx->counters.scan_restarts++;
+            lib_log(ctx, WBMBEXT_LOG_DEBUG, "    scan pass %d: %d errors, rescan", passes, pass_errors);
+            wbmbext_flush_input(ctx);
+            scan_init = 1;
+            continue;
+        }
+
+        // следующий проход находит уже найденные устройства снова
+        int known = 0;
+        for (int i = 0; i < dn; i++) {
+            if (devices[i].serial == dev.serial) {
+                devices[i].id = dev.id;
+                known = 1;
+            }
+        }
+        if (known) {
+            continue;
+        }
+
+        if (dn == max) {
+            lib_log(ctx, WBMBEXT_LOG_ERROR, "ERROR: too many devices, max %d", max);
+            return dn;
+        }
+
+        memset(&devices[dn], 0, sizeof(devices[dn]));
+        devices[dn].serial = dev.serial;
+        devices[dn].id = dev.id;
+        dn++;
+    }
+}
+
+// обращение по серийному номеру
+
+int wbmbext_read_regs(wbmbext_ctx_t * ctx, uint8_t ext_cmd, uint32_t serial, uint8_t fc,
+    uint16_t address, uint16_t count, uint16_t * values)
+{
+    int bits = (fc == 0x01) || (fc == 0x02);
+
+    if ((fc < 0x01) || (fc > 0x04) || (count == 0) || (count > (bits ? WBMBEXT_READ_REGS_MAX * 16 : WBMBEXT_READ_REGS_MAX))) {
+        return WBMBEXT_ERR_ARG;
+    }
+
+    pdu_req_t req = { .serial = serial, .fc = fc, .data_len = bits ? (count + 7) / 8 : count * 2 };
+    frame_pdu_resp_t pdu;
+    int len = special_pdu(ctx, ext_cmd, frame_encode_read_regs(ctx->tx_buf, ext_cmd, serial, fc, address, count), &req, &pdu);
+    if (len < 0) {
+        return len;
+    }
+
+    const uint8_t * data = pdu.data;
+    for (int i = 0; i < count; i++) {
+        values[i] = bits ? (data[i / 8] >> (i % 8)) & 1 : u16_from_be_buf8(&data[i * 2]);
+    }
+    return WBMBEXT_OK;
+}
+
+int wbmbext_read_dev_info(wbmbext_ctx_t * ctx, uint8_t ext_cmd, dev_info_t * dev, unsigned mask)
+{
+    const wbmbext_dev_info_field_t * fields = wbmbext_dev_info_fields;
+    int requests = 0;
+    unsigned left = mask;
+
+    while (left) {
+        // диапазон начинается с поля с наименьшим адресом и поглощает соседние и пересекающиеся
+        int first = -1;
+        for (int i = 0; i < DEV_INFO_FIELDS_NUM; i++) {
+            if ((left & (1 << i)) && ((first < 0) || (fields[i].address < fields[first].address))) {
+                first = i;
+            }
+        }
+
+        uint16_t start = fields[first].address;
+        uint16_t end = start + fields[first].len;
+        unsigned block = 1 << first;
+        int merged = 1;
+
+        while (merged) {
+            merged = 0;
+            for (int i = 0; i < DEV_INFO_FIELDS_NUM; i++) {
+                uint16_t f_start = fields[i].address;
+                uint16_t f_end = f_start + fields[i].len;
+                if (!(left & ~block & (1 << i)) || (f_start > end) || (f_end < start)) {
+                    continue;
+                }
+                uint16_t new_start = f_start < start ? f_start : start;
+                uint16_t new_end = f_end > end ? f_end : end;
+                if (new_end - new_start > WBMBEXT_READ_REGS_MAX) {
+                    continue;
+                }
+                start = new_start;
+                end = new_end;
+                block |= 1 << i;
+                merged = 1;
+            }
+        }
+        left &= ~block;
+
+        lib_log(ctx, WBMBEXT_LOG_DEBUG, "    read DEVICE INFO regs %d..%d", start, end - 1);
+        requests++;
+
+        uint16_t regs[WBMBEXT_READ_REGS_MAX];
+        if (wbmbext_read_regs(ctx, ext_cmd, dev->serial, 0x03, start, end - start, regs) != WBMBEXT_OK) {
+            continue;
+        }
+
+        // строка - по символу в младшем байте регистра
+        for (int i = 0; i < DEV_INFO_FIELDS_NUM; i++) {
+            if (block & (1 << i)) {
+                for (int c = 0; c < fields[i].len; c++) {
+                    dev->info[i][c] = (char)(regs[fields[i].address - start + c] & 0xFF);
+                }
+                dev->info_mask |= 1 << i;
+            }
+        }
+    }
+    return requests;
+}
+
+int wbmbext_write_reg(wbmbext_ctx_t * ctx, uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t value)
+{
+    pdu_req_t req = { .serial = serial, .fc = 0x06 };       // write single holding register
+    frame_pdu_resp_t pdu;
+    int len = special_pdu(ctx, ext_cmd, frame_encode_write_reg(ctx->tx_buf, ext_cmd, serial, address, value), &req, &pdu);
+    return len < 0 ? len : WBMBEXT_OK;
+}
+
+int wbmbext_change_id(wbmbext_ctx_t * ctx, uint8_t ext_cmd, uint32_t serial, uint8_t new_id)
+{
+    if ((new_id == 0) || (new_id > 247)) {
+        return WBMBEXT_ERR_ARG;
+    }
+    return wbmbext_write_reg(ctx, ext_cmd, serial, HOLDREG_WB_SLAVE_ID, new_id);
+}
+
+int wbmbext_read_id(wbmbext_ctx_t * ctx, uint8_t ext_cmd, uint32_t serial, uint8_t * id)
+{
+    uint16_t value;
+    int res = wbmbext_read_regs(ctx, ext_cmd, serial, 0x03, HOLDREG_WB_SLAVE_ID, 1, &value);
+    if (res == WBMBEXT_OK) {
+        *id = value;
+    }
+    return res;
+}
+
+int wbmbext_plan_ids(const dev_info_t * devices, int num, int reserved_min, int reserved_max, uint8_t * new_ids)
+{
+    uint8_t used[WBMBEXT_ID_MAX + 1] = {0};
+    int changes = 0;
+
+    // сначала занимаем адреса, которые остаются: повторы решаются в пользу первого в списке
+    for (int i = 0; i < num; i++) {
+        uint8_t id = devices[i].id;
+        new_ids[i] = 0;
+        if ((id < WBMBEXT_ID_MIN) || (id > WBMBEXT_ID_MAX) || used[id]) {
+            new_ids[i] = 1;     // отметка: адрес нужно сменить
+        } else {
+            used[id] = 1;
+        }
+    }
+
+    int next = WBMBEXT_ID_MIN;
+    for (int i = 0; i < num; i++) {
+        if (!new_ids[i]) {
+            continue;
+        }
+        while ((next <= WBMBEXT_ID_MAX) && (used[next] || ((next >= reserved_min) && (next <= reserved_max)))) {
+            next++;
+        }
+        if (next > WBMBEXT_ID_MAX) {
+            return WBMBEXT_ERR_ARG;
+        }
+        used[next] = 1;
+        new_ids[i] = next;
+        changes++;
+    }
+    return changes;
+}
+
+// события
+
+static int check_event_resp(wbmbext_ctx_t * ctx, const frame_view_t * v, const void * arg, void * resp)
+{
+    (void)arg;
+
+    if (frame_decode_event_resp(v, resp) != 0) {
+        lib_log(ctx, WBMBEXT_LOG_ERROR, "event wrong cmd %02X", v->cmd);
+        return frame_error(ctx);
+    }
+    return WBMBEXT_OK;
+}
+
+int wbmbext_event_request(wbmbext_ctx_t * ctx, uint8_t min_slave, uint8_t max_event_len,
+    uint8_t confirm_slave_id, uint8_t flag, struct ext_modbus_event_resp ** resp)
+{
+    // повтор идет с тем же подтверждением: если устройство его получило, а ответ потерян,
+    // следующий пакет придет с другим флагом, иначе устройство повторит неподтвержденный
+    ctx->tx_label = "    send EVENT GET";
+    return transact(ctx, frame_encode_event_req(ctx->tx_buf, min_slave, max_event_len, confirm_slave_id, flag),
+        bus_response_timeout_ns(&ctx->timing, ARBITRATION_WINDOWS_EVENTS, 0), check_event_resp, NULL, resp);
+}
+
+int wbmbext_event_next(const struct ext_modbus_event_resp * resp, unsigned * index, const event_in_buffer_t ** e)
+{
+    unsigned event_len = resp->data_len;
+
+    if (*index + sizeof(event_in_buffer_t) > event_len) {
+        return 0;
+    }
+    const event_in_buffer_t * ev = (const event_in_buffer_t *)&resp->data[*index];
+    if (*index + sizeof(event_in_buffer_t) + ev->len > event_len) {
+        return WBMBEXT_ERR_FRAME;
+    }
+    *index += sizeof(event_in_buffer_t) + ev->len;
+    *e = ev;
+    return 1;
+}
+
+void wbmbext_event_packets_init(wbmbext_event_packet_t * packets, int num)
+{
+    for (int i = 0; i < num; i++) {
+        packets[i].flag = -1;
+        packets[i].data_len = 0;
+    }
+}
+
+unsigned wbmbext_event_skip_len(const wbmbext_event_packet_t * last, const struct ext_modbus_event_resp * resp)
+{
+    if ((last->flag == resp->flag) && (resp->data_len >= last->data_len) &&
+        (memcmp(resp->data, last->data, last->data_len) == 0)) {
+        return last->data_len;
+    }
+    return 0;
+}
+
+void wbmbext_event_packet_save(wbmbext_event_packet_t * last, const struct ext_modbus_event_resp * resp)
+{
+    last->flag = resp->flag;
+    last->data_len = resp->data_len;
+    memcpy(last->data, resp->data, resp->data_len);
+}
+
+// длительность цикла без данных событий: пауза, запрос 0x10, арбитраж по 12 битам, заголовок и CRC ответа
+#define EVENT_RESP_OVERHEAD_LEN     8
+#define EVENT_ARBITRATION_BITS      12
+
+void wbmbext_event_sched_init(wbmbext_event_sched_t * sched, const wbmbext_ctx_t * ctx, uint64_t target_cycle_ns,
+    uint8_t max_event_len, uint8_t base_min_slave)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->max_event_len = max_event_len;
+    sched->base_min_slave = base_min_slave;
+    sched->min_slave = base_min_slave;
+    sched->streak_limit = WBMBEXT_EVENT_STREAK_LIMIT;
+
+    if (target_cycle_ns) {
+        const bus_timing_t * t = &ctx->timing;
+        uint64_t fixed_ns = bus_frame_gap_ns(t) + (FRAME_EVENT_REQ_LEN + EVENT_RESP_OVERHEAD_LEN) * t->char_ns +
+            bus_response_timeout_ns(t, EVENT_ARBITRATION_BITS, 0) - t->margin_ns;
+        uint64_t len = (target_cycle_ns > fixed_ns) ? (target_cycle_ns - fixed_ns) / t->char_ns : 0;
+
+        if (len < WBMBEXT_EVENT_LEN_MIN) {
+            len = WBMBEXT_EVENT_LEN_MIN;
+        }
+        if (len < sched->max_event_len) {
+            sched->max_event_len = len;
+        }
+    }
+}
+
+static void event_sched_restart(wbmbext_event_sched_t * sched)
+{
+    sched->min_slave = sched->base_min_slave;
+    sched->sweep = 0;
+    sched->streak = 0;
+}
+
+void wbmbext_event_sched_update(wbmbext_event_sched_t * sched, int len, const struct ext_modbus_event_resp * resp)
+{
+    if (len == WBMBEXT_ERR_TIMEOUT) {
+        // за min_slave никто не ответил - событий у устройств с большими адресами нет
+        event_sched_restart(sched);
+        return;
+    }
+    if (len < 0) {
+        return;
+    }
+
+    if (resp->sub_cmd == CMD_EXT_EVENTS_END) {
+        event_sched_restart(sched);
+        return;
+    }
+    if (resp->sub_cmd != CMD_EXT_EVENTS_RESP) {
+        return;
+    }
+
+    if (!sched->sweep) {
+        sched->streak++;
+        if (sched->streak < sched->streak_limit) {
+            return;
+        }
+        sched->sweep = 1;
+        sched->rotations++;
+    }
+
+    // в обходе каждое устройство отдает один пакет
+    if (resp->slave_id < WBMBEXT_ID_MAX) {
+        sched->min_slave = resp->slave_id + 1;
+    } else {
+        event_sched_restart(sched);
+    }
+}
+
+#define EVENT_CTRL_HEADER_LEN       FRAME_EVENT_CTRL_HEADER_LEN
+#define EVENT_CTRL_RANGE_HEADER_LEN 4       // тип, адрес, количество регистров
+#define EVENT_CTRL_SETTINGS_MAX     (256 - EVENT_CTRL_HEADER_LEN - 2)
+#define EVENT_CTRL_RANGES_MAX       (EVENT_CTRL_SETTINGS_MAX / (EVENT_CTRL_RANGE_HEADER_LEN + 1) + 1)
+
+static int event_setting_cmp(const void * a, const void * b)
+{
+    const wbmbext_event_setting_t * sa = a;
+    const wbmbext_event_setting_t * sb = b;
+    if (sa->type != sb->type) {
+        return sa->type - sb->type;
+    }
+    return sa->address - sb->address;
+}
+
+// длина диапазона соседних регистров одного типа, начиная с settings[0]
+static int event_range_len(const wbmbext_event_setting_t * settings, int num)
+{
+    int n = 1;
+    while ((n < num) && (n < 0xFF) && (settings[n].type == settings[0].type) &&
+        (settings[n].address == settings[n - 1].address + 1)) {
+        n++;
+    }
+    return n;
+}
+
+// ответ на настройку событий от того же устройства с масками всех диапазонов
+static int check_event_ctrl_resp(wbmbext_ctx_t * ctx, const frame_view_t * v, const void * arg, void * resp)
+{
+    const uint8_t * slave_id = arg;
+    frame_event_ctrl_resp_t * ctrl = resp;
+
+    if ((frame_decode_event_ctrl_resp(v, ctrl) != 0) || (ctrl->slave_id != *slave_id)) {
+        return frame_error(ctx);
+    }
+    return WBMBEXT_OK;
+}
+
+int wbmbext_event_setup(wbmbext_ctx_t * ctx, uint8_t slave_id, wbmbext_event_setting_t * settings, int num, int * frames)
+{
+    int matched = 0;
+    int sent = 0;
+    int first = 0;
+
+    qsort(settings, num, sizeof(settings[0]), event_setting_cmp);
+
+    while (first < num) {
+        uint8_t * tx_buf = ctx->tx_buf;
+        int pos = EVENT_CTRL_HEADER_LEN;
+        int last = first;
+        uint8_t range_len[EVENT_CTRL_RANGES_MAX];
+        int ranges = 0;
+
+        // диапазон, не поместившийся в кадр целиком, делится: остаток уйдет в следующем кадре
+        while (last < num) {
+            int space = EVENT_CTRL_SETTINGS_MAX - (pos - EVENT_CTRL_HEADER_LEN) - EVENT_CTRL_RANGE_HEADER_LEN;
+            if (space <= 0) {
+                break;
+            }
+            int n = event_range_len(&settings[last], num - last);
+            if (n > space) {
+                n = space;
+            }
+
+            tx_buf[pos] = settings[last].type;
+            u16_to_be_buf8(&tx_buf[pos + 1], settings[last].address);
+            tx_buf[pos + 3] = n;
+            range_len[ranges++] = n;
+            pos += EVENT_CTRL_RANGE_HEADER_LEN;
+            for (int i = 0; i < n; i++) {
+                tx_buf[pos++] = settings[last + i].ctrl;
+                settings[last + i].enabled = 0;
+                settings[last + i].done = 0;
+            }
+            last += n;
+        }
+        ctx->tx_label = "    send EVENT CTRL";
+        sent++;
+
+        frame_event_ctrl_resp_t ctrl;
+        // ответ идет без арбитража, но время обработки конфигурации устройством не нормировано - берем самый длинный таймаут;
+        // повтор безопасен: устройство просто применит те же настройки еще раз
+        int len = transact(ctx, frame_encode_event_ctrl(tx_buf, slave_id, pos - EVENT_CTRL_HEADER_LEN),
+            bus_response_timeout_ns(&ctx->timing, ARBITRATION_WINDOWS_SCAN, 0), check_event_ctrl_resp, &slave_id, &ctrl);
+        if (len < 0) {
+            matched = len;
+            break;
+        }
+
+        // маски идут блоками по диапазонам запроса, биты от младшего к старшему
+        const uint8_t * mask = ctrl.mask;
+        int mask_len = ctrl.mask_len;
+        int mpos = 0;
+        int i = first;
+        for (int range = 0; range < ranges; range++) {
+            int n = range_len[range];
+            for (int k = 0; k < n; k++) {
+                wbmbext_event_setting_t * st = &settings[i + k];
+                int byte = mpos + k / 8;
+                st->enabled = (byte < mask_len) ? (mask[byte] >> (k % 8)) & 1 : 0;
+                st->done = 1;
+                if (st->enabled == (st->ctrl != WBMBEXT_EVENT_CTRL_DISABLED)) {
+                    matched++;
+                }
+            }
+            mpos += (n + 7) / 8;
+            i += n;
+        }
+
+        first = last;
+    }
+
+    if (frames) {
+        *frames = sent;
+    }
+    return matched;
+}
+
+int wbmbext_event_ctrl(wbmbext_ctx_t * ctx, uint8_t slave_id, uint8_t type, uint16_t address, uint8_t ctrl)
+{
+    wbmbext_event_setting_t setting = { .type = type, .address = address, .ctrl = ctrl };
+    int res = wbmbext_event_setup(ctx, slave_id, &setting, 1, NULL);
+    return res < 0 ? res : WBMBEXT_OK;
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <stdint.h>
+#include <libserialport.h>
+#include "bus_timing.h"
+#include "frame_parser.h"
+#include "frame_codec.h"
+#include "txn_stats.h"
+#include "bus_capture.h"
+#include "rx_thread.h"
+#include "dev_info.h"
+#include "modbus_ext.h"
+
+/*
+    libwbmodbusext - работа с устройствами по расширению протокола modbus Wiren Board
+
+    Все состояние шины хранится в контексте wbmbext_ctx_t, глобальных переменных нет:
+    в одном процессе можно работать с несколькими шинами, по контексту на шину.
+    Один контекст не должен использоваться из нескольких потоков одновременно.
+    Открытый порт читает отдельный поток приема (см. rx_thread.h), он скрыт в контексте.
+
+    Функции ничего не печатают: результат возвращается в структурах, ошибки - кодами
+    WBMBEXT_ERR_*, текст ошибок и отладочный вывод кадров передаются в обработчик log_cb.
+*/
+
+#define WBMBEXT_OK                  0
+#define WBMBEXT_ERR_TIMEOUT         (-1)    // нет ответа за таймаут протокола
+#define WBMBEXT_ERR_CRC             (-2)
+#define WBMBEXT_ERR_IO              (-3)    // ошибка порта
+#define WBMBEXT_ERR_FRAME           (-4)    // неожиданный ответ
+#define WBMBEXT_ERR_EXCEPTION       (-5)    // устройство ответило modbus исключением, код в last_exception
+#define WBMBEXT_ERR_ARG             (-6)
+
+#define WBMBEXT_BUFFER_SIZE         512
+
+// повторов запроса после ошибки приема по умолчанию (см. wbmbext_set_retries)
+#define WBMBEXT_RETRIES_DEFAULT     2
+
+// ограничение длины кадра 256 байт: ответ 0x09 на чтение N регистров занимает 7 + 2 + 2 * N + 2 байт
+#define WBMBEXT_READ_REGS_MAX       122
+
+typedef enum {
+    WBMBEXT_LOG_ERROR,
+    WBMBEXT_LOG_DEBUG,              // кадры и ход обмена, передается только если включен debug
+} wbmbext_log_level_t;
+
+typedef void (*wbmbext_log_cb_t)(void * arg, wbmbext_log_level_t level, const char * msg);
+
+// ошибки приема и восстановление после них, с момента wbmbext_init
+typedef struct {
+    uint32_t crc_errors;
+    uint32_t frame_errors;          // неожиданный или обрезанный ответ
+    uint32_t timeouts;
+    uint32_t retries;               // повторы запросов
+    uint32_t scan_restarts;         // сканирования, начатые заново с SCAN INIT
+    uint32_t resyncs;               // кадр найден в том же приеме после кадра с ошибкой CRC
+} wbmbext_counters_t;
+
+typedef struct {
+    struct sp_port * port;
+    rx_thread_t * rx;               // поток приема, NULL - порт читается напрямую
+    bus_timing_t timing;
+    frame_parser_t rx_parser;
+    uint8_t tx_buf[WBMBEXT_BUFFER_SIZE];
+    const char * tx_label;          // название запроса для отладочного вывода
+
+    txn_t txn;
+    txn_stats_t stats;              // задержки транзакций
+    wbmbext_counters_t counters;
+    uint8_t retries[TXN_TYPES_NUM]; // повторов после ошибки по типу запроса
+    bus_capture_t * capture;        // запись обмена, NULL - не пишется
+
+    int debug;
+    wbmbext_log_cb_t log_cb;
+    void * log_arg;
+
+    uint8_t last_exception;
+} wbmbext_ctx_t;
+
+// описание строкового поля информации об устройстве: один символ в младшем байте регистра
+typedef struct {
+    const char * name;
+    uint16_t address;
+    uint8_t len;
+} wbmbext_dev_info_field_t;
+
+extern const wbmbext_dev_info_field_t wbmbext_dev_info_fields[DEV_INFO_FIELDS_NUM];
+
+void wbmbext_init(wbmbext_ctx_t * ctx);
+
+void wbmbext_set_log(wbmbext_ctx_t * ctx, wbmbext_log_cb_t cb, void * arg, int debug);
+
+// запись всех переданных и принятых данных; задается до wbmbext_configure, чтобы попала запись сессии
+void wbmbext_set_capture(wbmbext_ctx_t * ctx, bus_capture_t * capture);
+
+int wbmbext_open(wbmbext_ctx_t * ctx, const char * device);
+
+void wbmbext_close(wbmbext_ctx_t * ctx);
+
+int wbmbext_baud_supported(int baud);
+
+int wbmbext_parity_supported(char parity);
+
+// настройка порта и расчет временных параметров шины по фактическому формату кадра
+int wbmbext_configure(wbmbext_ctx_t * ctx, int baud, char parity, uint64_t timing_margin_ns);
+
+/*
+    Повторы запроса после ошибки CRC, неожиданного ответа или отсутствия ответа
+
+    Запрос повторяется тем же кадром: чтение по серийному номеру - тем же чтением,
+    запрос событий - с тем же подтверждением. Устройство, чей ответ на сканирование
+    испорчен, уже отметило себя найденным, поэтому проход сканирования с ошибками
+    доводится до конца и повторяется целиком с SCAN INIT, результаты проходов
+    объединяются; retries для TXN_SCAN_INIT - количество дополнительных проходов.
+    Отсутствие ответа на SCAN INIT - пустая шина, не ошибка.
+    По умолчанию WBMBEXT_RETRIES_DEFAULT для всех запросов кроме TXN_OTHER.
+*/
+void wbmbext_set_retries(wbmbext_ctx_t * ctx, txn_type_t type, int retries);
+
+// пауза перед каждым запросом вместо 3.5 символов, 0 - по умолчанию; задается после wbmbext_configure
+void wbmbext_set_frame_gap(wbmbext_ctx_t * ctx, uint64_t gap_ns);
+
+// сброс принятых, но не разобранных данных (например после смены настроек порта)
+void wbmbext_flush_input(wbmbext_ctx_t * ctx);
+
+/*
+    Сканирование шины командами 0x01/0x02, только серийные номера и адреса
+
+    Возвращает количество найденных устройств (не больше max), complete - получен ответ
+    об окончании сканирования 0x04. Без ответа на SCAN INIT сканирование заканчивается
+    по таймауту, проход с ошибками повторяется (см. wbmbext_set_retries).
+*/
+int wbmbext_scan(wbmbext_ctx_t * ctx, uint8_t ext_cmd, dev_info_t * devices, int max, int * complete);
+
+// чтение регистров по серийному номеру (0x08), fc 1..4, для 1 и 2 в values по значению на бит
+int wbmbext_read_regs(wbmbext_ctx_t * ctx, uint8_t ext_cmd, uint32_t serial, uint8_t fc,
+    uint16_t address, uint16_t count, uint16_t * values);
+
+// чтение выбранных полей информации об устройстве, возвращает количество запросов к устройству
+int wbmbext_read_dev_info(wbmbext_ctx_t * ctx, uint8_t ext_cmd, dev_info_t * dev, unsigned mask);
+
+// запись одного holding регистра по серийному номеру (fc 6)
+int wbmbext_write_reg(wbmbext_ctx_t * ctx, uint8_t ext_cmd, uint32_t serial, uint16_t address, uint16_t value);
+
+int wbmbext_change_id(wbmbext_ctx_t * ctx, uint8_t ext_cmd, uint32_t serial, uint8_t new_id);
+
+// чтение адреса устройства из регистра 128 по серийному номеру
+int wbmbext_read_id(wbmbext_ctx_t * ctx, uint8_t ext_cmd, uint32_t serial, uint8_t * id);
+
+#define WBMBEXT_ID_MIN              1
+#define WBMBEXT_ID_MAX              247
+
+/*
+    Расчет адресов без повторов
+
+    Устройство, первым занявшее адрес (в порядке списка), его сохраняет. Остальным
+    устройствам с тем же адресом и устройствам с недопустимым адресом назначается
+    наименьший свободный адрес вне зарезервированного диапазона reserved_min..reserved_max
+    (пустой диапазон, если reserved_min > reserved_max).
+
+    new_ids[i] - новый адрес устройства или 0, если адрес не меняется.
+    Возвращает количество устройств со сменой адреса или WBMBEXT_ERR_ARG, если свободных адресов не хватает.
+*/
+int wbmbext_plan_ids(const dev_info_t * devices, int num, int reserved_min, int reserved_max, uint8_t * new_ids);
+
+/*
+    Запрос событий 0x10 с подтверждением предыдущего пакета
+
+    Возвращает длину кадра ответа или код ошибки. resp->sub_cmd - CMD_EXT_EVENTS_RESP
+    или CMD_EXT_EVENTS_END, если событий нет; resp указывает в буфер приема контекста
+    до следующего обмена.
+*/
+int wbmbext_event_request(wbmbext_ctx_t * ctx, uint8_t min_slave, uint8_t max_event_len,
+    uint8_t confirm_slave_id, uint8_t flag, struct ext_modbus_event_resp ** resp);
+
+// очередное событие пакета: 1 - событие в e, 0 - события кончились, WBMBEXT_ERR_FRAME - пакет обрезан
+int wbmbext_event_next(const struct ext_modbus_event_resp * resp, unsigned * index, const event_in_buffer_t ** e);
+
+/*
+    Пропуск событий, уже полученных из прошлого пакета устройства
+
+    Устройство, не получившее подтверждение, повторяет пакет с тем же флагом, дополнив его
+    новыми событиями. Полученными считаются только данные, с которых пакет начинается и
+    которые целиком совпадают с прошлым пакетом: новое событие, побайтно совпадающее со
+    старым (coil 1 -> 0 -> 1), не теряется.
+*/
+typedef struct {
+    int8_t flag;                // -1 - пакетов от устройства еще не было
+    uint8_t data_len;
+    uint8_t data[256];
+} wbmbext_event_packet_t;
+
+// сброс пакетов num устройств: от них еще ничего не принято
+void wbmbext_event_packets_init(wbmbext_event_packet_t * packets, int num);
+
+// сколько байт данных resp уже получено: события, которые кончаются не дальше, пропускаются
+unsigned wbmbext_event_skip_len(const wbmbext_event_packet_t * last, const struct ext_modbus_event_resp * resp);
+
+// resp становится последним пакетом устройства
+void wbmbext_event_packet_save(wbmbext_event_packet_t * last, const struct ext_modbus_event_resp * resp);
+
+/*
+    Планировщик запросов событий
+
+    Предел длины данных событий в ответе рассчитывается из скорости шины так, чтобы
+    цикл запрос-ответ укладывался в target_cycle_ns: длинный пакет одного устройства
+    не задерживает события остальных дольше одного цикла.
+
+    Арбитраж выигрывает устройство с наименьшим адресом, поэтому устройства с меньшими
+    адресами могут занимать шину подряд, даже если у каждого пакет без остатка. После
+    streak_limit ответов с событиями подряд начинается обход: min_slave каждый раз
+    сдвигается за адрес ответившего устройства, и каждое устройство с событиями за ним
+    отдает один пакет. Ответ 0x12 или отсутствие ответа завершает обход, min_slave
+    возвращается к base_min_slave. В начале обхода min_slave = адрес ответившего + 1, а
+    ответил тот, у кого наименьший адрес среди устройств с событиями, поэтому каждое
+    устройство с событиями обслуживается не позже чем через streak_limit + N + 1 циклов,
+    где N - количество устройств с событиями (если ответы не теряются: потерянный ответ
+    завершает обход раньше).
+*/
+#define WBMBEXT_EVENT_LEN_MIN       16      // пакет должен вмещать хотя бы одно событие
+#define WBMBEXT_EVENT_STREAK_LIMIT  4
+
+typedef struct {
+    uint8_t max_event_len;      // предел длины данных для следующего запроса
+    uint8_t min_slave;          // min_slave для следующего запроса
+    uint8_t base_min_slave;
+    int sweep;                  // идет обход устройств за min_slave
+    int streak;                 // ответов с событиями подряд с начала опроса от base_min_slave
+    int streak_limit;
+    uint32_t rotations;         // сколько раз начинался обход
+} wbmbext_event_sched_t;
+
+// target_cycle_ns 0 - предел длины не рассчитывается, используется max_event_len
+void wbmbext_event_sched_init(wbmbext_event_sched_t * sched, const wbmbext_ctx_t * ctx, uint64_t target_cycle_ns,
+    uint8_t max_event_len, uint8_t base_min_slave);
+
+// учет результата запроса: len - результат wbmbext_event_request
+void wbmbext_event_sched_update(wbmbext_event_sched_t * sched, int len, const struct ext_modbus_event_resp * resp);
+
+#define WBMBEXT_EVENT_CTRL_DISABLED     0
+#define WBMBEXT_EVENT_CTRL_LOW          1
+#define WBMBEXT_EVENT_CTRL_HIGH         2
+
+typedef struct {
+    uint8_t type;
+    uint16_t address;
+    uint8_t ctrl;           // WBMBEXT_EVENT_CTRL_*
+    uint8_t enabled;        // результат: устройство подтвердило отправку событий регистра
+    uint8_t done;           // получен ответ на кадр с этой настройкой
+} wbmbext_event_setting_t;
+
+/*
+    Настройка отправки событий набора регистров одного устройства (0x18)
+
+    Настройки сортируются по типу и адресу, регистры с соседними адресами объединяются
+    в диапазоны, в каждый кадр упаковывается столько диапазонов, сколько помещается.
+    По битовым маскам ответа заполняются enabled и done каждой настройки.
+
+    Возвращает количество настроек, результат которых совпал с запрошенным (включено
+    для ctrl 1, 2 и выключено для 0), или код ошибки первого неудачного кадра.
+    frames - количество отправленных кадров, может быть NULL.
+*/
+int wbmbext_event_setup(wbmbext_ctx_t * ctx, uint8_t slave_id, wbmbext_event_setting_t * settings, int num, int * frames);
+
+// настройка отправки события одного регистра (0x18)
+int wbmbext_event_ctrl(wbmbext_ctx_t * ctx, uint8_t slave_id, uint8_t type, uint16_t address, uint8_t ctrl);